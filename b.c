@@ -1,29 +1,54 @@
 #include "b.h"
+#include <sys/resource.h>
+#include <sys/wait.h>
 
 #define OBJ_DIR "obj"
 #define PROG_NAME "anum"
 #define GCC "gcc"
 #define FLAGS "-Wall -Wextra -g -O2"
 
-int main(void) {
+#define BENCH_DIR "bench"
+#define BENCH_OBJ_DIR "obj/bench"
+#define BENCH_PROG_NAME "obj/bench/anum"
+#define BENCH_FLAGS "-O3 -DNDEBUG"
+#define BENCH_RUNS 10
+#define BENCH_STATS "obj/bench/stats.json"
 
-  INFO("Start building Annuum\n");
+// generated script stresses tokenizer and parser , few hundred helpers and
+// many lines calling them like our generated scripts do
+#define BENCH_GENERATED "obj/bench/generated.ann"
+#define BENCH_GENERATED_HELPERS 300
+#define BENCH_GENERATED_VARS 400
+#define BENCH_GENERATED_LINES 100000
 
-  if (!dir_exists(OBJ_DIR))
-    make_dir(OBJ_DIR, 0755);
+// every test script runs on every engine , its stdout must equal .out next to
+// it. When .err is there too , script must fail , its stdout must start with
+// .out and error printed after it (or to stderr) must contain first line of
+// .err.
+#define TEST_DIR "tests"
+#define TEST_OBJ_DIR "obj/test"
+#define TEST_STDOUT "obj/test/stdout.txt"
+#define TEST_STDERR "obj/test/stderr.txt"
+
+// NULL is default engine , vm with jit
+static const char *test_engines[] = {NULL, "--no-jit", "--tree"};
+
+static void build(char *obj_dir_name, char *prog_name, char *flags) {
+  if (!dir_exists(obj_dir_name))
+    make_dir(obj_dir_name, 0755);
 
   Array *c_filse = find_all_files("./src", "c");
 
   char *current_dir = pwd();
-  char *obj_dir = pathjoin(current_dir, OBJ_DIR);
+  char *obj_dir = pathjoin(current_dir, obj_dir_name);
 
   Array *o_files = array_new(c_filse->count);
   for (size_t i = 0; i < c_filse->count; i++) {
     char* name = path_basename((char *)c_filse->items[i]);
     char* obj_file_path = pathjoin(obj_dir , name);
     obj_file_path = change_extension(obj_file_path , "o");
-    
-    RUN(GCC , "-c" , (char *)c_filse->items[i] , "-o" , obj_file_path , FLAGS);
+
+    RUN(GCC , "-c" , (char *)c_filse->items[i] , "-o" , obj_file_path , flags);
 
     array_add(o_files , obj_file_path);
   }
@@ -32,9 +57,249 @@ int main(void) {
 
   for(size_t i = 1 ; i < o_files->count; i++){
     objs = strcat_new(objs , " ");
-    objs = strcat_new(objs , o_files->items[i]); 
+    objs = strcat_new(objs , o_files->items[i]);
+  }
+
+  RUN(GCC , objs , "-o" , prog_name);
+}
+
+static void generate_bench_script(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (!file)
+    ERROR("Failed to open file %s for writing", path);
+
+  for (int i = 0; i < BENCH_GENERATED_HELPERS; i++)
+    fprintf(file, "fn helper_%d(x, y) -> x + y * %d;\n", i, i % 7);
+
+  for (int i = 0; i < BENCH_GENERATED_VARS; i++)
+    fprintf(file, "value_%d = %d.5;\n", i, i);
+
+  for (int i = 0; i < BENCH_GENERATED_LINES; i++)
+    fprintf(file, "value_%d = helper_%d(value_%d , value_%d) / 2; // line %d\n",
+            i % BENCH_GENERATED_VARS, i % BENCH_GENERATED_HELPERS,
+            (i + 1) % BENCH_GENERATED_VARS, (i + 7) % BENCH_GENERATED_VARS, i);
+
+  fprintf(file, "print(value_0);\n");
+  fclose(file);
+}
+
+typedef struct {
+  double wall_ms;
+  long max_rss_kb;
+  double bytes_allocated;
+  // calls plus loop iterations , counted by interpreter and jit alike
+  double steps;
+  double execute_ns;
+} bench_run;
+
+// reads one number by key from json written by 'anum --stats'
+static double stats_value(const char *json, const char *key) {
+  char pattern[64];
+  snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+  const char *at = strstr(json, pattern);
+  return at ? strtod(strchr(at, ':') + 1, NULL) : 0;
+}
+
+static bench_run run_bench_once(const char *script) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  pid_t pid = fork();
+  if (pid < 0)
+    ERROR("Failed to fork for bench %s", script);
+
+  if (pid == 0) {
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0)
+      dup2(null_fd, STDOUT_FILENO);
+    int stats_fd = open(BENCH_STATS, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (stats_fd >= 0)
+      dup2(stats_fd, STDERR_FILENO);
+    execl(BENCH_PROG_NAME, BENCH_PROG_NAME, "--stats", script, (char *)NULL);
+    _exit(127);
+  }
+
+  int status = 0;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) < 0)
+    ERROR("Failed to wait bench %s", script);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    ERROR("Bench %s failed with status %d", script, status);
+
+  char json[4096] = {0};
+  FILE *stats = fopen(BENCH_STATS, "r");
+  if (!stats)
+    ERROR("Bench %s wrote no stats", script);
+  fread(json, 1, sizeof(json) - 1, stats);
+  fclose(stats);
+
+  bench_run run = {
+      .wall_ms = (end.tv_sec - start.tv_sec) * 1e3 +
+                 (end.tv_nsec - start.tv_nsec) / 1e6,
+      .max_rss_kb = usage.ru_maxrss,
+      .bytes_allocated = stats_value(json, "bytes_allocated"),
+      .steps = stats_value(json, "function_calls") +
+               stats_value(json, "loop_iterations"),
+      .execute_ns = stats_value(json, "execute"),
+  };
+  return run;
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// nearest rank percentile of sorted samples
+static double percentile(const double *sorted, int count, double p) {
+  int rank = (int)(p * count + 0.999999);
+  if (rank < 1)
+    rank = 1;
+  if (rank > count)
+    rank = count;
+  return sorted[rank - 1];
+}
+
+static void run_bench(const char *script, int runs) {
+  double *samples = malloc(sizeof(double) * runs);
+  if (!samples)
+    ERROR("Failed to allocate memory for bench samples");
+
+  // allocations and steps are the same for every run , time per step is taken
+  // from fastest run
+  bench_run last = {0};
+  double best_execute_ns = 0;
+  long max_rss_kb = 0;
+  for (int i = 0; i < runs; i++) {
+    last = run_bench_once(script);
+    samples[i] = last.wall_ms;
+    if (last.max_rss_kb > max_rss_kb)
+      max_rss_kb = last.max_rss_kb;
+    if (i == 0 || last.execute_ns < best_execute_ns)
+      best_execute_ns = last.execute_ns;
   }
 
-  RUN(GCC , objs , "-o" , PROG_NAME);
+  qsort(samples, runs, sizeof(double), compare_double);
+  printf("%-20s %10.3f %10.3f %10.3f %10ld %12.0f %10.2f\n",
+         path_basename(script), percentile(samples, runs, 0.5),
+         percentile(samples, runs, 0.99), samples[0], max_rss_kb,
+         last.bytes_allocated,
+         last.steps ? best_execute_ns / last.steps : 0.0);
+  free(samples);
+}
+
+static void bench(int runs) {
+  if (runs < 1)
+    ERROR("Bench needs at least one run per case , got %d", runs);
+
+  INFO("Start benchmarking Annuum , %d runs per case\n", runs);
+
+  if (!dir_exists(OBJ_DIR))
+    make_dir(OBJ_DIR, 0755);
+  build(BENCH_OBJ_DIR, BENCH_PROG_NAME, BENCH_FLAGS);
+  generate_bench_script(BENCH_GENERATED);
+
+  Array *scripts = find_all_files(BENCH_DIR, "ann");
+  array_add(scripts, BENCH_GENERATED);
+
+  printf("%-20s %10s %10s %10s %10s %12s %10s\n", "CASE", "MEDIAN ms",
+         "P99 ms", "MIN ms", "RSS KB", "ALLOC B", "NS/STEP");
+  for (int i = 0; i < scripts->count; i++)
+    run_bench(scripts->items[i], runs);
+}
+
+// exit status of script , its stdout and stderr go to TEST_STDOUT and
+// TEST_STDERR
+static int run_test_once(const char *script, const char *engine) {
+  pid_t pid = fork();
+  if (pid < 0)
+    ERROR("Failed to fork for test %s", script);
+
+  if (pid == 0) {
+    int out_fd = open(TEST_STDOUT, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int err_fd = open(TEST_STDERR, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0 || err_fd < 0)
+      _exit(127);
+    dup2(out_fd, STDOUT_FILENO);
+    dup2(err_fd, STDERR_FILENO);
+    if (engine)
+      execl(PROG_NAME, PROG_NAME, engine, script, (char *)NULL);
+    else
+      execl(PROG_NAME, PROG_NAME, script, (char *)NULL);
+    _exit(127);
+  }
+
+  int status = 0;
+  if (waitpid(pid, &status, 0) < 0)
+    ERROR("Failed to wait test %s", script);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static bool run_test(const char *script, const char *engine) {
+  char *expected_out = read_from_file(change_extension((char *)script, "out"));
+  char *err_path = change_extension((char *)script, "err");
+  char *expected_err = file_exists(err_path) ? read_from_file(err_path) : NULL;
+  if (expected_err)
+    expected_err[strcspn(expected_err, "\n")] = '\0';
+
+  int status = run_test_once(script, engine);
+  char *out = read_from_file(TEST_STDOUT);
+  char *err = read_from_file(TEST_STDERR);
+
+  bool passed;
+  if (expected_err) {
+    size_t length = strlen(expected_out);
+    passed = status != 0 && strncmp(out, expected_out, length) == 0 &&
+             (strstr(out + length, expected_err) || strstr(err, expected_err));
+  } else {
+    passed = status == 0 && strcmp(out, expected_out) == 0;
+  }
+
+  if (!passed) {
+    WARN("Test %s failed with %s , status %d\n", script,
+         engine ? engine : "default engine", status);
+    printf("expected stdout:\n%sgot stdout:\n%sgot stderr:\n%s", expected_out,
+           out, err);
+  }
+  free(expected_out);
+  free(expected_err);
+  free(out);
+  free(err);
+  return passed;
+}
+
+static int test(void) {
+  build(OBJ_DIR, PROG_NAME, FLAGS);
+  if (!dir_exists(TEST_OBJ_DIR))
+    make_dir(TEST_OBJ_DIR, 0755);
+
+  Array *scripts = find_all_files(TEST_DIR, "ann");
+  size_t engines = sizeof(test_engines) / sizeof(test_engines[0]);
+  int failed = 0;
+  for (int i = 0; i < scripts->count; i++) {
+    for (size_t j = 0; j < engines; j++)
+      failed += !run_test(scripts->items[i], test_engines[j]);
+  }
+
+  if (failed)
+    ERROR("%d of %zu test runs failed", failed, scripts->count * engines);
+  INFO("All %zu test runs passed\n", scripts->count * engines);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+    bench(argc > 2 ? atoi(argv[2]) : BENCH_RUNS);
+    return 0;
+  }
+
+  if (argc > 1 && strcmp(argv[1], "test") == 0)
+    return test();
+
+  INFO("Start building Annuum\n");
+  build(OBJ_DIR, PROG_NAME, FLAGS);
   return 0;
 }
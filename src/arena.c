@@ -0,0 +1,96 @@
+#include "arena.h"
+#include "logger.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN (sizeof(max_align_t))
+
+static arena_chunk *new_chunk(size_t capacity) {
+  arena_chunk *chunk = malloc(sizeof(arena_chunk) + capacity);
+  if (!chunk)
+    elog("Error allocation memory for arena chunk of %zu bytes", capacity);
+
+  STAT_ADD(bytes_allocated, sizeof(arena_chunk) + capacity);
+  chunk->next = NULL;
+  chunk->used = 0;
+  chunk->capacity = capacity;
+  return chunk;
+}
+
+arena_t *new_arena(size_t chunk_size) {
+  arena_t *arena = malloc(sizeof(arena_t));
+  if (!arena)
+    elog("Error allocation memory for arena");
+
+  arena->chunks = NULL;
+  arena->chunk_size = chunk_size ? chunk_size : ARENA_CHUNK_SIZE;
+  arena->allocated = 0;
+  return arena;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+  if (!arena)
+    elog("Can't allocate from null ptr on arena");
+
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  if (size == 0)
+    size = ARENA_ALIGN;
+
+  arena_chunk *chunk = arena->chunks;
+  if (!chunk || chunk->capacity - chunk->used < size) {
+    // big allocations get own chunk behind the current one , so free space
+    // of current chunk is not lost
+    if (size > arena->chunk_size / 4 && chunk) {
+      arena_chunk *big = new_chunk(size);
+      big->next = chunk->next;
+      chunk->next = big;
+      big->used = size;
+      arena->allocated += size;
+      return big->data;
+    }
+
+    chunk = new_chunk(size > arena->chunk_size ? size : arena->chunk_size);
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+  }
+
+  void *ptr = (char *)chunk->data + chunk->used;
+  chunk->used += size;
+  arena->allocated += size;
+  return ptr;
+}
+
+void *arena_copy(arena_t *arena, const void *src, size_t size) {
+  if (size == 0)
+    return NULL;
+  if (!src)
+    elog("Can't copy into arena from null ptr");
+
+  void *dst = arena_alloc(arena, size);
+  memcpy(dst, src, size);
+  return dst;
+}
+
+void arena_reset(arena_t *arena) {
+  if (!arena)
+    return;
+
+  arena_chunk *chunk = arena->chunks;
+  while (chunk) {
+    arena_chunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+
+  arena->chunks = NULL;
+  arena->allocated = 0;
+}
+
+void free_arena(arena_t *arena) {
+  if (!arena)
+    return;
+
+  arena_reset(arena);
+  free(arena);
+}
@@ -0,0 +1,29 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+typedef struct arena_chunk {
+  struct arena_chunk *next;
+  size_t used;
+  size_t capacity;
+  max_align_t data[];
+} arena_chunk;
+
+// Bump allocator , memory is never freed one by one , whole arena is
+// released by free_arena
+typedef struct arena_t {
+  arena_chunk *chunks;
+  size_t chunk_size;
+  size_t allocated;
+} arena_t;
+
+arena_t *new_arena(size_t chunk_size);
+void *arena_alloc(arena_t *arena, size_t size);
+void *arena_copy(arena_t *arena, const void *src, size_t size);
+void arena_reset(arena_t *arena);
+void free_arena(arena_t *arena);
+
+#endif
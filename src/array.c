@@ -0,0 +1,265 @@
+#include "array.h"
+#include "bytecode.h"
+#include "logger.h"
+#include "stats.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// indexes and lengths are exact doubles below 2^52 , like trips of ploop
+#define ARRAY_MAX_LENGTH 4503599627370496.0
+
+// headers of live arrays in open addressing set , arrays may be made by
+// chunks of ploop running on pool , so the set is locked. Roots may hold
+// handles of freed arrays (stale temporaries , copies of frames) , only
+// handles found in the set are followed.
+static pthread_mutex_t arrays_lock = PTHREAD_MUTEX_INITIALIZER;
+static array_t **arrays = NULL;
+static size_t array_count = 0;
+static size_t array_capacity = 0;
+
+static size_t live_bytes = 0;
+static size_t allocated_bytes = 0;
+static array_roots roots = NULL;
+static void *roots_context = NULL;
+static size_t holds = 0;
+
+// reached arrays whose elements are not visited yet
+static array_t **marking = NULL;
+static size_t marking_count = 0;
+static size_t marking_capacity = 0;
+
+static bool is_whole(double value) {
+  return value >= 0 && value < ARRAY_MAX_LENGTH &&
+         value == (double)(uint64_t)value;
+}
+
+// aligned_alloc needs size which is multiple of alignment
+static size_t data_bytes(size_t length) {
+  size_t bytes = (length * sizeof(double) + ARRAY_ALIGN - 1) / ARRAY_ALIGN *
+                 ARRAY_ALIGN;
+  return bytes ? bytes : ARRAY_ALIGN;
+}
+
+static size_t slot_of(const array_t *array, size_t capacity) {
+  uint64_t hash = (uint64_t)(uintptr_t)array * 0x9E3779B97F4A7C15u;
+  return (size_t)(hash >> 32) & (capacity - 1);
+}
+
+static void insert_array(array_t **set, size_t capacity, array_t *array) {
+  size_t slot = slot_of(array, capacity);
+  while (set[slot])
+    slot = (slot + 1) & (capacity - 1);
+  set[slot] = array;
+}
+
+static bool is_live(const array_t *array) {
+  if (array_count == 0)
+    return false;
+  size_t slot = slot_of(array, array_capacity);
+  while (arrays[slot]) {
+    if (arrays[slot] == array)
+      return true;
+    slot = (slot + 1) & (array_capacity - 1);
+  }
+  return false;
+}
+
+// set is kept at most half full , it is rebuilt with 'count' arrays of old
+// one which 'keep' accepts
+static void rebuild_arrays(size_t count, bool (*keep)(array_t *array)) {
+  size_t capacity = 64;
+  while (capacity < count * 2)
+    capacity *= 2;
+  array_t **set = calloc(capacity, sizeof(array_t *));
+  if (!set)
+    elog("Error allocation memory for set of arrays");
+
+  for (size_t i = 0; i < array_capacity; i++)
+    if (arrays[i] && keep(arrays[i]))
+      insert_array(set, capacity, arrays[i]);
+  free(arrays);
+  arrays = set;
+  array_capacity = capacity;
+}
+
+static bool keep_any(array_t *array) {
+  (void)array;
+  return true;
+}
+
+static void mark_values(const double *values, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (!is_array(values[i]))
+      continue;
+    array_t *array = array_header(values[i]);
+    if (array->marked || !is_live(array))
+      continue;
+
+    array->marked = true;
+    if (marking_count >= marking_capacity) {
+      marking_capacity = marking_capacity ? marking_capacity * 2 : 64;
+      marking = realloc(marking, sizeof(array_t *) * marking_capacity);
+      if (!marking)
+        elog("Error allocation memory for collection of arrays");
+    }
+    marking[marking_count++] = array;
+  }
+}
+
+static void free_array(array_t *array) {
+  free(array->data);
+  free(array);
+}
+
+// unmarked arrays are freed , marks are cleared for next collection
+static bool keep_marked(array_t *array) {
+  if (!array->marked) {
+    free_array(array);
+    return false;
+  }
+  array->marked = false;
+  return true;
+}
+
+// arrays in elements are marked on heap stack , so nesting of arrays never
+// reaches C stack
+static void collect_arrays(void) {
+  roots(roots_context, mark_values);
+  size_t count = 0;
+  live_bytes = 0;
+  while (marking_count > 0) {
+    array_t *array = marking[--marking_count];
+    count++;
+    live_bytes += sizeof(array_t) + data_bytes(array->length);
+    mark_values(array->data, array->length);
+  }
+  rebuild_arrays(count, keep_marked);
+  array_count = count;
+  allocated_bytes = 0;
+}
+
+double new_array(double length) {
+  if (!is_whole(length))
+    elog("Length of array must be whole number from 0 , got %g", length);
+
+  size_t count = (size_t)length;
+  size_t bytes = data_bytes(count);
+  pthread_mutex_lock(&arrays_lock);
+  size_t limit = live_bytes > ARRAY_GC_MIN_BYTES ? live_bytes
+                                                 : ARRAY_GC_MIN_BYTES;
+  if (roots && holds == 0 && allocated_bytes + bytes > limit)
+    collect_arrays();
+
+  array_t *array = malloc(sizeof(array_t));
+  double *data = aligned_alloc(ARRAY_ALIGN, bytes);
+  if (!array || !data)
+    elog("Error allocation memory for array of %zu numbers", count);
+  memset(data, 0, bytes);
+  STAT_ADD(bytes_allocated, sizeof(array_t) + bytes);
+
+  array->data = data;
+  array->length = count;
+  array->marked = false;
+  if ((array_count + 1) * 2 > array_capacity)
+    rebuild_arrays(array_count + 1, keep_any);
+  insert_array(arrays, array_capacity, array);
+  array_count++;
+  allocated_bytes += sizeof(array_t) + bytes;
+  pthread_mutex_unlock(&arrays_lock);
+
+  uint64_t bits = (uint64_t)ARRAY_TAG << ARRAY_TAG_SHIFT | (uintptr_t)array;
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+array_t *to_array(double value) {
+  if (!is_array(value))
+    elog("Value %g is not an array", value);
+  return array_header(value);
+}
+
+static size_t array_index(array_t *array, double index) {
+  if (!(index >= 0 && index < (double)array->length))
+    elog("Index %g is out of array of length %zu", index, array->length);
+  if (index != (double)(size_t)index)
+    elog("Index %g of array is not whole number", index);
+  return (size_t)index;
+}
+
+double array_get(double array, double index) {
+  array_t *header = to_array(array);
+  return header->data[array_index(header, index)];
+}
+
+void array_set(double array, double index, double value) {
+  array_t *header = to_array(array);
+  header->data[array_index(header, index)] = value;
+}
+
+// counter goes from start by whole steps , so first and last trip bound every
+// index and they are exact below 2^52
+bool array_fits(const double *loop, double array, int offset) {
+  double trips = range_trips(loop[0], loop[1], loop[2]);
+  if (!(trips > 0))
+    return true;
+  if (!is_array(array))
+    return false;
+
+  double first = loop[0] + offset;
+  double last = loop[0] + (trips - 1) * loop[2] + offset;
+  double low = first < last ? first : last;
+  double high = first < last ? last : first;
+  if (!is_whole(low) || !(high < (double)array_header(array)->length))
+    return false;
+  // step matters only when there is second trip , then it is below length
+  return trips == 1 || loop[2] == (double)(int64_t)loop[2];
+}
+
+void check_operands(double one, double two) {
+  if (is_array(one) || is_array(two))
+    elog("Operators take numbers , not arrays , use builtins on whole arrays");
+}
+
+void print_value(double value) {
+  if (is_array(value))
+    printf("array(%zu)\n", array_header(value)->length);
+  else
+    printf("%g\n", value);
+}
+
+void arrays_set_roots(array_roots engine_roots, void *context) {
+  pthread_mutex_lock(&arrays_lock);
+  roots = engine_roots;
+  roots_context = context;
+  pthread_mutex_unlock(&arrays_lock);
+}
+
+void arrays_hold(void) {
+  pthread_mutex_lock(&arrays_lock);
+  holds++;
+  pthread_mutex_unlock(&arrays_lock);
+}
+
+void arrays_release(void) {
+  pthread_mutex_lock(&arrays_lock);
+  holds--;
+  pthread_mutex_unlock(&arrays_lock);
+}
+
+void free_arrays(void) {
+  pthread_mutex_lock(&arrays_lock);
+  for (size_t i = 0; i < array_capacity; i++)
+    if (arrays[i])
+      free_array(arrays[i]);
+  free(arrays);
+  free(marking);
+  arrays = NULL;
+  marking = NULL;
+  array_count = array_capacity = marking_count = marking_capacity = 0;
+  live_bytes = allocated_bytes = 0;
+  roots = NULL;
+  roots_context = NULL;
+  pthread_mutex_unlock(&arrays_lock);
+}
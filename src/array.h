@@ -0,0 +1,80 @@
+#ifndef ARRAY_H
+#define ARRAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Arrays of numbers live outside of frames , value of array is quiet nan
+// whose payload is address of its header , so registers , slots and native
+// code keep holding plain doubles. Arithmetic never makes such payload from
+// numbers (nan of 0 / 0 or inf - inf has other high bits), it only passes
+// payload of nan operand along. Arrays are shared by every copy of value and
+// have fixed length. Engine running script hands its roots over , arrays not
+// reachable from them or from elements of reachable ones are freed once
+// enough memory was allocated since last collection.
+#define ARRAY_TAG 0x7FFCu
+#define ARRAY_TAG_SHIFT 48
+#define ARRAY_ALIGN 64
+
+// collection starts when bytes allocated since the last one reach bytes
+// still live after it , but at least ARRAY_GC_MIN_BYTES
+#define ARRAY_GC_MIN_BYTES (16 * 1024 * 1024)
+
+typedef struct array_t {
+  // ARRAY_ALIGN aligned , zeroed on creation
+  double *data;
+  size_t length;
+  // reached by collection running now
+  bool marked;
+} array_t;
+
+// values which may hold arrays , visit may get any doubles , handles of
+// freed arrays included
+typedef void (*array_visit)(const double *values, size_t count);
+// engine calls visit for every value it keeps , NULL roots stop collection
+typedef void (*array_roots)(void *context, array_visit visit);
+
+static inline bool is_array(double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits >> ARRAY_TAG_SHIFT == ARRAY_TAG;
+}
+
+// header of value which is known to be array
+static inline array_t *array_header(double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return (array_t *)(uintptr_t)(bits & (((uint64_t)1 << ARRAY_TAG_SHIFT) - 1));
+}
+
+double new_array(double length);
+array_t *to_array(double value);
+
+// bounds checked access , index must be whole number inside of array
+double array_get(double array, double index);
+void array_set(double array, double index, double value);
+
+// true when range loop 'loop[0]..loop[1] step loop[2]' has no trips or every
+// 'counter + offset' it makes is whole index inside of 'array' , so accesses
+// at them need no check
+bool array_fits(const double *loop, double array, int offset);
+
+// operators take only numbers , arrays are nans , so engines check operands
+// only when result of arithmetic is nan or operands of comparison are
+// unordered
+void check_operands(double one, double two);
+
+// numbers as '%g' , arrays as 'array(length)'
+void print_value(double value);
+
+void arrays_set_roots(array_roots roots, void *context);
+// nothing is collected between hold and release , ploop holds arrays while
+// chunks keep values in copies of frames and on other threads
+void arrays_hold(void);
+void arrays_release(void);
+// frees every array , live or not , at the end of run
+void free_arrays(void);
+
+#endif
@@ -0,0 +1,129 @@
+#include "builtin.h"
+#include "array.h"
+#include "logger.h"
+#include "simd.h"
+
+static double builtin_array(const double *args) { return new_array(args[0]); }
+
+static double builtin_len(const double *args) {
+  return (double)to_array(args[0])->length;
+}
+
+static void check_lengths(const array_t *one, const array_t *two) {
+  if (one->length != two->length)
+    elog("Arrays of length %zu and %zu can't be combined", one->length,
+         two->length);
+}
+
+// operand of element-wise builtin , array of 'dst' length or number repeated
+// in 'fill'
+static const double *operand(double value, const array_t *dst, double *fill,
+                             size_t *step) {
+  if (!is_array(value)) {
+    for (size_t i = 0; i < SIMD_WIDTH; i++)
+      fill[i] = value;
+    *step = 0;
+    return fill;
+  }
+
+  array_t *array = array_header(value);
+  check_lengths(dst, array);
+  *step = 1;
+  return array->data;
+}
+
+// 'op(dst , one , two)' writes 'one op two' to every element of dst and
+// gives dst , arrays may be the same
+static double elementwise(simd_op op, const double *args) {
+  array_t *dst = to_array(args[0]);
+  double one_fill[SIMD_WIDTH];
+  double two_fill[SIMD_WIDTH];
+  size_t one_step, two_step;
+  const double *one = operand(args[1], dst, one_fill, &one_step);
+  const double *two = operand(args[2], dst, two_fill, &two_step);
+
+  if (!simd()->arith(op, dst->data, one, one_step, two, two_step,
+                     dst->length))
+    elog("Can't divide by zero");
+  return args[0];
+}
+
+static double builtin_add(const double *args) {
+  return elementwise(SIMD_ADD, args);
+}
+
+static double builtin_sub(const double *args) {
+  return elementwise(SIMD_SUB, args);
+}
+
+static double builtin_mul(const double *args) {
+  return elementwise(SIMD_MUL, args);
+}
+
+static double builtin_div(const double *args) {
+  return elementwise(SIMD_DIV, args);
+}
+
+// 'scale(a , k)' is 'mul(a , a , k)'
+static double builtin_scale(const double *args) {
+  const double operands[] = {args[0], args[0], args[1]};
+  return elementwise(SIMD_MUL, operands);
+}
+
+static double builtin_sum(const double *args) {
+  array_t *array = to_array(args[0]);
+  return simd()->sum(array->data, array->length);
+}
+
+static double builtin_dot(const double *args) {
+  array_t *one = to_array(args[0]);
+  array_t *two = to_array(args[1]);
+  check_lengths(one, two);
+  return simd()->dot(one->data, two->data, one->length);
+}
+
+static double builtin_min(const double *args) {
+  array_t *array = to_array(args[0]);
+  return simd()->min(array->data, array->length);
+}
+
+static double builtin_max(const double *args) {
+  array_t *array = to_array(args[0]);
+  return simd()->max(array->data, array->length);
+}
+
+// 'axpy(k , x , y)' adds k * x to y and gives y
+static double builtin_axpy(const double *args) {
+  if (is_array(args[0]))
+    elog("Factor of axpy must be a number , not an array");
+  array_t *x = to_array(args[1]);
+  array_t *y = to_array(args[2]);
+  check_lengths(x, y);
+  simd()->axpy(args[0], x->data, y->data, y->length);
+  return args[2];
+}
+
+const builtin builtins[] = {
+    {.name = "array", .param_count = 1, .fn = builtin_array},
+    {.name = "len", .param_count = 1, .fn = builtin_len},
+    {.name = "add", .param_count = 3, .fn = builtin_add},
+    {.name = "sub", .param_count = 3, .fn = builtin_sub},
+    {.name = "mul", .param_count = 3, .fn = builtin_mul},
+    {.name = "div", .param_count = 3, .fn = builtin_div},
+    {.name = "scale", .param_count = 2, .fn = builtin_scale},
+    {.name = "sum", .param_count = 1, .fn = builtin_sum},
+    {.name = "dot", .param_count = 2, .fn = builtin_dot},
+    {.name = "min", .param_count = 1, .fn = builtin_min},
+    {.name = "max", .param_count = 1, .fn = builtin_max},
+    {.name = "axpy", .param_count = 3, .fn = builtin_axpy},
+};
+
+const size_t builtin_count = sizeof(builtins) / sizeof(builtins[0]);
+
+const builtin *find_builtin(symbol_t name) {
+  for (size_t i = 0; i < builtin_count; i++) {
+    if (intern_cstr(builtins[i].name) == name)
+      return &builtins[i];
+  }
+  return NULL;
+}
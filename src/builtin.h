@@ -0,0 +1,25 @@
+#ifndef BUILTIN_H
+#define BUILTIN_H
+
+#include <stddef.h>
+
+#include "symbol.h"
+
+// Functions implemented in C , call of builtin takes its arguments from
+// consecutive registers and gives one number. Script which defines function
+// of the same name calls its own one instead.
+typedef double (*builtin_fn)(const double *args);
+
+typedef struct builtin {
+  const char *name;
+  size_t param_count;
+  builtin_fn fn;
+} builtin;
+
+extern const builtin builtins[];
+extern const size_t builtin_count;
+
+// NULL when there is no builtin of that name
+const builtin *find_builtin(symbol_t name);
+
+#endif
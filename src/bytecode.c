@@ -0,0 +1,253 @@
+#include "bytecode.h"
+#include "array.h"
+#include "builtin.h"
+#include "jit.h"
+#include "logger.h"
+#include "memo.h"
+#include "ploop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OPCODE_NAME(op) #op,
+static const char *opcode_names[] = {OPCODE_LIST(OPCODE_NAME)};
+#undef OPCODE_NAME
+
+proto *new_proto(symbol_t name) {
+  if (name == NO_SYMBOL)
+    elog("Can't create proto without name");
+
+  proto *p = (proto *)calloc(1, sizeof(proto));
+  if (!p)
+    elog("Error allocation memory for proto struct");
+
+  p->name = name;
+  return p;
+}
+
+// entry of proto walk , nesting of functions never reaches C stack
+typedef struct proto_entry {
+  proto *p;
+  size_t depth;
+} proto_entry;
+
+void visit_protos(proto *p, proto_visit visit, void *context) {
+  if (!p)
+    return;
+
+  size_t count = 0;
+  size_t capacity = 16;
+  proto_entry *stack = malloc(sizeof(proto_entry) * capacity);
+  if (!stack)
+    elog("Error allocation memory for proto walk");
+  stack[count++] = (proto_entry){.p = p, .depth = 0};
+
+  while (count > 0) {
+    proto_entry entry = stack[--count];
+    if (count + entry.p->proto_count > capacity) {
+      while (count + entry.p->proto_count > capacity)
+        capacity *= 2;
+      stack = realloc(stack, sizeof(proto_entry) * capacity);
+      if (!stack)
+        elog("Error allocation memory for proto walk");
+    }
+    for (size_t i = entry.p->proto_count; i > 0; i--)
+      stack[count++] =
+          (proto_entry){.p = entry.p->protos[i - 1], .depth = entry.depth + 1};
+    visit(entry.p, entry.depth, context);
+  }
+  free(stack);
+}
+
+static void free_one_proto(proto *p, size_t depth, void *context) {
+  (void)depth;
+  (void)context;
+  free_jit_code(p->jit);
+  free_memo_table(p->memo);
+  free(p->names);
+  free(p->callees);
+  free(p->protos);
+  free(p->consts);
+  free(p->lines);
+  free(p->code);
+  free(p);
+}
+
+void free_proto(proto *p) { visit_protos(p, free_one_proto, NULL); }
+
+size_t proto_emit(proto *p, opcode op, uint16_t a, uint16_t b, uint16_t c) {
+  if (!p)
+    elog("Can't emit instruction to null ptr on proto");
+
+  if (p->code_count >= p->code_capacity) {
+    p->code_capacity = p->code_capacity ? p->code_capacity * 2 : 16;
+    p->code = realloc(p->code, sizeof(instr) * p->code_capacity);
+    p->lines = realloc(p->lines, sizeof(uint32_t) * p->code_capacity);
+    if (!p->code || !p->lines)
+      elog("Error allocation memory for proto code");
+  }
+
+  p->code[p->code_count] = (instr){.op = op, .a = a, .b = b, .c = c};
+  p->lines[p->code_count] = p->line;
+  return p->code_count++;
+}
+
+size_t proto_emit_bx(proto *p, opcode op, uint16_t a, uint32_t bx) {
+  return proto_emit(p, op, a, (uint16_t)(bx & 0xFFFF), (uint16_t)(bx >> 16));
+}
+
+void proto_patch_bx(proto *p, size_t at, uint32_t bx) {
+  if (!p || at >= p->code_count)
+    elog("Can't patch instruction %zu , out of proto code", at);
+
+  p->code[at].b = (uint16_t)(bx & 0xFFFF);
+  p->code[at].c = (uint16_t)(bx >> 16);
+}
+
+uint32_t proto_add_const(proto *p, double value) {
+  if (!p)
+    elog("Can't add constant to null ptr on proto");
+
+  for (size_t i = 0; i < p->const_count; i++) {
+    if (memcmp(&p->consts[i], &value, sizeof(double)) == 0)
+      return (uint32_t)i;
+  }
+
+  if (p->const_count >= p->const_capacity) {
+    p->const_capacity = p->const_capacity ? p->const_capacity * 2 : 8;
+    p->consts = realloc(p->consts, sizeof(double) * p->const_capacity);
+    if (!p->consts)
+      elog("Error allocation memory for proto constants");
+  }
+
+  p->consts[p->const_count] = value;
+  return (uint32_t)p->const_count++;
+}
+
+uint32_t proto_add_name(proto *p, symbol_t name) {
+  if (!p)
+    elog("Can't add name to null ptr on proto");
+  if (name == NO_SYMBOL)
+    elog("Can't add empty name to proto");
+
+  for (size_t i = 0; i < p->name_count; i++) {
+    if (p->names[i] == name)
+      return (uint32_t)i;
+  }
+
+  if (p->name_count >= p->name_capacity) {
+    p->name_capacity = p->name_capacity ? p->name_capacity * 2 : 8;
+    p->names = realloc(p->names, sizeof(symbol_t) * p->name_capacity);
+    p->callees = realloc(p->callees, sizeof(proto *) * p->name_capacity);
+    if (!p->names || !p->callees)
+      elog("Error allocation memory for proto names");
+  }
+
+  p->names[p->name_count] = name;
+  p->callees[p->name_count] = NULL;
+  return (uint32_t)p->name_count++;
+}
+
+uint32_t proto_add_proto(proto *p, proto *child) {
+  if (!p || !child)
+    elog("Can't add nested proto , null ptr on proto or child");
+
+  if (p->proto_count >= p->proto_capacity) {
+    p->proto_capacity = p->proto_capacity ? p->proto_capacity * 2 : 4;
+    p->protos = realloc(p->protos, sizeof(proto *) * p->proto_capacity);
+    if (!p->protos)
+      elog("Error allocation memory for nested protos");
+  }
+
+  p->protos[p->proto_count] = child;
+  return (uint32_t)p->proto_count++;
+}
+
+// doubles from 2^52 up have no fraction , smaller quotient is rounded up
+// through int64 , so no libm is needed
+#define RANGE_WHOLE 4503599627370496.0
+
+double range_trips(double start, double end, double step) {
+  if (is_array(start) || is_array(end) || is_array(step))
+    elog("Range of loop takes numbers , not arrays");
+  if (step == 0)
+    elog("Loop step can't be zero");
+
+  double trips = (end - start) / step;
+  if (!(trips > 0))
+    return 0.0;
+  if (trips >= RANGE_WHOLE)
+    return trips;
+
+  double whole = (double)(int64_t)trips;
+  return whole < trips ? whole + 1 : whole;
+}
+
+const char *opcode_to_str(opcode op) {
+  if (op >= OP_COUNT)
+    return "UNKNOWN";
+  return opcode_names[op];
+}
+
+static void print_one_proto(proto *p, size_t depth, void *context) {
+  int indent = *(int *)context + (int)depth;
+
+  printf("%*sPROTO %s (params: %zu , registers: %zu , constants: %zu)\n",
+         indent * 2, "", symbol_name(p->name), p->param_count, p->reg_count,
+         p->const_count);
+
+  for (size_t i = 0; i < p->code_count; i++) {
+    instr in = p->code[i];
+    printf("%*s  %4zu  [%4u]  %-11s %5u %5u %5u", indent * 2, "", i,
+           p->lines[i], opcode_to_str(in.op), in.a, in.b, in.c);
+
+    switch (in.op) {
+    case OP_LOADK:
+      printf("    ; %g", p->consts[INSTR_BX(in)]);
+      break;
+    case OP_ADDK:
+    case OP_SUBK:
+    case OP_MULK:
+    case OP_DIVK:
+      printf("    ; %g", p->consts[in.c]);
+      break;
+    case OP_IFLTK:
+    case OP_IFLEK:
+    case OP_IFGTK:
+    case OP_IFGEK:
+    case OP_IFEQK:
+    case OP_IFNEK:
+      printf("    ; %g", p->consts[in.b]);
+      break;
+    case OP_READ:
+    case OP_CALL:
+    case OP_TAILCALL:
+      printf("    ; %s", symbol_name(p->names[in.c]));
+      break;
+    case OP_JMP:
+    case OP_JMPF:
+    case OP_LOOP:
+      printf("    ; -> %u", INSTR_BX(in));
+      break;
+    case OP_DEFN:
+      printf("    ; %s", symbol_name(p->protos[in.b]->name));
+      break;
+    case OP_REDUCE:
+      printf("    ; %s", reduce_op_to_str((reduce_op)in.b));
+      break;
+    case OP_GUARD:
+      printf("    ; %+d", (int16_t)in.c);
+      break;
+    case OP_NATIVE:
+      printf("    ; %s", builtins[in.c].name);
+      break;
+    default:
+      break;
+    }
+    printf("\n");
+  }
+}
+
+void print_proto(proto *p, int indent) {
+  visit_protos(p, print_one_proto, &indent);
+}
@@ -0,0 +1,153 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "symbol.h"
+
+// R - registers of current frame (variable slots go first), K - constants,
+// N - names, P - nested protos
+#define OPCODE_LIST(X)                                                         \
+  X(OP_LOADK)  /* R[a] = K[bx]                                  */             \
+  X(OP_MOVE)   /* R[a] = R[b]                                   */             \
+  X(OP_READ)   /* OP_MOVE , fails when variable N[c] is unset   */             \
+  X(OP_ADD)    /* R[a] = R[b] + R[c]                            */             \
+  X(OP_SUB)    /* R[a] = R[b] - R[c]                            */             \
+  X(OP_MUL)    /* R[a] = R[b] * R[c]                            */             \
+  X(OP_DIV)    /* R[a] = R[b] / R[c]                            */             \
+  X(OP_LT)     /* R[a] = R[b] < R[c]                            */             \
+  X(OP_LE)     /* R[a] = R[b] <= R[c]                           */             \
+  X(OP_GT)     /* R[a] = R[b] > R[c]                            */             \
+  X(OP_GE)     /* R[a] = R[b] >= R[c]                           */             \
+  X(OP_EQ)     /* R[a] = R[b] == R[c]                           */             \
+  X(OP_NE)     /* R[a] = R[b] != R[c]                           */             \
+  X(OP_ADDK)   /* R[a] = R[b] + K[c]                            */             \
+  X(OP_SUBK)   /* R[a] = R[b] - K[c]                            */             \
+  X(OP_MULK)   /* R[a] = R[b] * K[c]                            */             \
+  X(OP_DIVK)   /* R[a] = R[b] / K[c]                            */             \
+  X(OP_IFLT)   /* if R[a] < R[b] skip next OP_JMP else take it  */             \
+  X(OP_IFLE)   /* if R[a] <= R[b] , same                        */             \
+  X(OP_IFGT)   /* if R[a] > R[b] , same                         */             \
+  X(OP_IFGE)   /* if R[a] >= R[b] , same                        */             \
+  X(OP_IFEQ)   /* if R[a] == R[b] , same                        */             \
+  X(OP_IFNE)   /* if R[a] != R[b] , same                        */             \
+  X(OP_IFLTK)  /* if R[a] < K[b] , same                         */             \
+  X(OP_IFLEK)  /* if R[a] <= K[b] , same                        */             \
+  X(OP_IFGTK)  /* if R[a] > K[b] , same                         */             \
+  X(OP_IFGEK)  /* if R[a] >= K[b] , same                        */             \
+  X(OP_IFEQK)  /* if R[a] == K[b] , same                        */             \
+  X(OP_IFNEK)  /* if R[a] != K[b] , same                        */             \
+  X(OP_JMP)    /* pc = bx                                       */             \
+  X(OP_JMPF)   /* if R[a] == 0 then pc = bx                     */             \
+  X(OP_LOOP)   /* pc = bx , back edge of loop                   */             \
+  X(OP_FORPREP) /* R[a + 1] = trips from R[a] to R[a + 1]       */             \
+  X(OP_FORLOOP) /* if --R[a + 1] > 0 then R[a] += R[a + 2]      */             \
+  X(OP_PLOOP)  /* run range R[a] .. R[a + 2] on pool            */             \
+  X(OP_REDUCE) /* R[a] is reduced by op b , data of OP_PLOOP    */             \
+  X(OP_PEND)   /* end of ploop chunk                            */             \
+  X(OP_GETI)   /* R[a] = R[b][R[c]]                             */             \
+  X(OP_SETI)   /* R[a][R[b]] = R[c]                             */             \
+  X(OP_GETU)   /* OP_GETI without bounds check                  */             \
+  X(OP_SETU)   /* OP_SETI without bounds check                  */             \
+  X(OP_GUARD)  /* if R[b] fits range R[a] + c skip next OP_JMP  */             \
+  X(OP_NATIVE) /* R[a] = builtin c (R[a] .. R[a + b - 1])       */             \
+  X(OP_PRINT)  /* print R[a]                                    */             \
+  X(OP_DEFN)   /* define function P[b]                          */             \
+  X(OP_CALL)   /* R[a] = fn N[c] (R[a] .. R[a + b - 1])         */             \
+  X(OP_TAILCALL) /* OP_CALL , call of running fn reuses its frame */           \
+  X(OP_RET)    /* return R[a]                                   */
+
+// superinstructions : K forms take constant operand without LOADK , IF forms
+// compare and branch in one dispatch , they are always followed by OP_JMP
+// which holds target taken when comparison is false. Range loop keeps counter
+// , trips left and step in R[a] .. R[a + 2] , FORPREP and FORLOOP are followed
+// by OP_JMP too : FORPREP takes it when there are no trips , FORLOOP takes it
+// back to body while trips are left , both copy counter to variable R[b]
+// whenever body runs. OP_PLOOP is followed by c OP_REDUCE and OP_JMP past the
+// loop , vm runs chunks of trips from the body on copies of frame , each ends
+// with OP_FORLOOP falling through to OP_PEND. OP_GUARD checks before range
+// loop R[a] .. R[a + 2] that every 'counter + c' (c is int16) is index of
+// array R[b] , while guards hold loop runs version with GETU and SETU and
+// takes OP_JMP to checked version otherwise
+#define OPCODE_ENUM(op) op,
+typedef enum opcode { OPCODE_LIST(OPCODE_ENUM) OP_COUNT } opcode;
+#undef OPCODE_ENUM
+
+typedef struct instr {
+  uint16_t op;
+  uint16_t a;
+  uint16_t b;
+  uint16_t c;
+} instr;
+
+// b and c together hold 32 bit operand (jump targets , constant and name
+// indexes)
+#define INSTR_BX(i) ((uint32_t)(i).b | ((uint32_t)(i).c << 16))
+#define MAX_REGISTERS UINT16_MAX
+
+typedef struct proto {
+  symbol_t name;
+
+  instr *code;
+  size_t code_count;
+  size_t code_capacity;
+
+  // source line of every instruction , new ones get 'line'
+  uint32_t *lines;
+  uint32_t line;
+
+  double *consts;
+  size_t const_count;
+  size_t const_capacity;
+
+  symbol_t *names;
+  size_t name_count;
+  size_t name_capacity;
+
+  // inline cache of call sites , callee of N[i] once it was looked up
+  struct proto **callees;
+
+  struct proto **protos;
+  size_t proto_count;
+  size_t proto_capacity;
+
+  size_t param_count;
+
+  // calls and loop iterations counted up to JIT_THRESHOLD , then proto gets
+  // native code (or stays interpreted when it can't be compiled)
+  uint32_t hotness;
+  struct jit_code *jit;
+
+  // results by arguments when calls of proto are cached , NULL otherwise
+  struct memo_table *memo;
+
+  // variable slots are the first registers of frame , temporaries go after
+  size_t slot_count;
+  size_t reg_count;
+} proto;
+
+proto *new_proto(symbol_t name);
+void free_proto(proto *p);
+
+// calls 'visit' for 'p' and every proto nested in it , parent goes before its
+// children and may free itself , 'depth' is nesting below 'p'
+typedef void (*proto_visit)(proto *p, size_t depth, void *context);
+void visit_protos(proto *p, proto_visit visit, void *context);
+
+size_t proto_emit(proto *p, opcode op, uint16_t a, uint16_t b, uint16_t c);
+size_t proto_emit_bx(proto *p, opcode op, uint16_t a, uint32_t bx);
+void proto_patch_bx(proto *p, size_t at, uint32_t bx);
+uint32_t proto_add_const(proto *p, double value);
+uint32_t proto_add_name(proto *p, symbol_t name);
+uint32_t proto_add_proto(proto *p, proto *child);
+
+// trips of range loop 'start..end step step' with exclusive end , vm , jit and
+// tree walker share it , so every engine runs the same count
+double range_trips(double start, double end, double step);
+
+const char *opcode_to_str(opcode op);
+void print_proto(proto *p, int indent);
+
+#endif
@@ -0,0 +1,913 @@
+#include "compiler.h"
+#include "builtin.h"
+#include "logger.h"
+#include "memo.h"
+#include "resolver.h"
+#include "stats.h"
+#include <stdlib.h>
+
+typedef struct jump_list {
+  size_t *items;
+  size_t count;
+  size_t capacity;
+} jump_list;
+
+// 'next' of range loop goes forward to its OP_FORLOOP , so start is
+// NO_LOOP_START and its jumps are patched like 'stop' ones
+#define NO_LOOP_START SIZE_MAX
+
+typedef struct loop_ctx {
+  size_t start;
+  jump_list stops;
+  jump_list nexts;
+  struct loop_ctx *outer;
+} loop_ctx;
+
+typedef enum task_kind { TASK_STMT, TASK_EXPR, TASK_COND } task_kind;
+
+// node being compiled , its stage tells which parts of it are emitted. Tasks
+// are kept on heap stack , child pushed by task runs before the task makes
+// its next step , so nesting of script never reaches C stack.
+typedef struct compile_task {
+  ast_node *node;
+  task_kind kind;
+  uint8_t stage;
+  bool started;
+  uint16_t dest;
+  // free register and line before task , both are back when it is done
+  uint16_t mark;
+  uint32_t outer_line;
+  // registers of operands , K form keeps index of constant in operands[1]
+  uint16_t operands[2];
+  opcode op;
+  // statement of block , start of loop or of range loop body
+  size_t index;
+  // jump taken when condition is false , jump over else
+  size_t jump;
+  size_t end_jump;
+  loop_ctx *loop;
+  bool outer_guarded;
+  jump_list exits;
+  jump_list checked;
+} compile_task;
+
+typedef struct pending_function {
+  proto *fn;
+  ast_node *node;
+} pending_function;
+
+typedef struct compiler {
+  proto *p;
+  uint16_t free_reg;
+  loop_ctx *loop;
+  // guards of range loop being compiled hold , hoisted accesses go unchecked
+  bool guarded;
+
+  compile_task *tasks;
+  size_t task_count;
+  size_t task_capacity;
+
+  // nested functions , compiled after the one defining them
+  pending_function *pending;
+  size_t pending_count;
+  size_t pending_capacity;
+} compiler;
+
+#define NO_REG UINT16_MAX
+
+static uint16_t alloc_reg(compiler *c) {
+  if (c->free_reg >= MAX_REGISTERS)
+    elog("Function '%s' is too complex , out of registers",
+         symbol_name(c->p->name));
+
+  uint16_t reg = c->free_reg++;
+  if (c->free_reg > c->p->reg_count)
+    c->p->reg_count = c->free_reg;
+  return reg;
+}
+
+// registers are allocated as a stack , freeing one releases every register
+// above it
+static void release_reg(compiler *c, uint16_t reg) { c->free_reg = reg; }
+
+static uint16_t name_index(compiler *c, symbol_t name) {
+  uint32_t index = proto_add_name(c->p, name);
+  if (index > UINT16_MAX)
+    elog("Function '%s' is too complex , too many names",
+         symbol_name(c->p->name));
+  return (uint16_t)index;
+}
+
+static size_t here(compiler *c) { return c->p->code_count; }
+
+// instructions of node get its line , returns line to restore after node
+static uint32_t enter_line(compiler *c, ast_node *node) {
+  uint32_t outer = c->p->line;
+  if (node->line)
+    c->p->line = node->line;
+  return outer;
+}
+
+static void patch_to_here(compiler *c, size_t jump) {
+  proto_patch_bx(c->p, jump, (uint32_t)here(c));
+}
+
+static void add_jump(jump_list *jumps, size_t jump) {
+  if (jumps->count >= jumps->capacity) {
+    jumps->capacity = jumps->capacity ? jumps->capacity * 2 : 4;
+    jumps->items = realloc(jumps->items, sizeof(size_t) * jumps->capacity);
+    if (!jumps->items)
+      elog("Error allocation memory for loop jumps");
+  }
+  jumps->items[jumps->count++] = jump;
+}
+
+static void patch_all_to_here(compiler *c, jump_list *jumps) {
+  for (size_t i = 0; i < jumps->count; i++)
+    patch_to_here(c, jumps->items[i]);
+  free(jumps->items);
+}
+
+static opcode binary_opcode(TokenType type) {
+  switch (type) {
+  case TOKEN_PLUS:
+    return OP_ADD;
+  case TOKEN_MINUS:
+    return OP_SUB;
+  case TOKEN_MULTIPLY:
+    return OP_MUL;
+  case TOKEN_DIVIDE:
+    return OP_DIV;
+  case TOKEN_LT:
+    return OP_LT;
+  case TOKEN_LE:
+    return OP_LE;
+  case TOKEN_GT:
+    return OP_GT;
+  case TOKEN_GE:
+    return OP_GE;
+  case TOKEN_EQ:
+    return OP_EQ;
+  case TOKEN_NE:
+    return OP_NE;
+  default:
+    elog("Unknown binary operator");
+    return OP_COUNT;
+  }
+}
+
+// K form of arithmetic operator , OP_COUNT when there is none
+static opcode binary_opcode_k(TokenType type) {
+  switch (type) {
+  case TOKEN_PLUS:
+    return OP_ADDK;
+  case TOKEN_MINUS:
+    return OP_SUBK;
+  case TOKEN_MULTIPLY:
+    return OP_MULK;
+  case TOKEN_DIVIDE:
+    return OP_DIVK;
+  default:
+    return OP_COUNT;
+  }
+}
+
+// compare and branch opcode , OP_COUNT when operator is not comparison
+static opcode branch_opcode(TokenType type, bool constant) {
+  switch (type) {
+  case TOKEN_LT:
+    return constant ? OP_IFLTK : OP_IFLT;
+  case TOKEN_LE:
+    return constant ? OP_IFLEK : OP_IFLE;
+  case TOKEN_GT:
+    return constant ? OP_IFGTK : OP_IFGT;
+  case TOKEN_GE:
+    return constant ? OP_IFGEK : OP_IFGE;
+  case TOKEN_EQ:
+    return constant ? OP_IFEQK : OP_IFEQ;
+  case TOKEN_NE:
+    return constant ? OP_IFNEK : OP_IFNE;
+  default:
+    return OP_COUNT;
+  }
+}
+
+// operator giving the same result with swapped operands , TOKEN_EOF when
+// there is none
+static TokenType swapped_operator(TokenType type) {
+  switch (type) {
+  case TOKEN_PLUS:
+  case TOKEN_MULTIPLY:
+  case TOKEN_EQ:
+  case TOKEN_NE:
+    return type;
+  case TOKEN_LT:
+    return TOKEN_GT;
+  case TOKEN_GT:
+    return TOKEN_LT;
+  case TOKEN_LE:
+    return TOKEN_GE;
+  case TOKEN_GE:
+    return TOKEN_LE;
+  default:
+    return TOKEN_EOF;
+  }
+}
+
+// binary operands with literal moved to the right when operator allows it ,
+// so 'var op const' and 'const op var' get the same K form
+typedef struct {
+  ast_node *left;
+  ast_node *right;
+  TokenType op;
+} binary_shape;
+
+static binary_shape binary_operands(ast_node *node) {
+  binary_shape shape = {.left = node->data.binary.left,
+                        .right = node->data.binary.right,
+                        .op = node->data.binary.op};
+  TokenType swapped = swapped_operator(shape.op);
+  if (shape.left->type == NODE_NUMBER && shape.right->type != NODE_NUMBER &&
+      swapped != TOKEN_EOF) {
+    shape.left = node->data.binary.right;
+    shape.right = node->data.binary.left;
+    shape.op = swapped;
+  }
+  return shape;
+}
+
+// index of literal in constants when it fits 16 bit operand of K form
+static bool const_operand(compiler *c, ast_node *node, uint16_t *index) {
+  if (node->type != NODE_NUMBER)
+    return false;
+
+  uint32_t at = proto_add_const(c->p, node->data.value);
+  if (at > UINT16_MAX)
+    return false;
+  *index = (uint16_t)at;
+  return true;
+}
+
+static void emit_const(compiler *c, uint16_t dest, double value) {
+  proto_emit_bx(c->p, OP_LOADK, dest, proto_add_const(c->p, value));
+}
+
+static void emit_move(compiler *c, uint16_t dest, uint16_t src) {
+  if (dest != src)
+    proto_emit(c->p, OP_MOVE, dest, src, 0);
+}
+
+// variable which is surely assigned is read in place from its slot , read
+// which may be unset is checked by OP_READ to temporary register
+static bool in_place(ast_node *node) {
+  return node->type == NODE_VARIABLE && !node->data.var.maybe_unset;
+}
+
+// register which will hold value of operand , variables are used in place
+// from their slots , everything else goes to fresh temporary register
+static uint16_t operand_reg(compiler *c, ast_node *node) {
+  if (in_place(node))
+    return (uint16_t)node->data.var.slot;
+  return alloc_reg(c);
+}
+
+// array of element which may be unset is checked in its slot before index
+static void check_array(compiler *c, ast_node *node) {
+  if (!node->data.element.maybe_unset)
+    return;
+  uint16_t slot = (uint16_t)node->data.element.slot;
+  proto_emit(c->p, OP_READ, slot, slot,
+             name_index(c, node->data.element.name));
+}
+
+static void push_task(compiler *c, task_kind kind, ast_node *node,
+                      uint16_t dest) {
+  if (!node)
+    elog(kind == TASK_STMT
+             ? "Can't compile statement by null ptr on ast node"
+             : "Can't compile expression by null ptr on ast node");
+
+  if (c->task_count >= c->task_capacity) {
+    c->task_capacity = c->task_capacity ? c->task_capacity * 2 : 32;
+    c->tasks = realloc(c->tasks, sizeof(compile_task) * c->task_capacity);
+    if (!c->tasks)
+      elog("Error allocation memory for compiler stack");
+  }
+  c->tasks[c->task_count++] =
+      (compile_task){.node = node, .kind = kind, .dest = dest, .op = OP_CALL};
+}
+
+// operand whose register came from operand_reg
+static void push_operand(compiler *c, ast_node *node, uint16_t reg) {
+  if (!in_place(node))
+    push_task(c, TASK_EXPR, node, reg);
+}
+
+static loop_ctx *enter_loop(compiler *c, size_t start) {
+  loop_ctx *loop = calloc(1, sizeof(loop_ctx));
+  if (!loop)
+    elog("Error allocation memory for loop jumps");
+  loop->start = start;
+  loop->outer = c->loop;
+  c->loop = loop;
+  return loop;
+}
+
+static bool is_temporary(compiler *c, uint16_t reg) {
+  return reg != NO_REG && reg >= c->p->slot_count;
+}
+
+// left operand of chain 'a + b + c' goes to dest when dest is temporary
+// nobody else reads , so chain of any length takes one register
+static bool compile_binary(compiler *c, size_t at) {
+  compile_task *task = &c->tasks[at];
+  if (task->stage == 1) {
+    proto_emit(c->p, task->op, task->dest, task->operands[0],
+               task->operands[1]);
+    return true;
+  }
+
+  binary_shape shape = binary_operands(task->node);
+  uint16_t left = in_place(shape.left)
+                      ? (uint16_t)shape.left->data.var.slot
+                  : is_temporary(c, task->dest) ? task->dest
+                                                : alloc_reg(c);
+  task->stage = 1;
+  task->operands[0] = left;
+
+  uint16_t constant;
+  opcode op_k = binary_opcode_k(shape.op);
+  if (op_k != OP_COUNT && const_operand(c, shape.right, &constant)) {
+    task->op = op_k;
+    task->operands[1] = constant;
+  } else {
+    uint16_t right = operand_reg(c, shape.right);
+    task->op = binary_opcode(shape.op);
+    task->operands[1] = right;
+    push_operand(c, shape.right, right);
+  }
+  push_operand(c, shape.left, left);
+  return false;
+}
+
+// arguments go to consecutive registers from base , call leaves result there
+static bool compile_call(compiler *c, size_t at) {
+  compile_task *task = &c->tasks[at];
+  ast_node *node = task->node;
+  ast_list arguments = node->data.function_call.arguments;
+  uint16_t base = task->operands[0];
+
+  if (task->stage == 1) {
+    const builtin *native = node->data.function_call.builtin;
+    if (native)
+      proto_emit(c->p, OP_NATIVE, base, (uint16_t)arguments.count,
+                 (uint16_t)(native - builtins));
+    else
+      proto_emit(c->p, task->op, base, (uint16_t)arguments.count,
+                 name_index(c, node->data.function_call.name));
+    emit_move(c, task->dest, base);
+    return true;
+  }
+
+  if (arguments.count > UINT16_MAX)
+    elog("Too many arguments in call of '%s'",
+         symbol_name(node->data.function_call.name));
+
+  base = alloc_reg(c);
+  for (size_t i = 1; i < arguments.count; i++)
+    alloc_reg(c);
+  task->stage = 1;
+  task->operands[0] = base;
+  for (size_t i = arguments.count; i > 0; i--)
+    push_task(c, TASK_EXPR, arguments.items[i - 1], (uint16_t)(base + i - 1));
+  return false;
+}
+
+static bool is_unchecked(compiler *c, ast_node *node) {
+  return c->guarded && node->data.element.hoisted;
+}
+
+static bool compile_index(compiler *c, size_t at) {
+  compile_task *task = &c->tasks[at];
+  ast_node *node = task->node;
+  if (task->stage == 1) {
+    proto_emit(c->p, is_unchecked(c, node) ? OP_GETU : OP_GETI, task->dest,
+               (uint16_t)node->data.element.slot, task->operands[0]);
+    return true;
+  }
+
+  check_array(c, node);
+  uint16_t index = operand_reg(c, node->data.element.index);
+  task->stage = 1;
+  task->operands[0] = index;
+  push_operand(c, node->data.element.index, index);
+  return false;
+}
+
+// dest could be a variable slot , so subexpressions never use it as scratch
+// and only the last instruction writes it
+static bool compile_expr(compiler *c, size_t at) {
+  compile_task *task = &c->tasks[at];
+  ast_node *node = task->node;
+
+  switch (node->type) {
+  case NODE_NUMBER:
+    emit_const(c, task->dest, node->data.value);
+    return true;
+  case NODE_VARIABLE:
+    if (node->data.var.maybe_unset)
+      proto_emit(c->p, OP_READ, task->dest, (uint16_t)node->data.var.slot,
+                 name_index(c, node->data.var.var_name));
+    else
+      emit_move(c, task->dest, (uint16_t)node->data.var.slot);
+    return true;
+  case NODE_BIN_OP:
+    return compile_binary(c, at);
+  case NODE_FUNCTION_CALL:
+    return compile_call(c, at);
+  case NODE_INDEX:
+    return compile_index(c, at);
+  default:
+    elog("Can't compile node type %d as expression", node->type);
+    return true;
+  }
+}
+
+// comparison goes to one compare and branch instruction , other conditions
+// are evaluated to register and tested , jump taken when condition is false
+// goes to 'jump' of task below , which pushed the condition
+static bool compile_condition(compiler *c, size_t at) {
+  compile_task *task = &c->tasks[at];
+  ast_node *node = task->node;
+
+  if (task->stage == 1) {
+    size_t jump;
+    if (task->op == OP_JMPF) {
+      jump = proto_emit_bx(c->p, OP_JMPF, task->operands[0], 0);
+    } else {
+      proto_emit(c->p, task->op, task->operands[0], task->operands[1], 0);
+      jump = proto_emit_bx(c->p, OP_JMP, 0, 0);
+    }
+    c->tasks[at - 1].jump = jump;
+    return true;
+  }
+
+  task->stage = 1;
+  if (node->type != NODE_BIN_OP ||
+      branch_opcode(node->data.binary.op, false) == OP_COUNT) {
+    uint16_t cond = operand_reg(c, node);
+    task->op = OP_JMPF;
+    task->operands[0] = cond;
+    push_operand(c, node, cond);
+    return false;
+  }
+
+  enter_line(c, node);
+  binary_shape shape = binary_operands(node);
+  uint16_t left = operand_reg(c, shape.left);
+  task->operands[0] = left;
+
+  uint16_t constant;
+  if (const_operand(c, shape.right, &constant)) {
+    task->op = branch_opcode(shape.op, true);
+    task->operands[1] = constant;
+  } else {
+    uint16_t right = operand_reg(c, shape.right);
+    task->op = branch_opcode(shape.op, false);
+    task->operands[1] = right;
+    push_operand(c, shape.right, right);
+  }
+  push_operand(c, shape.left, left);
+  return false;
+}
+
+// proto is made in place of definition , its body is compiled after the
+// function defining it
+static void compile_function_def(compiler *c, ast_node *node) {
+  proto *fn = new_proto(node->data.function_def.name);
+
+  fn->param_count = node->data.function_def.param_count;
+  fn->line = node->line;
+  if (node->data.function_def.memoize)
+    fn->memo = new_memo_table(fn->param_count);
+  fn->slot_count = node->data.function_def.slot_count;
+  fn->reg_count = fn->slot_count;
+
+  uint32_t index = proto_add_proto(c->p, fn);
+  if (index > UINT16_MAX)
+    elog("Function '%s' is too complex , too many nested functions",
+         symbol_name(c->p->name));
+  proto_emit(c->p, OP_DEFN, 0, (uint16_t)index, 0);
+
+  if (c->pending_count >= c->pending_capacity) {
+    c->pending_capacity = c->pending_capacity ? c->pending_capacity * 2 : 8;
+    c->pending = realloc(c->pending, sizeof(pending_function) *
+                                         c->pending_capacity);
+    if (!c->pending)
+      elog("Error allocation memory for nested functions");
+  }
+  c->pending[c->pending_count++] = (pending_function){.fn = fn, .node = node};
+}
+
+static bool compile_loop(compiler *c, size_t at) {
+  compile_task *task = &c->tasks[at];
+  ast_node *node = task->node;
+
+  switch (task->stage) {
+  case 0:
+    task->index = here(c);
+    task->stage = 1;
+    push_task(c, TASK_COND, node->data.loop.condition, NO_REG);
+    return false;
+  case 1:
+    task->loop = enter_loop(c, task->index);
+    task->stage = 2;
+    push_task(c, TASK_STMT, node->data.loop.loop_body, NO_REG);
+    return false;
+  default: {
+    loop_ctx *loop = task->loop;
+    proto_emit_bx(c->p, OP_LOOP, 0, (uint32_t)loop->start);
+    c->loop = loop->outer;
+
+    patch_to_here(c, task->jump);
+    patch_all_to_here(c, &loop->stops);
+    free(loop);
+
+    if (task->dest != NO_REG)
+      emit_const(c, task->dest, 0.0);
+    return true;
+  }
+  }
+}
+
+// ploop is followed by its reductions , vm runs body in chunks on copies of
+// frame , chunk ends at OP_PEND after its OP_FORLOOP falls through
+static size_t emit_ploop(compiler *c, ast_node *node, uint16_t base,
+                         uint16_t slot) {
+  size_t count = node->data.range_loop.reduction_count;
+  if (count > UINT16_MAX)
+    elog("Too many reductions of ploop in '%s'", symbol_name(c->p->name));
+
+  // reductions are merged with values from before the loop
+  for (size_t i = 0; i < count; i++) {
+    reduction *reduced = &node->data.range_loop.reductions[i];
+    if (reduced->maybe_unset)
+      proto_emit(c->p, OP_READ, (uint16_t)reduced->slot,
+                 (uint16_t)reduced->slot, name_index(c, reduced->name));
+  }
+  proto_emit(c->p, OP_PLOOP, base, slot, (uint16_t)count);
+  for (size_t i = 0; i < count; i++) {
+    reduction *reduced = &node->data.range_loop.reductions[i];
+    proto_emit(c->p, OP_REDUCE, (uint16_t)reduced->slot,
+               (uint16_t)reduced->op, 0);
+  }
+  return proto_emit_bx(c->p, OP_JMP, 0, 0);
+}
+
+// loop over bounds in base .. base + 2 , its 'stop' jumps and jump taken
+// when there are no trips are added to exits of task , body is pushed last
+static void begin_range_version(compiler *c, size_t at) {
+  compile_task *task = &c->tasks[at];
+  ast_node *node = task->node;
+  uint16_t base = task->operands[0];
+  uint16_t slot = (uint16_t)node->data.range_loop.slot;
+
+  if (node->data.range_loop.parallel) {
+    add_jump(&task->exits, emit_ploop(c, node, base, slot));
+  } else {
+    proto_emit(c->p, OP_FORPREP, base, slot, 0);
+    add_jump(&task->exits, proto_emit_bx(c->p, OP_JMP, 0, 0));
+  }
+
+  task->loop = enter_loop(c, NO_LOOP_START);
+  task->loop->stops = task->exits;
+  task->exits = (jump_list){0};
+  task->index = here(c);
+  push_task(c, TASK_STMT, node->data.range_loop.loop_body, NO_REG);
+}
+
+static void end_range_version(compiler *c, size_t at) {
+  compile_task *task = &c->tasks[at];
+  ast_node *node = task->node;
+  loop_ctx *loop = task->loop;
+  uint16_t base = task->operands[0];
+  uint16_t slot = (uint16_t)node->data.range_loop.slot;
+
+  c->loop = loop->outer;
+  task->exits = loop->stops;
+  patch_all_to_here(c, &loop->nexts);
+  free(loop);
+
+  proto_emit(c->p, OP_FORLOOP, base, slot, 0);
+  proto_emit_bx(c->p, OP_JMP, 0, (uint32_t)task->index);
+  if (node->data.range_loop.parallel)
+    proto_emit(c->p, OP_PEND, 0, 0, 0);
+}
+
+static void emit_guard(compiler *c, uint16_t base, range_guard *guard,
+                       int16_t offset, jump_list *checked) {
+  proto_emit(c->p, OP_GUARD, base, (uint16_t)guard->slot, (uint16_t)offset);
+  add_jump(checked, proto_emit_bx(c->p, OP_JMP, 0, 0));
+}
+
+// counter , trips left and step stay in three registers above slots for the
+// whole loop , body can't reach them , so assigning the variable doesn't
+// change iterations. Loop with guards is compiled twice , version without
+// hoisted checks runs when every guard holds and the checked one otherwise
+// , so accesses out of array fail at the same trip as without hoisting.
+static bool compile_range_loop(compiler *c, size_t at) {
+  compile_task *task = &c->tasks[at];
+  ast_node *node = task->node;
+
+  switch (task->stage) {
+  case 0: {
+    uint16_t base = alloc_reg(c);
+    alloc_reg(c);
+    alloc_reg(c);
+    task->operands[0] = base;
+    task->stage = 1;
+    push_task(c, TASK_EXPR, node->data.range_loop.step, base + 2);
+    push_task(c, TASK_EXPR, node->data.range_loop.end, base + 1);
+    push_task(c, TASK_EXPR, node->data.range_loop.start, base);
+    return false;
+  }
+  case 1:
+    if (node->data.range_loop.guard_count == 0) {
+      task->stage = 3;
+      begin_range_version(c, at);
+      return false;
+    }
+    for (size_t i = 0; i < node->data.range_loop.guard_count; i++) {
+      range_guard *guard = &node->data.range_loop.guards[i];
+      emit_guard(c, task->operands[0], guard, guard->low, &task->checked);
+      if (guard->high != guard->low)
+        emit_guard(c, task->operands[0], guard, guard->high, &task->checked);
+    }
+    task->outer_guarded = c->guarded;
+    c->guarded = true;
+    task->stage = 2;
+    begin_range_version(c, at);
+    return false;
+  case 2:
+    end_range_version(c, at);
+    c->guarded = task->outer_guarded;
+    // ploop leaves by its own jump , counted loop falls through at the end
+    if (!node->data.range_loop.parallel)
+      add_jump(&task->exits, proto_emit_bx(c->p, OP_JMP, 0, 0));
+    patch_all_to_here(c, &task->checked);
+    task->stage = 3;
+    begin_range_version(c, at);
+    return false;
+  default:
+    end_range_version(c, at);
+    patch_all_to_here(c, &task->exits);
+    if (task->dest != NO_REG)
+      emit_const(c, task->dest, 0.0);
+    return true;
+  }
+}
+
+static void compile_stop(compiler *c) {
+  if (!c->loop)
+    elog("Syntax error : 'stop' outside of loop in '%s'",
+         symbol_name(c->p->name));
+
+  add_jump(&c->loop->stops, proto_emit_bx(c->p, OP_JMP, 0, 0));
+}
+
+static bool compile_if(compiler *c, size_t at) {
+  compile_task *task = &c->tasks[at];
+  ast_node *node = task->node;
+  ast_node *else_body = node->data.if_stmt.else_body;
+
+  switch (task->stage) {
+  case 0:
+    task->stage = 1;
+    push_task(c, TASK_COND, node->data.if_stmt.condition, NO_REG);
+    return false;
+  case 1:
+    task->stage = 2;
+    push_task(c, TASK_STMT, node->data.if_stmt.if_body, task->dest);
+    return false;
+  case 2:
+    if (!else_body && task->dest == NO_REG) {
+      patch_to_here(c, task->jump);
+      return true;
+    }
+    task->end_jump = proto_emit_bx(c->p, OP_JMP, 0, 0);
+    patch_to_here(c, task->jump);
+    if (!else_body) {
+      emit_const(c, task->dest, 0.0);
+      patch_to_here(c, task->end_jump);
+      return true;
+    }
+    task->stage = 3;
+    push_task(c, TASK_STMT, else_body, task->dest);
+    return false;
+  default:
+    patch_to_here(c, task->end_jump);
+    return true;
+  }
+}
+
+static bool is_jump_out(ast_node *node) {
+  return node->type == NODE_RETURN || node->type == NODE_LOOP_STOP ||
+         node->type == NODE_LOOP_NEXT;
+}
+
+// statement value is written to dest only when it is requested , block value
+// is the value of its last statement
+static bool compile_stmt(compiler *c, size_t at) {
+  compile_task *task = &c->tasks[at];
+  ast_node *node = task->node;
+  uint16_t dest = task->dest;
+
+  switch (node->type) {
+  case NODE_ASSIGNMENT: {
+    uint16_t slot = (uint16_t)node->data.assignment.slot;
+    if (task->stage == 0) {
+      task->stage = 1;
+      push_task(c, TASK_EXPR, node->data.assignment.value, slot);
+      return false;
+    }
+    if (dest != NO_REG)
+      emit_move(c, dest, slot);
+    return true;
+  }
+
+  // index goes first , statement value is the stored one
+  case NODE_INDEX_ASSIGN: {
+    if (task->stage == 1) {
+      proto_emit(c->p, is_unchecked(c, node) ? OP_SETU : OP_SETI,
+                 (uint16_t)node->data.element.slot, task->operands[0],
+                 task->operands[1]);
+      if (dest != NO_REG)
+        emit_move(c, dest, task->operands[1]);
+      return true;
+    }
+    check_array(c, node);
+    uint16_t index = operand_reg(c, node->data.element.index);
+    uint16_t value = operand_reg(c, node->data.element.value);
+    task->stage = 1;
+    task->operands[0] = index;
+    task->operands[1] = value;
+    push_operand(c, node->data.element.value, value);
+    push_operand(c, node->data.element.index, index);
+    return false;
+  }
+
+  case NODE_PRINT: {
+    if (task->stage == 1) {
+      proto_emit(c->p, OP_PRINT, task->operands[0], 0, 0);
+      if (dest != NO_REG)
+        emit_move(c, dest, task->operands[0]);
+      return true;
+    }
+    uint16_t value = operand_reg(c, node->data.print.expression);
+    task->stage = 1;
+    task->operands[0] = value;
+    push_operand(c, node->data.print.expression, value);
+    return false;
+  }
+
+  // rest of block is unreachable after unconditional jump out of it
+  case NODE_BLOCK: {
+    ast_list statements = node->data.block.statements;
+    if (task->index == statements.count ||
+        (task->index > 0 && is_jump_out(statements.items[task->index - 1])))
+      return true;
+    size_t i = task->index++;
+    push_task(c, TASK_STMT, statements.items[i],
+              i + 1 == statements.count ? dest : NO_REG);
+    return false;
+  }
+
+  case NODE_IF:
+    return compile_if(c, at);
+
+  case NODE_LOOP:
+    return compile_loop(c, at);
+
+  case NODE_RANGE_LOOP:
+    return compile_range_loop(c, at);
+
+  case NODE_LOOP_STOP:
+    compile_stop(c);
+    return true;
+
+  case NODE_LOOP_NEXT:
+    if (!c->loop)
+      elog("Syntax error : 'next' outside of loop in '%s'",
+           symbol_name(c->p->name));
+    if (c->loop->start == NO_LOOP_START)
+      add_jump(&c->loop->nexts, proto_emit_bx(c->p, OP_JMP, 0, 0));
+    else
+      proto_emit_bx(c->p, OP_LOOP, 0, (uint32_t)c->loop->start);
+    return true;
+
+  case NODE_FUNCTION_DEF:
+    compile_function_def(c, node);
+    if (dest != NO_REG)
+      emit_const(c, dest, 0.0);
+    return true;
+
+  case NODE_RETURN: {
+    ast_node *value = node->data.return_stm.value;
+    if (task->stage == 1) {
+      proto_emit(c->p, OP_RET, task->operands[0], 0, 0);
+      return true;
+    }
+    task->stage = 1;
+    // call of function by its own name may reuse frame , vm decides at run
+    // time since the name can be bound to other function , then it was plain
+    // call and its value is returned
+    if (value->type == NODE_FUNCTION_CALL &&
+        value->data.function_call.name == c->p->name) {
+      task->operands[0] = c->free_reg;
+      push_task(c, TASK_EXPR, value, c->free_reg);
+      c->tasks[c->task_count - 1].op = OP_TAILCALL;
+      return false;
+    }
+    task->operands[0] = operand_reg(c, value);
+    push_operand(c, value, c->tasks[at].operands[0]);
+    return false;
+  }
+
+  case NODE_NOOP:
+    return true;
+
+  default:
+    if (task->stage == 1)
+      return true;
+    task->stage = 1;
+    push_task(c, TASK_EXPR, node, dest != NO_REG ? dest : alloc_reg(c));
+    return false;
+  }
+}
+
+// task on top makes its next step , it is popped when done and gives back
+// its registers and line
+static void run_tasks(compiler *c) {
+  while (c->task_count > 0) {
+    size_t at = c->task_count - 1;
+    compile_task *task = &c->tasks[at];
+    if (!task->started) {
+      task->started = true;
+      task->mark = c->free_reg;
+      task->outer_line = c->p->line;
+      if (task->kind != TASK_COND)
+        enter_line(c, task->node);
+    }
+
+    bool done;
+    if (task->kind == TASK_STMT)
+      done = compile_stmt(c, at);
+    else if (task->kind == TASK_EXPR)
+      done = compile_expr(c, at);
+    else
+      done = compile_condition(c, at);
+
+    if (done) {
+      task = &c->tasks[at];
+      c->p->line = task->outer_line;
+      release_reg(c, task->mark);
+      c->task_count--;
+    }
+  }
+}
+
+static void compile_function_body(compiler *c, ast_node *body) {
+  uint16_t result = alloc_reg(c);
+  push_task(c, TASK_STMT, body, result);
+  run_tasks(c);
+  proto_emit(c->p, OP_RET, result, 0, 0);
+}
+
+proto *compile(ast_node *ast_tree) {
+  if (!ast_tree)
+    elog("Can't compile ast tree by null ptr");
+
+  size_t slot_count = resolve(ast_tree);
+
+  uint64_t started = stats_phase_begin();
+  proto *main_proto = new_proto(intern_cstr("main"));
+  compiler c = {.p = main_proto, .free_reg = (uint16_t)slot_count,
+                .loop = NULL};
+  main_proto->slot_count = slot_count;
+  main_proto->reg_count = slot_count;
+  compile_function_body(&c, ast_tree);
+
+  for (size_t i = 0; i < c.pending_count; i++) {
+    proto *fn = c.pending[i].fn;
+    c.p = fn;
+    c.free_reg = (uint16_t)fn->slot_count;
+    c.loop = NULL;
+    c.guarded = false;
+    compile_function_body(&c, c.pending[i].node->data.function_def.body);
+  }
+
+  free(c.pending);
+  free(c.tasks);
+  stats_phase_end(PHASE_compile, started);
+  return main_proto;
+}
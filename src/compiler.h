@@ -0,0 +1,9 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include "bytecode.h"
+#include "lexer.h"
+
+proto *compile(ast_node *ast_tree);
+
+#endif
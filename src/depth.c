@@ -0,0 +1,21 @@
+#include "depth.h"
+#include "logger.h"
+
+static size_t depth_limit = DEFAULT_MAX_DEPTH;
+static size_t call_limit = DEFAULT_MAX_CALL_DEPTH;
+
+void set_max_depth(size_t depth) {
+  if (depth == 0)
+    elog("Can't set max depth to zero");
+  depth_limit = depth;
+}
+
+size_t max_depth(void) { return depth_limit; }
+
+void set_max_call_depth(size_t depth) {
+  if (depth == 0)
+    elog("Can't set max call depth to zero");
+  call_limit = depth;
+}
+
+size_t max_call_depth(void) { return call_limit; }
@@ -0,0 +1,20 @@
+#ifndef DEPTH_H
+#define DEPTH_H
+
+#include <stddef.h>
+
+// Limits of scripts : parser rejects statements and expressions nested deeper
+// than max_depth and both evaluators stop when calls nest deeper than
+// max_call_depth , so deep generated programs fail with error instead of
+// growing without bound. Parser , passes over ast , tree walker and vm keep
+// their work on heap stacks , so neither limit depends on C stack. Chains
+// like 'a + b + c' are not nesting , only right operand of operator nests.
+#define DEFAULT_MAX_DEPTH 100000
+#define DEFAULT_MAX_CALL_DEPTH 1000000
+
+void set_max_depth(size_t depth);
+size_t max_depth(void);
+void set_max_call_depth(size_t depth);
+size_t max_call_depth(void);
+
+#endif
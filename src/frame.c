@@ -0,0 +1,93 @@
+#include "frame.h"
+#include "logger.h"
+#include "stats.h"
+#include <stdlib.h>
+
+static frame_segment *new_segment(frame_segment *prev, size_t capacity) {
+  frame_segment *segment =
+      malloc(sizeof(frame_segment) + sizeof(double) * capacity);
+  if (!segment)
+    elog("Error allocation memory for frame stack segment");
+
+  STAT_ADD(bytes_allocated,
+           sizeof(frame_segment) + sizeof(double) * capacity);
+  segment->prev = prev;
+  segment->next = NULL;
+  segment->used = 0;
+  segment->capacity = capacity;
+  return segment;
+}
+
+static void free_segments(frame_segment *segment) {
+  while (segment) {
+    frame_segment *next = segment->next;
+    free(segment);
+    segment = next;
+  }
+}
+
+frame_stack *new_frame_stack(void) {
+  frame_stack *stack = malloc(sizeof(frame_stack));
+  if (!stack)
+    elog("Error allocation memory for frame stack");
+
+  stack->current = new_segment(NULL, FRAME_SEGMENT_SLOTS);
+  stack->depth = 0;
+  return stack;
+}
+
+double *frame_push(frame_stack *stack, size_t slot_count) {
+  if (slot_count == 0)
+    slot_count = 1;
+
+  frame_segment *segment = stack->current;
+  if (segment->capacity - segment->used < slot_count) {
+    frame_segment *next = segment->next;
+    if (next && next->capacity < slot_count) {
+      free_segments(next);
+      next = NULL;
+    }
+    if (!next)
+      next = new_segment(segment, slot_count > FRAME_SEGMENT_SLOTS
+                                      ? slot_count
+                                      : FRAME_SEGMENT_SLOTS);
+    next->prev = segment;
+    next->used = 0;
+    segment->next = next;
+    stack->current = segment = next;
+  }
+
+  double *frame = segment->slots + segment->used;
+  segment->used += slot_count;
+  stack->depth++;
+  return frame;
+}
+
+void frame_pop(frame_stack *stack, double *frame) {
+  frame_segment *segment = stack->current;
+  if (frame < segment->slots || frame >= segment->slots + segment->capacity)
+    elog("Frame pop out of order");
+
+  segment->used = (size_t)(frame - segment->slots);
+  if (segment->used == 0 && segment->prev)
+    stack->current = segment->prev;
+  stack->depth--;
+}
+
+void frame_visit(const frame_stack *stack,
+                 void (*visit)(const double *slots, size_t count)) {
+  for (frame_segment *segment = stack->current; segment;
+       segment = segment->prev)
+    visit(segment->slots, segment->used);
+}
+
+void free_frame_stack(frame_stack *stack) {
+  if (!stack)
+    return;
+
+  frame_segment *segment = stack->current;
+  while (segment->prev)
+    segment = segment->prev;
+  free_segments(segment);
+  free(stack);
+}
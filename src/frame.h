@@ -0,0 +1,53 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FRAME_SEGMENT_SLOTS (64 * 1024)
+
+typedef struct frame_segment {
+  struct frame_segment *prev;
+  struct frame_segment *next;
+  size_t used;
+  size_t capacity;
+  double slots[];
+} frame_segment;
+
+// LIFO stack of call frames , segments are kept after pop and reused by next
+// calls , so steady state calls never touch the heap. Frame never crosses
+// segment boundary , pointer to it stays valid until it is popped.
+typedef struct frame_stack {
+  frame_segment *current;
+  size_t depth;
+} frame_stack;
+
+// variable slot holds it until its first assignment , quiet nan whose payload
+// arithmetic never makes (see array.h) , so reads which may come before
+// assignment are checked against it
+#define UNSET_BITS ((uint64_t)0x7FFD << 48)
+
+static inline bool is_unset(double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits == UNSET_BITS;
+}
+
+// variable slots of new frame , nothing is assigned yet
+static inline void frame_unset(double *slots, size_t count) {
+  uint64_t bits = UNSET_BITS;
+  for (size_t i = 0; i < count; i++)
+    memcpy(&slots[i], &bits, sizeof(bits));
+}
+
+frame_stack *new_frame_stack(void);
+double *frame_push(frame_stack *stack, size_t slot_count);
+void frame_pop(frame_stack *stack, double *frame);
+// slots of every frame on stack , one call per segment from top down
+void frame_visit(const frame_stack *stack,
+                 void (*visit)(const double *slots, size_t count));
+void free_frame_stack(frame_stack *stack);
+
+#endif
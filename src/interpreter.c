@@ -1,280 +1,844 @@
+#include "array.h"
+#include "builtin.h"
+#include "bytecode.h"
+#include "depth.h"
+#include "frame.h"
 #include "lexer.h"
 #include "logger.h"
+#include "memo.h"
+#include "ploop.h"
+#include "stats.h"
+#include "resolver.h"
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define LOOP_NEXT_SIGNAL -123456789.0
-#define LOOP_STOP_SIGNAL -987654321.0
+// definitions are function def nodes themselves , indexed by name
+static void add_function(symbol_map *funcs, ast_node *definition) {
+  symbol_t name = definition->data.function_def.name;
+  if (!symbol_map_put(funcs, name, definition))
+    elog("Function '%s' already defined", symbol_name(name));
+}
 
-typedef struct {
-  char *name;
-  arr_t *parameters;
-  ast_node *body;
-} function_definition;
+static ast_node *get_function(symbol_map *funcs, symbol_t name) {
+  ast_node *definition = symbol_map_get(funcs, name);
+  if (!definition)
+    elog("Function '%s' not found", symbol_name(name));
+  return definition;
+}
 
-typedef struct {
-  function_definition *funcs;
-  size_t count;
-  size_t capacity;
-} function_store;
+// completion record of statement , tells enclosing block , loop or call how
+// control leaves it
+typedef enum {
+  FLOW_NORMAL,
+  FLOW_NEXT,
+  FLOW_STOP,
+  FLOW_RETURN,
+  FLOW_TAIL,
+} flow_kind;
 
 typedef struct {
-  char *name;
+  flow_kind kind;
   double value;
-  bool is_const;
-} variable;
+} completion;
 
+// node being evaluated , 'stage' is how far it got (children evaluated , loop
+// iteration part , block statement index)
 typedef struct {
-  variable *vars;
-  size_t count;
-  size_t capacity;
-} variable_store;
-
-variable_store *init_variable_store() {
-  variable_store *store = malloc(sizeof(variable_store));
-  store->vars = malloc(sizeof(variable) * 10);
-  store->count = 0;
-  store->capacity = 10;
-  return store;
-}
-
-void set_variable(variable_store *store, const char *name, double value,
-                  bool is_const) {
-  for (size_t i = 0; i < store->count; i++) {
-    if (strcmp(store->vars[i].name, name) == 0) {
-      if (store->vars[i].is_const) {
-        elog("syntax error , try set value to const var %s", name);
-      }
+  ast_node *node;
+  uint32_t stage;
+  bool statement;
+} tree_task;
 
-      store->vars[i].value = value;
-      return;
-    }
-  }
+// running call , frame of caller is restored when body completes
+typedef struct {
+  double *caller_vars;
+  ast_node *caller_function;
+  memo_table *memo;
+} tree_call;
 
-  if (store->count >= store->capacity) {
-    store->capacity *= 2;
-    store->vars = realloc(store->vars, sizeof(variable) * store->capacity);
+// running ploop , 'saved' holds its frame as it was before the loop followed
+// by merged reductions of finished chunks
+typedef struct {
+  double *saved;
+  size_t slot_count;
+  size_t chunks;
+  size_t chunk;
+  double start;
+  double trips;
+} tree_ploop;
+
+// every run gets its own id , so call sites cached by previous run of the same
+// tree are missed instead of skipping definition order checks. Walker keeps
+// nodes , values and calls on heap stacks , so depth of script is limited by
+// depth.h limits only and never by C stack.
+typedef struct {
+  symbol_map funcs;
+  frame_stack *frames;
+  uint32_t run;
+  // frame and definition whose body is running , NULL at top level
+  double *vars;
+  ast_node *function;
+  size_t main_slots;
+  // cached results of memoized functions by name
+  symbol_map memos;
+  // completion of last finished statement
+  completion flow;
+
+  tree_task *tasks;
+  size_t task_count;
+  size_t task_capacity;
+
+  double *values;
+  size_t value_count;
+  size_t value_capacity;
+
+  tree_call *calls;
+  size_t call_count;
+  size_t call_capacity;
+
+  // ploops around current statement , innermost is last
+  tree_ploop *ploops;
+  size_t ploop_count;
+  size_t ploop_capacity;
+} tree_state;
+
+static memo_table *get_memo(tree_state *state, ast_node *definition) {
+  symbol_t name = definition->data.function_def.name;
+  memo_table *memo = symbol_map_get(&state->memos, name);
+  if (!memo) {
+    memo = new_memo_table(definition->data.function_def.param_count);
+    symbol_map_put(&state->memos, name, memo);
   }
+  return memo;
+}
 
-  store->vars[store->count].name = strdup(name);
-  store->vars[store->count].value = value;
-  store->vars[store->count].is_const = is_const;
-  store->count++;
+static void *grow_stack(void *items, size_t *capacity, size_t item_size) {
+  *capacity = *capacity ? *capacity * 2 : 64;
+  items = realloc(items, item_size * *capacity);
+  if (!items)
+    elog("Error allocation memory for tree walker stack");
+  return items;
 }
 
-double get_variable(variable_store *store, const char *name) {
-  for (size_t i = 0; i < store->count; i++) {
-    if (strcmp(store->vars[i].name, name) == 0) {
-      return store->vars[i].value;
-    }
-  }
-  elog("Variable '%s' not found", name);
-  return 0.0;
+static void push_task(tree_state *state, ast_node *node, bool statement) {
+  if (!node)
+    elog("Can't interpret tree by null ptr");
+  STAT_INC(nodes_evaluated);
+
+  if (state->task_count >= state->task_capacity)
+    state->tasks = grow_stack(state->tasks, &state->task_capacity,
+                              sizeof(tree_task));
+  state->tasks[state->task_count++] =
+      (tree_task){.node = node, .stage = 0, .statement = statement};
+}
+
+static void push_value(tree_state *state, double value) {
+  if (state->value_count >= state->value_capacity)
+    state->values = grow_stack(state->values, &state->value_capacity,
+                               sizeof(double));
+  state->values[state->value_count++] = value;
+}
+
+static double pop_value(tree_state *state) {
+  return state->values[--state->value_count];
 }
 
-void free_variable_store(variable_store *store) {
-  for (size_t i = 0; i < store->count; i++) {
-    free(store->vars[i].name);
+static double binary_value(TokenType op, double one, double two) {
+  if (isunordered(one, two))
+    check_operands(one, two);
+
+  switch (op) {
+  case TOKEN_PLUS:
+    return one + two;
+  case TOKEN_MINUS:
+    return one - two;
+  case TOKEN_MULTIPLY:
+    return one * two;
+  case TOKEN_DIVIDE:
+    if (two == 0)
+      elog("Can't divide by zero");
+    return one / two;
+  case TOKEN_GT:
+    return one > two ? 1.0 : 0.0;
+  case TOKEN_LT:
+    return one < two ? 1.0 : 0.0;
+  case TOKEN_EQ:
+    return one == two ? 1.0 : 0.0;
+  case TOKEN_GE:
+    return one >= two ? 1.0 : 0.0;
+  case TOKEN_LE:
+    return one <= two ? 1.0 : 0.0;
+  case TOKEN_NE:
+    return one != two ? 1.0 : 0.0;
+  default:
+    elog("Unknown binary operator");
+    return 0.0;
   }
-  free(store->vars);
-  free(store);
 }
 
-function_store *init_function_store() {
-  function_store *store = malloc(sizeof(function_store));
-  store->funcs = malloc(sizeof(function_definition) * 10);
-  store->count = 0;
-  store->capacity = 10;
-  return store;
+// operators and elements over numbers and variables at most DIRECT_DEPTH
+// levels deep are computed in place instead of getting own tasks
+#define DIRECT_DEPTH 4
+
+static bool is_direct(ast_node *node, int depth) {
+  if (node->type == NODE_NUMBER || node->type == NODE_VARIABLE)
+    return true;
+  if (depth > 0 && node->type == NODE_INDEX)
+    return is_direct(node->data.element.index, depth - 1);
+  return depth > 0 && node->type == NODE_BIN_OP &&
+         is_direct(node->data.binary.left, depth - 1) &&
+         is_direct(node->data.binary.right, depth - 1);
 }
 
-void add_function(function_store *store, const char *name, arr_t *parameters,
-                  ast_node *body) {
-  for (size_t i = 0; i < store->count; i++) {
-    if (strcmp(store->funcs[i].name, name) == 0) {
-      elog("Function '%s' already defined", name);
-    }
+// only reads marked by mark_unset_reads may find their slot unset
+static double read_variable(ast_node *node, const double *vars) {
+  double value = vars[node->data.var.slot];
+  if (node->data.var.maybe_unset && is_unset(value))
+    elog("Variable '%s' not found", symbol_name(node->data.var.var_name));
+  return value;
+}
+
+// array of element is checked before its index , like in vm
+static double read_array(ast_node *node, const double *vars) {
+  double value = vars[node->data.element.slot];
+  if (node->data.element.maybe_unset && is_unset(value))
+    elog("Variable '%s' not found", symbol_name(node->data.element.name));
+  return value;
+}
+
+static double direct_value(ast_node *node, double *vars) {
+  STAT_INC(nodes_evaluated);
+  if (node->type == NODE_NUMBER)
+    return node->data.value;
+  if (node->type == NODE_VARIABLE)
+    return read_variable(node, vars);
+  if (node->type == NODE_INDEX) {
+    double array = read_array(node, vars);
+    return array_get(array, direct_value(node->data.element.index, vars));
   }
 
-  if (store->count >= store->capacity) {
-    store->capacity *= 2;
-    store->funcs =
-        realloc(store->funcs, sizeof(function_definition) * store->capacity);
+  double one = direct_value(node->data.binary.left, vars);
+  double two = direct_value(node->data.binary.right, vars);
+  return binary_value(node->data.binary.op, one, two);
+}
+
+// returns false when operand got own task , its value is pushed when the task
+// completes
+static bool push_operand(tree_state *state, ast_node *node) {
+  if (!is_direct(node, DIRECT_DEPTH)) {
+    push_task(state, node, false);
+    return false;
+  }
+  push_value(state, direct_value(node, state->vars));
+  return true;
+}
+
+static ast_node *call_target(ast_node *call, tree_state *state) {
+  ast_node *func = call->data.function_call.target;
+  if (call->data.function_call.cached_run != state->run) {
+    func = get_function(&state->funcs, call->data.function_call.name);
+    call->data.function_call.target = func;
+    call->data.function_call.cached_run = state->run;
   }
 
-  store->funcs[store->count].name = strdup(name);
-  store->funcs[store->count].parameters = parameters;
-  store->funcs[store->count].body = body;
-  store->count++;
+  if (func->data.function_def.param_count !=
+      call->data.function_call.arguments.count)
+    elog("Function '%s' called with wrong number of arguments",
+         symbol_name(call->data.function_call.name));
+  return func;
 }
 
-function_definition *get_function(function_store *store, const char *name) {
-  for (size_t i = 0; i < store->count; i++) {
-    if (strcmp(store->funcs[i].name, name) == 0) {
-      return &store->funcs[i];
+// arguments are on top of value stack , memoized function keeps them after
+// slots like in vm. Returns false when result was cached.
+static bool enter_call(tree_state *state, ast_node *func) {
+  size_t param_count = func->data.function_def.param_count;
+  size_t slot_count = func->data.function_def.slot_count;
+  double *args = state->values + state->value_count - param_count;
+
+  memo_table *memo = NULL;
+  if (func->data.function_def.memoize) {
+    memo = get_memo(state, func);
+    double cached;
+    if (memo_get(memo, args, &cached)) {
+      STAT_INC(memo_hits);
+      state->value_count -= param_count;
+      push_value(state, cached);
+      return false;
     }
   }
-  elog("Function '%s' not found", name);
-  return NULL;
+
+  if (state->call_count >= max_call_depth())
+    elog("Call stack overflow , calls nested deeper than %zu , raise limit "
+         "with --max-call-depth",
+         max_call_depth());
+  STAT_INC(function_calls);
+
+  double *local_vars =
+      frame_push(state->frames, slot_count + (memo ? param_count : 0));
+  if (param_count)
+    memcpy(local_vars, args, sizeof(double) * param_count);
+  frame_unset(local_vars + param_count, slot_count - param_count);
+  if (memo)
+    memcpy(local_vars + slot_count, args, sizeof(double) * param_count);
+  state->value_count -= param_count;
+
+  if (state->call_count >= state->call_capacity)
+    state->calls = grow_stack(state->calls, &state->call_capacity,
+                              sizeof(tree_call));
+  state->calls[state->call_count++] = (tree_call){
+      .caller_vars = state->vars,
+      .caller_function = state->function,
+      .memo = memo,
+  };
+
+  state->vars = local_vars;
+  state->function = func;
+  return true;
 }
 
-double interpret_with_vars(ast_node *ast_tree, variable_store *vars,
-                           function_store *funcs) {
-  if (!ast_tree)
-    elog("Can't interpret tree by null ptr");
+static void leave_call(tree_state *state, double value) {
+  tree_call call = state->calls[--state->call_count];
+  ast_node *func = state->function;
 
-  double one = 0;
-  double two = 0;
+  if (call.memo)
+    memo_put(call.memo, state->vars + func->data.function_def.slot_count,
+             value);
+  frame_pop(state->frames, state->vars);
 
-  switch (ast_tree->type) {
-  case NODE_NUMBER:
-    return ast_tree->data.value;
+  state->vars = call.caller_vars;
+  state->function = call.caller_function;
+  push_value(state, value);
+}
 
-  case NODE_LOOP_STOP:
-    return LOOP_STOP_SIGNAL;
+static bool is_tail_call(ast_node *value, tree_state *state) {
+  return state->function && value->type == NODE_FUNCTION_CALL &&
+         value->data.function_call.name ==
+             state->function->data.function_def.name;
+}
 
-  case NODE_LOOP_NEXT:
-    return LOOP_NEXT_SIGNAL;
+// arguments of self call replace params of running frame , other slots are
+// unset like in new frame
+static void tail_call(tree_state *state) {
+  ast_node *func = state->function;
+  size_t param_count = func->data.function_def.param_count;
+  size_t slot_count = func->data.function_def.slot_count;
+
+  STAT_INC(function_calls);
+  state->value_count -= param_count;
+  memcpy(state->vars, state->values + state->value_count,
+         sizeof(double) * param_count);
+  frame_unset(state->vars + param_count, slot_count - param_count);
+}
+
+// arguments of call are evaluated one per stage , 'first' is stage of first
+// one. Returns true when all of them are on value stack.
+static bool eval_arguments(tree_state *state, tree_task *task, ast_node *call,
+                           uint32_t first) {
+  ast_list *arguments = &call->data.function_call.arguments;
+
+  while (task->stage - first < arguments->count) {
+    if (!push_operand(state, arguments->items[task->stage++ - first]))
+      return false;
+  }
+  return true;
+}
+
+static void eval_expr(tree_state *state, tree_task *task) {
+  ast_node *node = task->node;
+
+  switch (node->type) {
+  case NODE_NUMBER:
+    state->task_count--;
+    push_value(state, node->data.value);
+    return;
 
   case NODE_VARIABLE:
-    return get_variable(vars, ast_tree->data.var.var_name);
+    state->task_count--;
+    push_value(state, read_variable(node, state->vars));
+    return;
 
   case NODE_BIN_OP:
-    one = interpret_with_vars(ast_tree->data.binary.left, vars, funcs);
-    two = interpret_with_vars(ast_tree->data.binary.right, vars, funcs);
-
-    switch (ast_tree->data.binary.op) {
-    case TOKEN_PLUS:
-      return one + two;
-    case TOKEN_MINUS:
-      return one - two;
-    case TOKEN_MULTIPLY:
-      return one * two;
-    case TOKEN_DIVIDE:
-      if (two == 0)
-        elog("Can't divide by zero");
-      return one / two;
-    case TOKEN_GT:
-      return one > two ? 1.0 : 0.0;
-    case TOKEN_LT:
-      return one < two ? 1.0 : 0.0;
-    case TOKEN_EQ:
-      return one == two ? 1.0 : 0.0;
-    case TOKEN_GE:
-      return one >= two ? 1.0 : 0.0;
-    case TOKEN_LE:
-      return one <= two ? 1.0 : 0.0;
-    case TOKEN_NE:
-      return one != two ? 1.0 : 0.0;
-    default:
-      elog("Unknown binary operator");
-      return 0.0;
+    if (task->stage == 0) {
+      task->stage = 1;
+      if (!push_operand(state, node->data.binary.left))
+        return;
+    }
+    if (task->stage == 1) {
+      task->stage = 2;
+      if (!push_operand(state, node->data.binary.right))
+        return;
     }
+    {
+      double two = pop_value(state);
+      double one = pop_value(state);
+      state->task_count--;
+      push_value(state, binary_value(node->data.binary.op, one, two));
+    }
+    return;
+
+  case NODE_INDEX:
+    if (task->stage == 0) {
+      task->stage = 1;
+      read_array(node, state->vars);
+      if (!push_operand(state, node->data.element.index))
+        return;
+    }
+    {
+      double index = pop_value(state);
+      state->task_count--;
+      push_value(state,
+                 array_get(state->vars[node->data.element.slot], index));
+    }
+    return;
 
-  case NODE_ASSIGNMENT:
-    one = interpret_with_vars(ast_tree->data.assignment.value, vars, funcs);
-    set_variable(vars, ast_tree->data.assignment.var_name, one,
-                 ast_tree->data.assignment.is_const);
-    return one;
-
-  case NODE_IF:
-    one = interpret_with_vars(ast_tree->data.if_stmt.condition, vars, funcs);
-    if (one != 0.0) {
-      return interpret_with_vars(ast_tree->data.if_stmt.if_body, vars, funcs);
-    } else if (ast_tree->data.if_stmt.else_body) {
-      return interpret_with_vars(ast_tree->data.if_stmt.else_body, vars, funcs);
+  // stage 0 finds definition , then arguments , then body which runs again
+  // while it ends with self call in tail position
+  case NODE_FUNCTION_CALL: {
+    size_t arg_count = node->data.function_call.arguments.count;
+    uint32_t body = (uint32_t)arg_count + 2;
+
+    // builtin takes its arguments from value stack where they were pushed
+    const builtin *native = node->data.function_call.builtin;
+    if (native) {
+      if (!eval_arguments(state, task, node, 0))
+        return;
+      double result = native->fn(state->values + state->value_count -
+                                 arg_count);
+      state->value_count -= arg_count;
+      state->task_count--;
+      push_value(state, result);
+      return;
     }
-    return 0.0;
 
-  case NODE_LOOP:
+    if (task->stage == 0) {
+      call_target(node, state);
+      task->stage = 1;
+    }
 
-    while (true) {
-      one = interpret_with_vars(ast_tree->data.loop.condition, vars, funcs);
+    if (task->stage < body) {
+      if (!eval_arguments(state, task, node, 1))
+        return;
 
-      if (one == 0.0)
-        break;
+      ast_node *func = node->data.function_call.target;
+      if (!enter_call(state, func)) {
+        state->task_count--;
+        return;
+      }
+      task->stage = body;
+      push_task(state, func->data.function_def.body, true);
+      return;
+    }
 
-      double result =
-          interpret_with_vars(ast_tree->data.loop.loop_body, vars, funcs);
+    if (state->flow.kind == FLOW_TAIL) {
+      push_task(state, state->function->data.function_def.body, true);
+      return;
+    }
+    state->task_count--;
+    leave_call(state, state->flow.value);
+    return;
+  }
 
-      if (result == LOOP_NEXT_SIGNAL)
-        continue;
+  default:
+    elog("Unknown expression node type %d", node->type);
+  }
+}
 
-      if (result == LOOP_STOP_SIGNAL)
-        break;
-    }
-    return 0.0;
+static void finish_stmt(tree_state *state, flow_kind kind, double value) {
+  state->flow = (completion){.kind = kind, .value = value};
+  state->task_count--;
+}
 
-  case NODE_PRINT:
-    one = interpret_with_vars(ast_tree->data.print.expression, vars, funcs);
-    printf("%g\n", one);
-    return one;
-
-  case NODE_BLOCK:
-    one = 0.0;
-    for (size_t i = 0; i < ast_tree->data.block.statements->size; i++) {
-      ast_node *statement = arr_get(ast_tree->data.block.statements, i);
-      one = interpret_with_vars(statement, vars, funcs);
-
-      if (one == LOOP_NEXT_SIGNAL || one == LOOP_STOP_SIGNAL) {
-        return one;
-      }
+// operand of statement taken at stage 0 when it is computed in place , else
+// its task is pushed and value is taken from value stack at stage 1
+static bool take_operand(tree_state *state, tree_task *task, ast_node *node,
+                         double *value) {
+  if (task->stage == 0) {
+    task->stage = 1;
+    if (is_direct(node, DIRECT_DEPTH)) {
+      *value = direct_value(node, state->vars);
+      return true;
     }
-    return one;
+    push_task(state, node, false);
+    return false;
+  }
+  *value = pop_value(state);
+  return true;
+}
 
-  case NODE_FUNCTION_DEF:
-    add_function(funcs, ast_tree->data.function_def.name,
-                 ast_tree->data.function_def.params,
-                 ast_tree->data.function_def.body);
-    return 0.0;
+// assignments of values computed in place run without own task
+static bool direct_stmt(tree_state *state, ast_node *node) {
+  if (node->type != NODE_ASSIGNMENT ||
+      !is_direct(node->data.assignment.value, DIRECT_DEPTH))
+    return false;
+
+  STAT_INC(nodes_evaluated);
+  double value = direct_value(node->data.assignment.value, state->vars);
+  state->vars[node->data.assignment.slot] = value;
+  state->flow = (completion){.kind = FLOW_NORMAL, .value = value};
+  return true;
+}
 
-  case NODE_FUNCTION_CALL: {
-    function_definition *func =
-        get_function(funcs, ast_tree->data.function_call.name);
+// chunk starts from frame saved before ploop , with its reductions at
+// identity and counter at its first trip
+static void start_chunk(tree_state *state, ast_node *node, tree_ploop *ploop,
+                        double *loop) {
+  double first, count;
+  ploop_chunk(ploop->trips, ploop->chunks, ploop->chunk, &first, &count);
+  memcpy(state->vars, ploop->saved, sizeof(double) * ploop->slot_count);
+  for (size_t i = 0; i < node->data.range_loop.reduction_count; i++) {
+    reduction *reduced = &node->data.range_loop.reductions[i];
+    state->vars[reduced->slot] = reduce_identity(reduced->op);
+  }
+  loop[0] = ploop->start + first * loop[2];
+  loop[1] = count;
+}
 
-    variable_store *local_vars = init_variable_store();
+static void push_ploop(tree_state *state, ast_node *node, double *loop,
+                       size_t chunks) {
+  size_t slot_count = state->function
+                          ? state->function->data.function_def.slot_count
+                          : state->main_slots;
+  size_t reduction_count = node->data.range_loop.reduction_count;
+
+  if (state->ploop_count >= state->ploop_capacity)
+    state->ploops = grow_stack(state->ploops, &state->ploop_capacity,
+                               sizeof(tree_ploop));
+  tree_ploop *ploop = &state->ploops[state->ploop_count++];
+  *ploop = (tree_ploop){
+      .saved = frame_push(state->frames, slot_count + reduction_count),
+      .slot_count = slot_count,
+      .chunks = chunks,
+      .chunk = 0,
+      .start = loop[0],
+      .trips = loop[1],
+  };
+
+  memcpy(ploop->saved, state->vars, sizeof(double) * slot_count);
+  for (size_t i = 0; i < reduction_count; i++)
+    ploop->saved[slot_count + i] =
+        state->vars[node->data.range_loop.reductions[i].slot];
+  start_chunk(state, node, ploop, loop);
+}
 
-    size_t param_count = func->parameters->size;
-    size_t arg_count = ast_tree->data.function_call.arguments->size;
+// merges reductions of finished chunk in chunk order , false after the last
+// one
+static bool next_chunk(tree_state *state, ast_node *node, tree_ploop *ploop,
+                       double *loop) {
+  for (size_t i = 0; i < node->data.range_loop.reduction_count; i++) {
+    reduction *reduced = &node->data.range_loop.reductions[i];
+    double *merged = &ploop->saved[ploop->slot_count + i];
+    *merged = reduce_combine(reduced->op, *merged, state->vars[reduced->slot]);
+  }
 
-    if (param_count != arg_count)
-      elog("Function '%s' called with wrong number of arguments",
-           ast_tree->data.function_call.name);
+  if (++ploop->chunk == ploop->chunks)
+    return false;
+  start_chunk(state, node, ploop, loop);
+  return true;
+}
 
-    for (size_t i = 0; i < param_count; i++) {
-      char *param_name = (char *)arr_get(func->parameters, i);
-      ast_node *arg_expr = arr_get(ast_tree->data.function_call.arguments, i);
+// frame is back as before ploop , only reductions changed
+static void end_ploop(tree_state *state, ast_node *node, tree_ploop *ploop) {
+  memcpy(state->vars, ploop->saved, sizeof(double) * ploop->slot_count);
+  for (size_t i = 0; i < node->data.range_loop.reduction_count; i++)
+    state->vars[node->data.range_loop.reductions[i].slot] =
+        ploop->saved[ploop->slot_count + i];
+  frame_pop(state->frames, ploop->saved);
+  state->ploop_count--;
+}
 
-      double arg_value = interpret_with_vars(arg_expr, vars, funcs);
+// ploop runs its chunks one after another , stages are those of range loop
+// and loop[1] counts trips left in current chunk
+static void eval_ploop(tree_state *state, tree_task *task) {
+  ast_node *node = task->node;
+  ast_node *bounds[] = {node->data.range_loop.start,
+                        node->data.range_loop.end,
+                        node->data.range_loop.step};
+  while (task->stage < 3) {
+    if (!push_operand(state, bounds[task->stage++]))
+      return;
+  }
 
-      set_variable(local_vars, param_name, arg_value, false);
+  double *loop = state->values + state->value_count - 3;
+  if (task->stage == 3) {
+    // reductions are merged with values from before the loop
+    for (size_t i = 0; i < node->data.range_loop.reduction_count; i++) {
+      reduction *reduced = &node->data.range_loop.reductions[i];
+      if (reduced->maybe_unset && is_unset(state->vars[reduced->slot]))
+        elog("Variable '%s' not found", symbol_name(reduced->name));
+    }
+    loop[1] = range_trips(loop[0], loop[1], loop[2]);
+    size_t chunks = ploop_chunks(loop[1]);
+    if (chunks == 0) {
+      state->value_count -= 3;
+      finish_stmt(state, FLOW_NORMAL, 0.0);
+      return;
     }
+    push_ploop(state, node, loop, chunks);
+  } else {
+    tree_ploop *ploop = &state->ploops[state->ploop_count - 1];
+    STAT_INC(loop_iterations);
+    loop[1] -= 1;
+    loop[0] += loop[2];
+    if (!(loop[1] > 0) && !next_chunk(state, node, ploop, loop)) {
+      end_ploop(state, node, ploop);
+      state->value_count -= 3;
+      finish_stmt(state, FLOW_NORMAL, 0.0);
+      return;
+    }
+  }
+
+  state->vars[node->data.range_loop.slot] = loop[0];
+  task->stage = 4;
+  push_task(state, node->data.range_loop.loop_body, true);
+}
 
-    double result = interpret_with_vars(func->body, local_vars, funcs);
+static void eval_stmt(tree_state *state, tree_task *task) {
+  ast_node *node = task->node;
+  double value;
 
-    free_variable_store(local_vars);
+  switch (node->type) {
+  case NODE_LOOP_STOP:
+    finish_stmt(state, FLOW_STOP, 0.0);
+    return;
+
+  case NODE_LOOP_NEXT:
+    finish_stmt(state, FLOW_NEXT, 0.0);
+    return;
 
-    return result;
+  case NODE_ASSIGNMENT:
+    if (!take_operand(state, task, node->data.assignment.value, &value))
+      return;
+    state->vars[node->data.assignment.slot] = value;
+    finish_stmt(state, FLOW_NORMAL, value);
+    return;
+
+  // index goes first , statement value is the stored one
+  case NODE_INDEX_ASSIGN:
+    if (task->stage == 0) {
+      task->stage = 1;
+      read_array(node, state->vars);
+      if (!push_operand(state, node->data.element.index))
+        return;
+    }
+    if (task->stage == 1) {
+      task->stage = 2;
+      if (!push_operand(state, node->data.element.value))
+        return;
+    }
+    value = pop_value(state);
+    array_set(state->vars[node->data.element.slot], pop_value(state), value);
+    finish_stmt(state, FLOW_NORMAL, value);
+    return;
+
+  // taken branch replaces if , its completion is completion of if
+  case NODE_IF: {
+    if (!take_operand(state, task, node->data.if_stmt.condition, &value))
+      return;
+    ast_node *branch = value != 0.0 ? node->data.if_stmt.if_body
+                                    : node->data.if_stmt.else_body;
+    if (!branch) {
+      finish_stmt(state, FLOW_NORMAL, 0.0);
+      return;
+    }
+    state->task_count--;
+    push_task(state, branch, true);
+    return;
   }
 
-  case NODE_RETURN:
-    return interpret_with_vars(ast_tree->data.return_stm.value, vars, funcs);
+  // stages 0 and 1 check condition , stage 2 gets completion of body
+  case NODE_LOOP:
+    if (task->stage == 2) {
+      if (state->flow.kind == FLOW_STOP) {
+        finish_stmt(state, FLOW_NORMAL, 0.0);
+        return;
+      }
+      if (state->flow.kind == FLOW_RETURN || state->flow.kind == FLOW_TAIL) {
+        state->task_count--;
+        return;
+      }
+      STAT_INC(loop_iterations);
+      task->stage = 0;
+    }
+    if (!take_operand(state, task, node->data.loop.condition, &value))
+      return;
+    if (value == 0.0) {
+      finish_stmt(state, FLOW_NORMAL, 0.0);
+      return;
+    }
+    task->stage = 2;
+    push_task(state, node->data.loop.loop_body, true);
+    return;
+
+  // stages 0 - 2 push bounds , stage 3 turns them to counter , trips left and
+  // step which stay on value stack while loop runs , stage 4 gets completion
+  // of body
+  case NODE_RANGE_LOOP: {
+    if (node->data.range_loop.parallel) {
+      eval_ploop(state, task);
+      return;
+    }
+    ast_node *bounds[] = {node->data.range_loop.start,
+                          node->data.range_loop.end,
+                          node->data.range_loop.step};
+    while (task->stage < 3) {
+      if (!push_operand(state, bounds[task->stage++]))
+        return;
+    }
+
+    double *loop = state->values + state->value_count - 3;
+    if (task->stage == 3) {
+      loop[1] = range_trips(loop[0], loop[1], loop[2]);
+    } else {
+      if (state->flow.kind == FLOW_STOP || state->flow.kind == FLOW_RETURN ||
+          state->flow.kind == FLOW_TAIL) {
+        state->value_count -= 3;
+        if (state->flow.kind == FLOW_STOP)
+          finish_stmt(state, FLOW_NORMAL, 0.0);
+        else
+          state->task_count--;
+        return;
+      }
+      STAT_INC(loop_iterations);
+      loop[1] -= 1;
+      loop[0] += loop[2];
+    }
+
+    if (!(loop[1] > 0)) {
+      state->value_count -= 3;
+      finish_stmt(state, FLOW_NORMAL, 0.0);
+      return;
+    }
+    state->vars[node->data.range_loop.slot] = loop[0];
+    task->stage = 4;
+    push_task(state, node->data.range_loop.loop_body, true);
+    return;
+  }
+
+  case NODE_PRINT:
+    if (!take_operand(state, task, node->data.print.expression, &value))
+      return;
+    print_value(value);
+    finish_stmt(state, FLOW_NORMAL, value);
+    return;
+
+  // stage is index of next statement , block ends early on completion which
+  // is not normal and gives completion of its last statement , so the last
+  // one replaces block
+  case NODE_BLOCK: {
+    ast_list *statements = &node->data.block.statements;
+    if (task->stage == 0)
+      state->flow = (completion){.kind = FLOW_NORMAL, .value = 0.0};
+
+    while (task->stage < statements->count) {
+      if (state->flow.kind != FLOW_NORMAL)
+        break;
+      ast_node *statement = statements->items[task->stage++];
+      if (direct_stmt(state, statement))
+        continue;
+      if (task->stage == statements->count)
+        state->task_count--;
+      push_task(state, statement, true);
+      return;
+    }
+    state->task_count--;
+    return;
+  }
+
+  case NODE_FUNCTION_DEF:
+    add_function(&state->funcs, node);
+    finish_stmt(state, FLOW_NORMAL, 0.0);
+    return;
+
+  // self call in tail position evaluates arguments from stage 2 and hands them
+  // to running call instead of nesting new one
+  case NODE_RETURN: {
+    ast_node *value_node = node->data.return_stm.value;
+    if (task->stage == 0 && is_tail_call(value_node, state)) {
+      if (value_node->data.function_call.arguments.count !=
+          state->function->data.function_def.param_count)
+        elog("Function '%s' called with wrong number of arguments",
+             symbol_name(value_node->data.function_call.name));
+      task->stage = 2;
+    }
+
+    if (task->stage < 2) {
+      if (!take_operand(state, task, value_node, &value))
+        return;
+      finish_stmt(state, FLOW_RETURN, value);
+      return;
+    }
+
+    if (!eval_arguments(state, task, value_node, 2))
+      return;
+    tail_call(state);
+    finish_stmt(state, FLOW_TAIL, 0.0);
+    return;
+  }
 
   case NODE_NOOP:
-    return 0.0;
+    finish_stmt(state, FLOW_NORMAL, 0.0);
+    return;
 
   default:
-    elog("Unknown node type");
-    return 0.0;
+    if (!take_operand(state, task, node, &value))
+      return;
+    finish_stmt(state, FLOW_NORMAL, value);
+    return;
   }
 }
 
-double interpret(ast_node *ast_tree) {
-  variable_store *vars = init_variable_store();
-  function_store *funcs = init_function_store();
-  double result = interpret_with_vars(ast_tree, vars, funcs);
-  free_variable_store(vars);
+static completion interpret_stmt(ast_node *ast_tree, tree_state *state) {
+  size_t base = state->task_count;
+  push_task(state, ast_tree, true);
+
+  while (state->task_count > base) {
+    tree_task *task = &state->tasks[state->task_count - 1];
+    if (task->statement)
+      eval_stmt(state, task);
+    else
+      eval_expr(state, task);
+  }
+  return state->flow;
+}
+
+// frames hold variables (ploop keeps its saved frame there too) , operands
+// wait on values stack and return value in flow
+static void tree_roots(void *context, array_visit visit) {
+  tree_state *state = context;
+  frame_visit(state->frames, visit);
+  visit(state->values, state->value_count);
+  visit(&state->flow.value, 1);
+}
+
+double interpret_tree(ast_node *ast_tree) {
+  size_t slot_count = resolve(ast_tree);
+  static uint32_t runs = 0;
+  tree_state state = {
+      .frames = new_frame_stack(), .run = ++runs, .main_slots = slot_count};
+  symbol_map_init(&state.funcs);
+  symbol_map_init(&state.memos);
+
+  uint64_t started = stats_phase_begin();
+  state.vars = frame_push(state.frames, slot_count);
+  frame_unset(state.vars, slot_count);
+  arrays_set_roots(tree_roots, &state);
+  double result = interpret_stmt(ast_tree, &state).value;
+  stats_phase_end(PHASE_execute, started);
+
+  free(state.tasks);
+  free(state.values);
+  free(state.calls);
+  free(state.ploops);
+  free_frame_stack(state.frames);
+  symbol_map_free(&state.funcs);
+  for (size_t i = 0; i < state.memos.capacity; i++) {
+    if (state.memos.keys[i] != NO_SYMBOL)
+      free_memo_table(state.memos.values[i]);
+  }
+  symbol_map_free(&state.memos);
+  free_arrays();
   return result;
 }
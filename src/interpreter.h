@@ -3,6 +3,6 @@
 
 #include "lexer.h"
 
-double interpret(ast_node *ast_tree);
+double interpret_tree(ast_node *ast_tree);
 
 #endif
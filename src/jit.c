@@ -0,0 +1,779 @@
+#include "jit.h"
+#include "array.h"
+#include "builtin.h"
+#include "frame.h"
+#include "logger.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+static bool enabled = JIT_SUPPORTED;
+
+void jit_set_enabled(bool value) { enabled = value && JIT_SUPPORTED; }
+
+bool jit_enabled(void) { return enabled; }
+
+#if JIT_SUPPORTED
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// native code keeps R in rbx , K in rbp , vm in r12 , proto in r13 and
+// counters of running thread in r14 , every instruction loads its operands to
+// xmm0 - xmm2 and stores result back , so no state lives in machine registers
+// between instructions
+#define BASE_R 3
+#define BASE_K 5
+
+#define SSE_DOUBLE 0xF2
+#define SSE_PACKED 0x66
+#define SSE_LOAD 0x10
+#define SSE_STORE 0x11
+#define SSE_ADD 0x58
+#define SSE_MUL 0x59
+#define SSE_SUB 0x5C
+#define SSE_DIV 0x5E
+#define SSE_COMPARE 0x2E
+
+#define JUMP_ABOVE 0x87
+#define JUMP_ABOVE_EQUAL 0x83
+#define JUMP_BELOW_EQUAL 0x86
+#define JUMP_EQUAL 0x84
+#define JUMP_NOT_EQUAL 0x85
+#define JUMP_PARITY 0x8A
+
+// largest index which still fits 32 bit displacement of 8 byte slots
+#define MAX_OPERAND_INDEX ((uint32_t)1 << 28)
+
+typedef struct {
+  size_t at;
+  uint32_t target;
+} jit_fixup;
+
+typedef struct {
+  uint8_t *bytes;
+  size_t count;
+  size_t capacity;
+
+  jit_fixup *fixups;
+  size_t fixup_count;
+  size_t fixup_capacity;
+} jit_buffer;
+
+static void emit(jit_buffer *b, const uint8_t *bytes, size_t count) {
+  if (b->count + count > b->capacity) {
+    while (b->count + count > b->capacity)
+      b->capacity = b->capacity ? b->capacity * 2 : 4096;
+    b->bytes = realloc(b->bytes, b->capacity);
+    if (!b->bytes)
+      elog("Error allocation memory for jit code buffer");
+  }
+  memcpy(b->bytes + b->count, bytes, count);
+  b->count += count;
+}
+
+#define EMIT(b, ...)                                                           \
+  emit(b, (const uint8_t[]){__VA_ARGS__}, sizeof((const uint8_t[]){__VA_ARGS__}))
+
+static void emit_u32(jit_buffer *b, uint32_t value) {
+  emit(b, (const uint8_t *)&value, sizeof(value));
+}
+
+static void emit_u64(jit_buffer *b, uint64_t value) {
+  emit(b, (const uint8_t *)&value, sizeof(value));
+}
+
+static void patch_u32(jit_buffer *b, size_t at, uint32_t value) {
+  memcpy(b->bytes + at, &value, sizeof(value));
+}
+
+// prefix 0F op xmm , [base + index * 8]
+static void emit_sse(jit_buffer *b, uint8_t prefix, uint8_t op, int xmm,
+                     int base, uint32_t index) {
+  EMIT(b, prefix, 0x0F, op, (uint8_t)(0x80 | xmm << 3 | base));
+  emit_u32(b, index * 8);
+}
+
+static void emit_load(jit_buffer *b, int xmm, int base, uint32_t index) {
+  emit_sse(b, SSE_DOUBLE, SSE_LOAD, xmm, base, index);
+}
+
+static void emit_store(jit_buffer *b, int xmm, uint32_t index) {
+  emit_sse(b, SSE_DOUBLE, SSE_STORE, xmm, BASE_R, index);
+}
+
+// mov rax , address ; call rax
+static void emit_call(jit_buffer *b, const void *function) {
+  EMIT(b, 0x48, 0xB8);
+  emit_u64(b, (uint64_t)(uintptr_t)function);
+  EMIT(b, 0xFF, 0xD0);
+}
+
+static void emit_jump_back(jit_buffer *b, size_t position) {
+  EMIT(b, 0xE9);
+  emit_u32(b, (uint32_t)(position - (b->count + 4)));
+}
+
+// jump to bytecode instruction , offset is known only after whole proto is
+// emitted
+static void emit_jump_to(jit_buffer *b, uint8_t condition, uint32_t target) {
+  if (condition)
+    EMIT(b, 0x0F, condition);
+  else
+    EMIT(b, 0xE9);
+
+  if (b->fixup_count >= b->fixup_capacity) {
+    b->fixup_capacity = b->fixup_capacity ? b->fixup_capacity * 2 : 64;
+    b->fixups = realloc(b->fixups, sizeof(jit_fixup) * b->fixup_capacity);
+    if (!b->fixups)
+      elog("Error allocation memory for jit jumps");
+  }
+  b->fixups[b->fixup_count++] = (jit_fixup){.at = b->count, .target = target};
+  emit_u32(b, 0);
+}
+
+// mov eax , pc ; jmp epilogue
+static void emit_exit(jit_buffer *b, uint32_t pc, size_t epilogue) {
+  EMIT(b, 0xB8);
+  emit_u32(b, pc);
+  emit_jump_back(b, epilogue);
+}
+
+static void jit_divide_by_zero(void) { elog("Can't divide by zero"); }
+
+static void jit_unset_variable(proto *fn, uint32_t name) {
+  elog("Variable '%s' not found", symbol_name(fn->names[name]));
+}
+
+// counter , end and step of range loop at 'loop' , end becomes trips left
+static bool jit_range_start(double *loop) {
+  loop[1] = range_trips(loop[0], loop[1], loop[2]);
+  return loop[1] > 0;
+}
+
+#if STATS_ENABLED
+// counters are thread local and native code runs on every thread of pool , so
+// jit_enter hands counters of its thread over in r14 and native calls pass
+// them on
+// inc qword [r14 + offset] , offset is that of counter in stats_t
+static void emit_count(jit_buffer *b, size_t offset) {
+  EMIT(b, 0x49, 0xFF, 0x86);
+  emit_u32(b, (uint32_t)offset);
+}
+#endif
+
+typedef enum { CMP_LT, CMP_LE, CMP_GT, CMP_GE, CMP_EQ, CMP_NE } compare_kind;
+
+static compare_kind compare_of(opcode op) {
+  switch (op) {
+  case OP_LT:
+  case OP_IFLT:
+  case OP_IFLTK:
+    return CMP_LT;
+  case OP_LE:
+  case OP_IFLE:
+  case OP_IFLEK:
+    return CMP_LE;
+  case OP_GT:
+  case OP_IFGT:
+  case OP_IFGTK:
+    return CMP_GT;
+  case OP_GE:
+  case OP_IFGE:
+  case OP_IFGEK:
+    return CMP_GE;
+  case OP_EQ:
+  case OP_IFEQ:
+  case OP_IFEQK:
+    return CMP_EQ;
+  default:
+    return CMP_NE;
+  }
+}
+
+// check_operands(first , second) , it returns only when neither is array
+static void emit_operand_check(jit_buffer *b, int first_base, uint32_t first,
+                               int second_base, uint32_t second) {
+  emit_load(b, 0, first_base, first);
+  emit_load(b, 1, second_base, second);
+  emit_call(b, check_operands);
+}
+
+// ucomisd sets flags of unsigned compare and parity on nan , so 'x < y' is
+// tested as 'y above x' which is false for nan as in C
+static void emit_ucomisd(jit_buffer *b, compare_kind kind, int first_base,
+                         uint32_t first, int second_base, uint32_t second) {
+  if (kind == CMP_LT || kind == CMP_LE) {
+    emit_load(b, 0, second_base, second);
+    emit_sse(b, SSE_PACKED, SSE_COMPARE, 0, first_base, first);
+  } else {
+    emit_load(b, 0, first_base, first);
+    emit_sse(b, SSE_PACKED, SSE_COMPARE, 0, second_base, second);
+  }
+}
+
+// unordered operands (parity set) are checked for arrays , then compared again
+// as check clobbers flags
+static void emit_compare(jit_buffer *b, compare_kind kind, int first_base,
+                         uint32_t first, int second_base, uint32_t second) {
+  emit_ucomisd(b, kind, first_base, first, second_base, second);
+  EMIT(b, 0x7B, 0x00); // jnp over
+  size_t skip = b->count;
+  emit_operand_check(b, first_base, first, second_base, second);
+  emit_ucomisd(b, kind, first_base, first, second_base, second);
+  b->bytes[skip - 1] = (uint8_t)(b->count - skip);
+}
+
+// R[a] = comparison ? 1.0 : 0.0
+static void emit_compare_value(jit_buffer *b, compare_kind kind, instr in) {
+  emit_compare(b, kind, BASE_R, in.b, BASE_R, in.c);
+  switch (kind) {
+  case CMP_LT:
+  case CMP_GT:
+    EMIT(b, 0x0F, 0x97, 0xC0); // seta al
+    break;
+  case CMP_LE:
+  case CMP_GE:
+    EMIT(b, 0x0F, 0x93, 0xC0); // setae al
+    break;
+  case CMP_EQ:
+    EMIT(b, 0x0F, 0x94, 0xC0); // sete al
+    EMIT(b, 0x0F, 0x9B, 0xC1); // setnp cl
+    EMIT(b, 0x20, 0xC8);       // and al , cl
+    break;
+  case CMP_NE:
+    EMIT(b, 0x0F, 0x95, 0xC0); // setne al
+    EMIT(b, 0x0F, 0x9A, 0xC1); // setp cl
+    EMIT(b, 0x08, 0xC8);       // or al , cl
+    break;
+  }
+  EMIT(b, 0x0F, 0xB6, 0xC0);       // movzx eax , al
+  EMIT(b, 0xF2, 0x0F, 0x2A, 0xC0); // cvtsi2sd xmm0 , eax
+  emit_store(b, 0, in.a);
+}
+
+// jumps to 'target' when comparison is true
+static void emit_compare_branch(jit_buffer *b, compare_kind kind,
+                                int second_base, instr in, uint32_t target) {
+  emit_compare(b, kind, BASE_R, in.a, second_base, in.b);
+  switch (kind) {
+  case CMP_LT:
+  case CMP_GT:
+    emit_jump_to(b, JUMP_ABOVE, target);
+    break;
+  case CMP_LE:
+  case CMP_GE:
+    emit_jump_to(b, JUMP_ABOVE_EQUAL, target);
+    break;
+  case CMP_EQ:
+    EMIT(b, 0x7A, 0x06); // jp over je , nan is never equal
+    emit_jump_to(b, JUMP_EQUAL, target);
+    break;
+  case CMP_NE:
+    emit_jump_to(b, JUMP_PARITY, target);
+    emit_jump_to(b, JUMP_NOT_EQUAL, target);
+    break;
+  }
+}
+
+// nan result (parity set) means operand may be array , it is checked and
+// result is computed again as check clobbers xmm0
+static void emit_arithmetic(jit_buffer *b, uint8_t op, instr in,
+                            int second_base) {
+  emit_load(b, 0, BASE_R, in.b);
+  emit_sse(b, SSE_DOUBLE, op, 0, second_base, in.c);
+  EMIT(b, 0x66, 0x0F, 0x2E, 0xC0); // ucomisd xmm0 , xmm0
+  EMIT(b, 0x7B, 0x00);             // jnp over
+  size_t skip = b->count;
+  emit_operand_check(b, BASE_R, in.b, second_base, in.c);
+  emit_load(b, 0, BASE_R, in.b);
+  emit_sse(b, SSE_DOUBLE, op, 0, second_base, in.c);
+  b->bytes[skip - 1] = (uint8_t)(b->count - skip);
+  emit_store(b, 0, in.a);
+}
+
+static void emit_divide(jit_buffer *b, instr in) {
+  emit_load(b, 1, BASE_R, in.c);
+  EMIT(b, 0x66, 0x0F, 0x57, 0xD2); // xorpd xmm2 , xmm2
+  EMIT(b, 0x66, 0x0F, 0x2E, 0xCA); // ucomisd xmm1 , xmm2
+  EMIT(b, 0x7A, 0x0E);             // jp over call , nan is not zero
+  EMIT(b, 0x75, 0x0C);             // jne over call
+  emit_call(b, jit_divide_by_zero);
+  emit_arithmetic(b, SSE_DIV, in, BASE_R);
+}
+
+// no trips fall to following OP_JMP past body , otherwise counter goes to
+// variable and body starts
+static void emit_range_start(jit_buffer *b, uint32_t at, instr in) {
+  EMIT(b, 0x48, 0x8D, 0xBB); // lea rdi , [rbx + 8 * a]
+  emit_u32(b, (uint32_t)in.a * 8);
+  emit_call(b, jit_range_start);
+  EMIT(b, 0x84, 0xC0); // test al , al
+  emit_jump_to(b, JUMP_EQUAL, at + 1);
+  emit_load(b, 0, BASE_R, in.a);
+  emit_store(b, 0, in.b);
+  emit_jump_to(b, 0, at + 2);
+}
+
+// one compare of trips left per iteration , then counter steps and body
+// starts again at target of following OP_JMP
+static void emit_range_loop(jit_buffer *b, proto *fn, uint32_t at, instr in) {
+#if STATS_ENABLED
+  emit_count(b, offsetof(stats_t, loop_iterations));
+#endif
+  double one = 1.0;
+  uint64_t one_bits;
+  memcpy(&one_bits, &one, sizeof(one_bits));
+
+  emit_load(b, 0, BASE_R, in.a + 1);
+  EMIT(b, 0x48, 0xB8); // mov rax , 1.0
+  emit_u64(b, one_bits);
+  EMIT(b, 0x66, 0x48, 0x0F, 0x6E, 0xC8); // movq xmm1 , rax
+  EMIT(b, 0xF2, 0x0F, 0x5C, 0xC1);       // subsd xmm0 , xmm1
+  emit_store(b, 0, in.a + 1);
+  EMIT(b, 0x66, 0x0F, 0x57, 0xC9); // xorpd xmm1 , xmm1
+  EMIT(b, 0x66, 0x0F, 0x2E, 0xC1); // ucomisd xmm0 , xmm1
+  emit_jump_to(b, JUMP_BELOW_EQUAL, at + 2);
+
+  emit_load(b, 0, BASE_R, in.a);
+  emit_sse(b, SSE_DOUBLE, SSE_ADD, 0, BASE_R, in.a + 2);
+  emit_store(b, 0, in.a);
+  emit_store(b, 0, in.b);
+  emit_jump_to(b, 0, INSTR_BX(fn->code[at + 1]));
+}
+
+// bits of R[b] are compared with unset value , helper is called only when
+// they match and never returns
+static void emit_read(jit_buffer *b, instr in) {
+  EMIT(b, 0x48, 0x8B, 0x83); // mov rax , [rbx + 8 * b]
+  emit_u32(b, (uint32_t)in.b * 8);
+  EMIT(b, 0x48, 0xB9); // mov rcx , unset
+  emit_u64(b, UNSET_BITS);
+  EMIT(b, 0x48, 0x39, 0xC8); // cmp rax , rcx
+  EMIT(b, 0x75, 0x00);       // jne over
+  size_t skip = b->count;
+  EMIT(b, 0x4C, 0x89, 0xEF); // mov rdi , r13
+  EMIT(b, 0xBE);             // mov esi , c
+  emit_u32(b, in.c);
+  emit_call(b, jit_unset_variable);
+  b->bytes[skip - 1] = (uint8_t)(b->count - skip);
+  EMIT(b, 0x48, 0x89, 0x83); // mov [rbx + 8 * a] , rax
+  emit_u32(b, (uint32_t)in.a * 8);
+}
+
+// checked accesses go through the same C functions as vm , their operands
+// and result are doubles in xmm0 - xmm2
+static void emit_checked_get(jit_buffer *b, instr in) {
+  emit_load(b, 0, BASE_R, in.b);
+  emit_load(b, 1, BASE_R, in.c);
+  emit_call(b, array_get);
+  emit_store(b, 0, in.a);
+}
+
+static void emit_checked_set(jit_buffer *b, instr in) {
+  emit_load(b, 0, BASE_R, in.a);
+  emit_load(b, 1, BASE_R, in.b);
+  emit_load(b, 2, BASE_R, in.c);
+  emit_call(b, array_set);
+}
+
+// rax = data of array R[array] , rcx = index R[index] , guard of the loop
+// made sure both are valid
+static void emit_element_address(jit_buffer *b, uint32_t array,
+                                 uint32_t index) {
+  EMIT(b, 0x48, 0x8B, 0x83); // mov rax , [rbx + 8 * array]
+  emit_u32(b, array * 8);
+  EMIT(b, 0x48, 0xC1, 0xE0, 64 - ARRAY_TAG_SHIFT); // shl rax , tag bits
+  EMIT(b, 0x48, 0xC1, 0xE8, 64 - ARRAY_TAG_SHIFT); // shr rax , tag bits
+  EMIT(b, 0x48, 0x8B, 0x80);                       // mov rax , [rax + data]
+  emit_u32(b, (uint32_t)offsetof(array_t, data));
+  EMIT(b, 0xF2, 0x48, 0x0F, 0x2C, 0x8B); // cvttsd2si rcx , [rbx + 8 * index]
+  emit_u32(b, index * 8);
+}
+
+static void emit_unchecked_get(jit_buffer *b, instr in) {
+  emit_element_address(b, in.b, in.c);
+  EMIT(b, 0xF2, 0x0F, 0x10, 0x04, 0xC8); // movsd xmm0 , [rax + rcx * 8]
+  emit_store(b, 0, in.a);
+}
+
+static void emit_unchecked_set(jit_buffer *b, instr in) {
+  emit_element_address(b, in.a, in.b);
+  emit_load(b, 0, BASE_R, in.c);
+  EMIT(b, 0xF2, 0x0F, 0x11, 0x04, 0xC8); // movsd [rax + rcx * 8] , xmm0
+}
+
+// holding guard skips following OP_JMP to checked version of loop
+static void emit_guard(jit_buffer *b, uint32_t at, instr in) {
+  EMIT(b, 0x48, 0x8D, 0xBB); // lea rdi , [rbx + 8 * a]
+  emit_u32(b, (uint32_t)in.a * 8);
+  emit_load(b, 0, BASE_R, in.b);
+  EMIT(b, 0xBE); // mov esi , offset
+  emit_u32(b, (uint32_t)(int32_t)(int16_t)in.c);
+  emit_call(b, array_fits);
+  EMIT(b, 0x84, 0xC0); // test al , al
+  emit_jump_to(b, JUMP_NOT_EQUAL, at + 2);
+}
+
+// builtin reads its arguments from registers in place
+static void emit_builtin(jit_buffer *b, instr in) {
+  EMIT(b, 0x48, 0x8D, 0xBB); // lea rdi , [rbx + 8 * a]
+  emit_u32(b, (uint32_t)in.a * 8);
+  emit_call(b, builtins[in.c].fn);
+  emit_store(b, 0, in.a);
+}
+
+// native callee is called straight from here , so nested native calls take
+// one C frame each
+static void emit_native_call(jit_buffer *b, uint32_t at, instr in,
+                             const jit_helpers *helpers) {
+  EMIT(b, 0x4C, 0x89, 0xE7); // mov rdi , r12
+  EMIT(b, 0x4C, 0x89, 0xEE); // mov rsi , r13
+  EMIT(b, 0xBA);             // mov edx , at
+  emit_u32(b, at);
+  EMIT(b, 0x48, 0x89, 0xD9); // mov rcx , rbx
+  emit_call(b, helpers->call);
+
+  EMIT(b, 0x48, 0x85, 0xC0); // test rax , rax
+  EMIT(b, 0x74, 0x00);       // jz over , value is already stored
+  size_t skip = b->count;
+
+  EMIT(b, 0x48, 0x89, 0xC7); // mov rdi , rax
+  EMIT(b, 0x4C, 0x89, 0xE6); // mov rsi , r12
+  EMIT(b, 0x4C, 0x89, 0xF1); // mov rcx , r14
+  EMIT(b, 0xFF, 0xD2);       // call rdx
+  EMIT(b, 0x4C, 0x89, 0xE7); // mov rdi , r12
+  EMIT(b, 0x48, 0x89, 0xC6); // mov rsi , rax
+  emit_call(b, helpers->ret);
+  emit_store(b, 0, in.a);
+
+  b->bytes[skip - 1] = (uint8_t)(b->count - skip);
+}
+
+// frames cleared by fast path of self tail call , bigger ones go through
+// helper to keep code short
+#define MAX_INLINE_TAIL_SLOTS 16
+
+// cached callee of call site is fn itself , args are copied over params and
+// native code starts over , otherwise helper looks callee up and either
+// reuses frame the same way or it is a plain call
+static void emit_tail_call(jit_buffer *b, proto *fn, uint32_t at, instr in,
+                           const jit_helpers *helpers) {
+  size_t fast = 0;
+  if (fn->slot_count <= MAX_INLINE_TAIL_SLOTS) {
+    EMIT(b, 0x49, 0x8B, 0x85); // mov rax , [r13 + callees]
+    emit_u32(b, (uint32_t)offsetof(proto, callees));
+    EMIT(b, 0x48, 0x8B, 0x80); // mov rax , [rax + 8 * c]
+    emit_u32(b, (uint32_t)in.c * 8);
+    EMIT(b, 0x4C, 0x39, 0xE8); // cmp rax , r13
+    EMIT(b, 0x0F, JUMP_NOT_EQUAL);
+    fast = b->count;
+    emit_u32(b, 0);
+
+    for (uint32_t i = 0; i < fn->param_count; i++) {
+      emit_load(b, 0, BASE_R, in.a + i);
+      emit_store(b, 0, i);
+    }
+    EMIT(b, 0x48, 0xB8); // mov rax , unset
+    emit_u64(b, UNSET_BITS);
+    EMIT(b, 0x66, 0x48, 0x0F, 0x6E, 0xC0); // movq xmm0 , rax
+    for (uint32_t i = fn->param_count; i < fn->slot_count; i++)
+      emit_store(b, 0, i);
+#if STATS_ENABLED
+    emit_count(b, offsetof(stats_t, function_calls));
+#endif
+    emit_jump_to(b, 0, 0);
+    patch_u32(b, fast, (uint32_t)(b->count - (fast + 4)));
+  }
+
+  EMIT(b, 0x4C, 0x89, 0xE7); // mov rdi , r12
+  EMIT(b, 0x4C, 0x89, 0xEE); // mov rsi , r13
+  EMIT(b, 0xBA);             // mov edx , at
+  emit_u32(b, at);
+  EMIT(b, 0x48, 0x89, 0xD9); // mov rcx , rbx
+  emit_call(b, helpers->tail);
+  EMIT(b, 0x84, 0xC0); // test al , al
+  emit_jump_to(b, JUMP_NOT_EQUAL, 0);
+
+  emit_native_call(b, at, in, helpers);
+}
+
+static void emit_prologue(jit_buffer *b, proto *fn) {
+  EMIT(b, 0x53);                   // push rbx
+  EMIT(b, 0x55);                   // push rbp
+  EMIT(b, 0x41, 0x54);             // push r12
+  EMIT(b, 0x41, 0x55);             // push r13
+  EMIT(b, 0x41, 0x56);             // push r14 , stack is aligned for calls
+  EMIT(b, 0x48, 0x89, 0xFB);       // mov rbx , rdi
+  EMIT(b, 0x49, 0x89, 0xF4);       // mov r12 , rsi
+  EMIT(b, 0x49, 0x89, 0xCE);       // mov r14 , rcx
+  EMIT(b, 0x48, 0xBD);             // mov rbp , consts
+  emit_u64(b, (uint64_t)(uintptr_t)fn->consts);
+  EMIT(b, 0x49, 0xBD); // mov r13 , fn
+  emit_u64(b, (uint64_t)(uintptr_t)fn);
+}
+
+static void emit_epilogue(jit_buffer *b) {
+  EMIT(b, 0x41, 0x5E);             // pop r14
+  EMIT(b, 0x41, 0x5D);             // pop r13
+  EMIT(b, 0x41, 0x5C);             // pop r12
+  EMIT(b, 0x5D);                   // pop rbp
+  EMIT(b, 0x5B);                   // pop rbx
+  EMIT(b, 0xC3);                   // ret
+}
+
+// false when instruction has no template and native code must leave to
+// interpreter before it
+static bool emit_instr(jit_buffer *b, proto *fn, uint32_t at,
+                       const jit_helpers *helpers, size_t epilogue) {
+  instr in = fn->code[at];
+
+  switch (in.op) {
+  case OP_LOADK:
+    if (INSTR_BX(in) >= MAX_OPERAND_INDEX)
+      return false;
+    emit_load(b, 0, BASE_K, INSTR_BX(in));
+    emit_store(b, 0, in.a);
+    return true;
+
+  case OP_MOVE:
+    emit_load(b, 0, BASE_R, in.b);
+    emit_store(b, 0, in.a);
+    return true;
+
+  case OP_READ:
+    emit_read(b, in);
+    return true;
+
+  case OP_ADD:
+    emit_arithmetic(b, SSE_ADD, in, BASE_R);
+    return true;
+  case OP_SUB:
+    emit_arithmetic(b, SSE_SUB, in, BASE_R);
+    return true;
+  case OP_MUL:
+    emit_arithmetic(b, SSE_MUL, in, BASE_R);
+    return true;
+  case OP_DIV:
+    emit_divide(b, in);
+    return true;
+
+  case OP_ADDK:
+    emit_arithmetic(b, SSE_ADD, in, BASE_K);
+    return true;
+  case OP_SUBK:
+    emit_arithmetic(b, SSE_SUB, in, BASE_K);
+    return true;
+  case OP_MULK:
+    emit_arithmetic(b, SSE_MUL, in, BASE_K);
+    return true;
+  case OP_DIVK:
+    // constant divisor is known , zero check is resolved here
+    if (fn->consts[in.c] == 0)
+      emit_call(b, jit_divide_by_zero);
+    else
+      emit_arithmetic(b, SSE_DIV, in, BASE_K);
+    return true;
+
+  case OP_LT:
+  case OP_LE:
+  case OP_GT:
+  case OP_GE:
+  case OP_EQ:
+  case OP_NE:
+    emit_compare_value(b, compare_of(in.op), in);
+    return true;
+
+  // true comparison skips following OP_JMP , false one falls to it
+  case OP_IFLT:
+  case OP_IFLE:
+  case OP_IFGT:
+  case OP_IFGE:
+  case OP_IFEQ:
+  case OP_IFNE:
+    emit_compare_branch(b, compare_of(in.op), BASE_R, in, at + 2);
+    return true;
+  case OP_IFLTK:
+  case OP_IFLEK:
+  case OP_IFGTK:
+  case OP_IFGEK:
+  case OP_IFEQK:
+  case OP_IFNEK:
+    emit_compare_branch(b, compare_of(in.op), BASE_K, in, at + 2);
+    return true;
+
+  case OP_JMP:
+    emit_jump_to(b, 0, INSTR_BX(in));
+    return true;
+
+  case OP_LOOP:
+#if STATS_ENABLED
+    emit_count(b, offsetof(stats_t, loop_iterations));
+#endif
+    emit_jump_to(b, 0, INSTR_BX(in));
+    return true;
+
+  case OP_FORPREP:
+    emit_range_start(b, at, in);
+    return true;
+
+  case OP_FORLOOP:
+    emit_range_loop(b, fn, at, in);
+    return true;
+
+  case OP_JMPF:
+    emit_load(b, 0, BASE_R, in.a);
+    EMIT(b, 0x66, 0x0F, 0x57, 0xC9); // xorpd xmm1 , xmm1
+    EMIT(b, 0x66, 0x0F, 0x2E, 0xC1); // ucomisd xmm0 , xmm1
+    EMIT(b, 0x7A, 0x06);             // jp over je , nan is not zero
+    emit_jump_to(b, JUMP_EQUAL, INSTR_BX(in));
+    return true;
+
+  case OP_GETI:
+    emit_checked_get(b, in);
+    return true;
+  case OP_SETI:
+    emit_checked_set(b, in);
+    return true;
+  case OP_GETU:
+    emit_unchecked_get(b, in);
+    return true;
+  case OP_SETU:
+    emit_unchecked_set(b, in);
+    return true;
+  case OP_GUARD:
+    emit_guard(b, at, in);
+    return true;
+  case OP_NATIVE:
+    emit_builtin(b, in);
+    return true;
+
+  case OP_PRINT:
+    emit_load(b, 0, BASE_R, in.a);
+    emit_call(b, print_value);
+    return true;
+
+  case OP_CALL:
+    emit_native_call(b, at, in, helpers);
+    return true;
+
+  case OP_TAILCALL:
+    emit_tail_call(b, fn, at, in, helpers);
+    return true;
+
+  case OP_RET:
+    emit_load(b, 0, BASE_R, in.a);
+    emit_exit(b, JIT_RETURNED, epilogue);
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+jit_code *jit_compile(proto *fn, const jit_helpers *helpers) {
+  if (!fn || !helpers)
+    elog("Can't jit compile , null ptr on proto or call helper");
+  if (!enabled || fn->code_count == 0 || fn->code_count >= UINT32_MAX)
+    return NULL;
+
+  jit_buffer b = {0};
+  uint32_t *offsets = malloc(sizeof(uint32_t) * (fn->code_count + 1));
+  if (!offsets)
+    elog("Error allocation memory for jit offsets");
+
+  emit_prologue(&b, fn);
+  emit_jump_to(&b, 0, 0);
+  size_t resume = b.count;
+  emit_prologue(&b, fn);
+  EMIT(&b, 0xFF, 0xE2); // jmp rdx
+  size_t epilogue = b.count;
+  emit_epilogue(&b);
+
+  for (uint32_t at = 0; at < fn->code_count; at++) {
+    offsets[at] = (uint32_t)b.count;
+    if (!emit_instr(&b, fn, at, helpers, epilogue))
+      emit_exit(&b, at, epilogue);
+  }
+  offsets[fn->code_count] = (uint32_t)b.count;
+  EMIT(&b, 0x0F, 0x0B); // ud2 , code never runs past last return
+
+  for (size_t i = 0; i < b.fixup_count; i++) {
+    jit_fixup fixup = b.fixups[i];
+    patch_u32(&b, fixup.at,
+              (uint32_t)(offsets[fixup.target] - (fixup.at + 4)));
+  }
+  free(b.fixups);
+
+  // code is written while mapping is writable and only then made executable
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t size = (b.count + page - 1) / page * page;
+  uint8_t *memory =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    free(b.bytes);
+    free(offsets);
+    return NULL;
+  }
+  memcpy(memory, b.bytes, b.count);
+  free(b.bytes);
+  if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(memory, size);
+    free(offsets);
+    return NULL;
+  }
+
+  jit_code *code = malloc(sizeof(jit_code));
+  if (!code)
+    elog("Error allocation memory for jit code");
+  code->memory = memory;
+  code->size = size;
+  code->resume = (uint32_t)resume;
+  code->offsets = offsets;
+  STAT_INC(jit_compiled);
+  return code;
+}
+
+// call entry takes the same arguments , it ignores start
+typedef jit_exit (*jit_native)(double *regs, void *vm, const void *start,
+                               stats_t *counters);
+
+jit_exit jit_enter(jit_code *code, double *regs, void *vm, size_t pc) {
+  jit_native native = (jit_native)(void *)(code->memory + code->resume);
+#if STATS_ENABLED
+  stats_t *counters = &stats;
+#else
+  stats_t *counters = NULL;
+#endif
+  return native(regs, vm, code->memory + code->offsets[pc], counters);
+}
+
+void free_jit_code(jit_code *code) {
+  if (!code)
+    return;
+
+  munmap(code->memory, code->size);
+  free(code->offsets);
+  free(code);
+}
+
+#else
+
+jit_code *jit_compile(proto *fn, const jit_helpers *helpers) {
+  (void)fn;
+  (void)helpers;
+  return NULL;
+}
+
+jit_exit jit_enter(jit_code *code, double *regs, void *vm, size_t pc) {
+  (void)code;
+  (void)regs;
+  (void)vm;
+  (void)pc;
+  elog("Jit is not supported on this platform");
+  return (jit_exit){0};
+}
+
+void free_jit_code(jit_code *code) { (void)code; }
+
+#endif
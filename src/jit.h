@@ -0,0 +1,71 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bytecode.h"
+
+// Baseline template jit , every bytecode instruction of hot proto is
+// translated to fixed sequence of x86-64 SSE2 code working on the same
+// registers as interpreter , so interpreter and native code can hand frame
+// over to each other at any instruction. Instructions without template
+// (like OP_DEFN) leave native code and interpreter continues from them.
+#if defined(__x86_64__) && defined(__linux__) && !defined(ANNUUM_NO_JIT)
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+// calls plus loop iterations of proto before it is compiled
+#define JIT_THRESHOLD 1000
+// native code calls other functions through C stack , deeper calls stay in
+// interpreter which keeps its frames on heap
+#define JIT_MAX_DEPTH 2000
+#define JIT_RETURNED UINT32_MAX
+
+// native code starts with call entry running proto from first instruction ,
+// resume entry at 'resume' continues from instruction given by interpreter
+typedef struct jit_code {
+  uint8_t *memory;
+  size_t size;
+  uint32_t resume;
+  // native offset of every bytecode instruction
+  uint32_t *offsets;
+} jit_code;
+
+// pc is JIT_RETURNED when proto returned 'value' , otherwise index of
+// instruction interpreter continues from
+typedef struct jit_exit {
+  uint64_t pc;
+  double value;
+} jit_exit;
+
+// frame of callee which native code calls directly at 'code' , regs is NULL
+// when callee was already run by interpreter and its value stored
+typedef struct jit_target {
+  double *regs;
+  const uint8_t *code;
+} jit_target;
+
+// native code of call instruction 'at' of fn asks vm to push callee frame ,
+// after native callee exits vm pops it (or interprets rest of it) and gives
+// value of call
+typedef struct jit_helpers {
+  jit_target (*call)(void *vm, proto *fn, uint32_t at, double *regs);
+  double (*ret)(void *vm, uint64_t pc, double value);
+  // tail call instruction 'at' , true when it reused frame of fn for self
+  // call and native code jumps to its start
+  bool (*tail)(void *vm, proto *fn, uint32_t at, double *regs);
+} jit_helpers;
+
+void jit_set_enabled(bool enabled);
+bool jit_enabled(void);
+
+// returns NULL when proto can't be compiled , it then stays interpreted
+jit_code *jit_compile(proto *fn, const jit_helpers *helpers);
+jit_exit jit_enter(jit_code *code, double *regs, void *vm, size_t pc);
+void free_jit_code(jit_code *code);
+
+#endif
@@ -1,37 +1,109 @@
 #include "lexer.h"
+#include "depth.h"
 #include "logger.h"
 #include "parser.h"
+#include "stats.h"
+#include "walk.h"
 #include <stdio.h>
 #include <string.h>
 
-ast_node *new_function_def_node(const char *name, arr_t *parameters,
+// copies collected nodes out of temporary arr into the arena
+static ast_list new_ast_list(arena_t *arena, arr_t *nodes) {
+  ast_list list = {.items = NULL, .count = 0};
+  if (!nodes || nodes->size == 0)
+    return list;
+
+  list.items = arena_copy(arena, nodes->data, sizeof(ast_node *) * nodes->size);
+  list.count = nodes->size;
+  return list;
+}
+
+static ast_node *new_node(arena_t *arena) {
+  STAT_INC(ast_nodes);
+  ast_node *node = (ast_node *)arena_alloc(arena, sizeof(ast_node));
+  if (node)
+    node->line = 0;
+  return node;
+}
+
+// nodes get line of their first token , inner nodes keep lines set earlier
+static ast_node *at_line(ast_node *node, size_t line) {
+  if (node && node->line == 0)
+    node->line = (uint32_t)line;
+  return node;
+}
+
+ast_node *new_function_def_node(arena_t *arena, symbol_t name,
+                                symbol_t *parameters, size_t param_count,
                                 ast_node *body) {
-  ast_node *node = (ast_node *)malloc(sizeof(ast_node));
+  ast_node *node = new_node(arena);
   if (!node)
     elog("Error allocation memory for ast node (function definition)");
 
   node->type = NODE_FUNCTION_DEF;
-  node->data.function_def.name = strdup(name);
-  node->data.function_def.params = parameters;
+  node->data.function_def.name = name;
+  node->data.function_def.params =
+      arena_copy(arena, parameters, sizeof(symbol_t) * param_count);
+  node->data.function_def.param_count = param_count;
   node->data.function_def.body = body;
+  node->data.function_def.slot_count = 0;
+  node->data.function_def.pure = false;
+  node->data.function_def.memoize = false;
 
   return node;
 }
 
-ast_node *new_function_call_node(const char *name, arr_t *arguments) {
-  ast_node *node = (ast_node *)malloc(sizeof(ast_node));
+ast_node *new_function_call_node(arena_t *arena, symbol_t name,
+                                 arr_t *arguments) {
+  ast_node *node = new_node(arena);
   if (!node)
     elog("Error allocation memory for ast node (function call)");
 
   node->type = NODE_FUNCTION_CALL;
-  node->data.function_call.name = strdup(name);
-  node->data.function_call.arguments = arguments;
+  node->data.function_call.name = name;
+  node->data.function_call.arguments = new_ast_list(arena, arguments);
+  node->data.function_call.target = NULL;
+  node->data.function_call.cached_run = 0;
+  node->data.function_call.builtin = NULL;
+
+  return node;
+}
+
+ast_node *new_index_node(arena_t *arena, symbol_t name, ast_node *index) {
+  if (name == NO_SYMBOL)
+    elog("Can't create index ast node without array name");
+  if (!index)
+    elog("Can't create index ast node with null ptr on index ast node");
+
+  ast_node *node = new_node(arena);
+  if (!node)
+    elog("Error allocation memory for ast node (index)");
+
+  node->type = NODE_INDEX;
+  node->data.element.name = name;
+  node->data.element.slot = 0;
+  node->data.element.index = index;
+  node->data.element.value = NULL;
+  node->data.element.hoisted = false;
+  node->data.element.maybe_unset = false;
+
+  return node;
+}
+
+ast_node *new_index_assign_node(arena_t *arena, symbol_t name, ast_node *index,
+                                ast_node *value) {
+  if (!value)
+    elog("Can't create index assignment ast node with null ptr on value ast "
+         "node");
 
+  ast_node *node = new_index_node(arena, name, index);
+  node->type = NODE_INDEX_ASSIGN;
+  node->data.element.value = value;
   return node;
 }
 
-ast_node *new_return_node(ast_node *value) {
-  ast_node *node = (ast_node *)malloc(sizeof(ast_node));
+ast_node *new_return_node(arena_t *arena, ast_node *value) {
+  ast_node *node = new_node(arena);
   if (!node)
     elog("Error allocation memory for ast node (return)");
 
@@ -41,8 +113,8 @@ ast_node *new_return_node(ast_node *value) {
   return node;
 }
 
-ast_node *new_loop_stop_node() {
-  ast_node *node = (ast_node *)malloc(sizeof(ast_node));
+ast_node *new_loop_stop_node(arena_t *arena) {
+  ast_node *node = new_node(arena);
   if (!node)
     elog("Error allocation memory for ast node (number type)");
 
@@ -50,8 +122,8 @@ ast_node *new_loop_stop_node() {
   return node;
 }
 
-ast_node *new_loop_next_node() {
-  ast_node *node = (ast_node *)malloc(sizeof(ast_node));
+ast_node *new_loop_next_node(arena_t *arena) {
+  ast_node *node = new_node(arena);
   if (!node)
     elog("Error allocation memory for ast node (number type)");
 
@@ -59,8 +131,8 @@ ast_node *new_loop_next_node() {
   return node;
 }
 
-ast_node *new_number_node(double value) {
-  ast_node *node = (ast_node *)malloc(sizeof(ast_node));
+ast_node *new_number_node(arena_t *arena, double value) {
+  ast_node *node = new_node(arena);
   if (!node)
     elog("Error allocation memory for ast node (number type)");
 
@@ -69,17 +141,19 @@ ast_node *new_number_node(double value) {
   return node;
 }
 
-ast_node *new_binary_node(ast_node *left, ast_node *right, TokenType type) {
+ast_node *new_binary_node(arena_t *arena, ast_node *left, ast_node *right,
+                          TokenType type) {
   if (!left)
     elog("Can't create binary node with null ptr on left ast node");
   if (!right)
     elog("Can't create binary node with null ptr on right ast node");
 
-  ast_node *node = (ast_node *)malloc(sizeof(ast_node));
+  ast_node *node = new_node(arena);
   if (!node)
     elog("Error allocation memory for ast node (binary type)");
 
   node->type = NODE_BIN_OP;
+  node->line = left->line;
   node->data.binary.left = left;
   node->data.binary.right = right;
   node->data.binary.op = type;
@@ -87,52 +161,51 @@ ast_node *new_binary_node(ast_node *left, ast_node *right, TokenType type) {
   return node;
 }
 
-ast_node *new_variable_node(const char *name, bool is_const) {
-  if (!name)
-    elog("Can't create new variable ast node with null ptr on it name");
-  if (*name == '\0')
-    elog("Can't create new variable ast node with empty name");
+ast_node *new_variable_node(arena_t *arena, symbol_t name, bool is_const) {
+  if (name == NO_SYMBOL)
+    elog("Can't create new variable ast node without name");
 
-  ast_node *node = (ast_node *)malloc(sizeof(ast_node));
+  ast_node *node = new_node(arena);
   if (!node)
     elog("Error allocation memory for ast node (variable type)");
 
   node->type = NODE_VARIABLE;
-  node->data.var.var_name = strdup(name);
+  node->data.var.var_name = name;
   node->data.var.is_const = is_const;
+  node->data.var.slot = 0;
+  node->data.var.maybe_unset = false;
 
   return node;
 }
 
-ast_node *new_assignment_node(const char *var_name, ast_node *value,
-                              bool is_const) {
-  if (!var_name)
-    elog("Can't create assigment ast node with null ptr on var name");
-  if (*var_name == '\0')
-    elog("Can't create assigment ast node with empty var name");
+ast_node *new_assignment_node(arena_t *arena, symbol_t var_name,
+                              ast_node *value, bool is_const) {
+  if (var_name == NO_SYMBOL)
+    elog("Can't create assigment ast node without var name");
   if (!value)
     elog("Can't create assigments ast node with null ptr on value ast node");
 
-  ast_node *node = (ast_node *)malloc(sizeof(ast_node));
+  ast_node *node = new_node(arena);
   if (!node)
     elog("Error allocation memory for ast node (assigment type)");
 
   node->type = NODE_ASSIGNMENT;
-  node->data.assignment.var_name = strdup(var_name);
+  node->data.assignment.var_name = var_name;
   node->data.assignment.value = value;
   node->data.assignment.is_const = is_const;
+  node->data.assignment.slot = 0;
 
   return node;
 }
 
-ast_node *new_if_node(ast_node *condition, ast_node *if_body,
+ast_node *new_if_node(arena_t *arena, ast_node *condition, ast_node *if_body,
                       ast_node *else_body) {
   if (!condition)
     elog("Can't create if node with null ptr on condition node");
   if (!if_body)
     elog("Can't create if node without if_body ast nod");
 
-  ast_node *node = (ast_node *)malloc(sizeof(ast_node));
+  ast_node *node = new_node(arena);
   if (!node)
     elog("Error allocation memory for ast node (if type)");
 
@@ -144,11 +217,11 @@ ast_node *new_if_node(ast_node *condition, ast_node *if_body,
   return node;
 }
 
-ast_node *new_print_node(ast_node *expression) {
+ast_node *new_print_node(arena_t *arena, ast_node *expression) {
   if (!expression)
     elog("Can't create print ast node with null ptr on expression ast node");
 
-  ast_node *node = (ast_node *)malloc(sizeof(ast_node));
+  ast_node *node = new_node(arena);
   if (!node)
     elog("Error allocation memory for ast node (print type)");
 
@@ -157,7 +230,7 @@ ast_node *new_print_node(ast_node *expression) {
   return node;
 }
 
-ast_node *new_block_node(arr_t *statements) {
+ast_node *new_block_node(arena_t *arena, arr_t *statements) {
   if (!statements)
     elog("Can't create new block ast node , with null ptr on statements arr");
   if (statements->size == 0)
@@ -165,22 +238,23 @@ ast_node *new_block_node(arr_t *statements) {
   if (!statements->data)
     elog("Can't create new block ast node with null ptr on arr_t -> items");
 
-  ast_node *node = (ast_node *)malloc(sizeof(ast_node));
+  ast_node *node = new_node(arena);
   if (!node)
     elog("Error allocation memory for ast node (statemenets type)");
 
   node->type = NODE_BLOCK;
-  node->data.block.statements = statements;
+  node->data.block.statements = new_ast_list(arena, statements);
   return node;
 }
 
-ast_node *new_loop_node(ast_node *condition, ast_node *loop_body) {
+ast_node *new_loop_node(arena_t *arena, ast_node *condition,
+                        ast_node *loop_body) {
   if (!condition)
     elog("Can't create loop ast node with null ptr on contidion ast node");
   if (!loop_body)
     elog("Can't create loop ast node with null ptr on loop body ast node");
 
-  ast_node *node = (ast_node *)malloc(sizeof(ast_node));
+  ast_node *node = new_node(arena);
   if (!node)
     elog("Error allocation memory for ast node (loop type)");
 
@@ -190,62 +264,58 @@ ast_node *new_loop_node(ast_node *condition, ast_node *loop_body) {
   return node;
 }
 
-void free_ast(ast_node *node) {
-  if (!node)
-    return;
-
-  switch (node->type) {
-  case NODE_BIN_OP:
-    free_ast(node->data.binary.left);
-    free_ast(node->data.binary.right);
-    break;
-  case NODE_ASSIGNMENT:
-    free(node->data.assignment.var_name);
-    free_ast(node->data.assignment.value);
-    break;
-  case NODE_VARIABLE:
-    free(node->data.var.var_name);
-    break;
-  case NODE_IF:
-    free_ast(node->data.if_stmt.condition);
-    free_ast(node->data.if_stmt.if_body);
-    if (node->data.if_stmt.else_body)
-      free_ast(node->data.if_stmt.else_body);
-    break;
-  case NODE_PRINT:
-    free_ast(node->data.print.expression);
-    break;
-  case NODE_BLOCK:
-    for (size_t i = 0; i < node->data.block.statements->size; i++) {
-      free_ast(arr_get(node->data.block.statements, i));
-    }
-    arr_destroy(node->data.block.statements);
-    break;
-  case NODE_LOOP:
-    free_ast(node->data.loop.condition);
-    free_ast(node->data.loop.loop_body);
-  default:
-    break;
-  }
+ast_node *new_range_loop_node(arena_t *arena, symbol_t var_name,
+                              ast_node *start, ast_node *end, ast_node *step,
+                              ast_node *loop_body) {
+  if (var_name == NO_SYMBOL)
+    elog("Can't create range loop ast node without var name");
+  if (!start || !end || !step)
+    elog("Can't create range loop ast node with null ptr on bound ast node");
+  if (!loop_body)
+    elog("Can't create range loop ast node with null ptr on loop body ast "
+         "node");
 
-  free(node);
+  ast_node *node = new_node(arena);
+  if (!node)
+    elog("Error allocation memory for ast node (range loop type)");
+
+  node->type = NODE_RANGE_LOOP;
+  node->data.range_loop.var_name = var_name;
+  node->data.range_loop.slot = 0;
+  node->data.range_loop.start = start;
+  node->data.range_loop.end = end;
+  node->data.range_loop.step = step;
+  node->data.range_loop.loop_body = loop_body;
+  node->data.range_loop.parallel = false;
+  node->data.range_loop.reductions = NULL;
+  node->data.range_loop.reduction_count = 0;
+  node->data.range_loop.guards = NULL;
+  node->data.range_loop.guard_count = 0;
+  return node;
 }
 
-lexer_t *new_lexer(arr_t *tokens) {
+lexer_t *new_lexer(const token_buffer *tokens, arena_t *arena) {
   if (!tokens)
-    elog("Can't create lexer with null ptr on tokens arr");
-  if (tokens->size == 0)
-    elog("Can't create lexer with empty list of tokens");
-  if (tokens->data == NULL)
-    elog("Can't create lexer with tokens arr with null ptr on arr_t -> items ");
+    elog("Can't create lexer with null ptr on token buffer");
+  if (tokens->count == 0)
+    elog("Can't create lexer with empty token buffer");
 
   lexer_t *lexer = (lexer_t *)malloc(sizeof(lexer_t));
   if (!lexer)
     elog("Error allocation memory for lexer_t struct");
 
-  lexer->current_index = 0;
   lexer->tokens = tokens;
-  lexer->current = (token *)arr_get(tokens, 0);
+  lexer->current = 0;
+  lexer->arena = arena;
+  lexer->open = NULL;
+  lexer->open_count = 0;
+  lexer->open_capacity = 0;
+  lexer->operands = NULL;
+  lexer->operand_count = 0;
+  lexer->operand_capacity = 0;
+  lexer->pending = NULL;
+  lexer->pending_count = 0;
+  lexer->pending_capacity = 0;
 
   return lexer;
 }
@@ -254,54 +324,54 @@ void free_lexer(lexer_t *lexer) {
   if (!lexer)
     return;
 
+  free(lexer->open);
+  free(lexer->operands);
+  free(lexer->pending);
   free(lexer);
 }
 
+// cursor never moves past last token , which is always EOF
 void lexer_skip(lexer_t *lexer, size_t count) {
   if (!lexer)
     elog("Can't skip lexer token, ptr on it is null");
   if (count == 0)
     elog("Can't skip zero tokens in lexer");
 
-  if (lexer->current_index + count >= lexer->tokens->size) {
-    count = lexer->tokens->size - lexer->current_index - 1;
-    if (count <= 0)
-      return;
-  }
+  size_t last = lexer->tokens->count - 1;
+  lexer->current = count >= last - lexer->current ? last : lexer->current + count;
+}
 
-  lexer->current_index += count;
-  lexer->current = arr_get(lexer->tokens, lexer->current_index);
+size_t lexer_column(const lexer_t *lexer) {
+  return token_column(lexer->tokens, lexer->current);
 }
 
-token *lexer_take(lexer_t *lexer) {
+size_t lexer_take(lexer_t *lexer) {
   if (!lexer)
     elog("Can't take next token in lexer by null ptr on it");
-  if (lexer->current_index + 1 >= lexer->tokens->size)
-    return NULL;
+  if (lexer->current + 1 >= lexer->tokens->count)
+    return NO_TOKEN;
 
-  lexer->current_index++;
-  lexer->current = arr_get(lexer->tokens, lexer->current_index);
-  return lexer->current;
+  return ++lexer->current;
 }
 
-token *lexer_look_back(lexer_t *lexer) {
+size_t lexer_look_back(lexer_t *lexer) {
   if (!lexer)
     elog("Can't look back at lexer by null ptr on it");
 
-  if (lexer->current_index == 0)
-    return NULL;
+  if (lexer->current == 0)
+    return NO_TOKEN;
 
-  return arr_get(lexer->tokens, lexer->current_index - 1);
+  return lexer->current - 1;
 }
 
-token *lexer_look_next(lexer_t *lexer) {
+size_t lexer_look_next(lexer_t *lexer) {
   if (!lexer)
     elog("Can't look next at lexer by null ptr on it");
 
-  if (lexer->current_index + 1 >= lexer->tokens->size)
-    return NULL;
+  if (lexer->current + 1 >= lexer->tokens->count)
+    return NO_TOKEN;
 
-  return arr_get(lexer->tokens, lexer->current_index + 1);
+  return lexer->current + 1;
 }
 
 void lexer_one_skip(lexer_t *lexer) {
@@ -317,7 +387,7 @@ void lexer_syntax_error(lexer_t *lexer, const char *message) {
   if (!message || *message == '\0')
     elog("Can't log syntax error , message is null or empty string");
 
-  elog("Syntax error %zu:%zu %s", lexer->current->line, lexer->current->offset,
+  elog("Syntax error %zu:%zu %s", lexer_line(lexer), lexer_column(lexer),
        message);
 }
 
@@ -325,19 +395,35 @@ bool lexer_skip_if_eq(lexer_t *lexer, TokenType type) {
   if (!lexer)
     elog("Can't skip if eq , lexer is null");
 
-  if (lexer->current->type != type)
+  if (lexer_type(lexer) != type)
     elog("Unexpected token type , excpect %d , have : %d", type,
-         lexer->current->type);
+         lexer_type(lexer));
 
   lexer_one_skip(lexer);
   return true;
 }
 
-void print_ast(ast_node *node, int indent) {
-  if (!node) {
-    return;
+// children of if and loops are printed under their labels
+static const char *child_label(ast_node *node, ast_node *parent) {
+  switch (parent ? parent->type : NODE_NOOP) {
+  case NODE_IF:
+    if (node == parent->data.if_stmt.condition)
+      return "CONDITION";
+    return node == parent->data.if_stmt.if_body ? "THEN" : "ELSE";
+  case NODE_LOOP:
+    return node == parent->data.loop.condition ? "CONDITION" : "BODY";
+  case NODE_RANGE_LOOP:
+    if (node == parent->data.range_loop.start)
+      return "START";
+    if (node == parent->data.range_loop.end)
+      return "END";
+    return node == parent->data.range_loop.step ? "STEP" : "BODY";
+  default:
+    return NULL;
   }
+}
 
+static void print_node(ast_node *node, int indent) {
   for (int i = 0; i < indent; i++) {
     printf("  ");
   }
@@ -385,43 +471,75 @@ void print_ast(ast_node *node, int indent) {
       break;
     }
 
-    print_ast(node->data.binary.left, indent + 1);
-    print_ast(node->data.binary.right, indent + 1);
     break;
 
   case NODE_VARIABLE:
-    printf("VARIABLE: %s\n", node->data.var.var_name);
+    printf("VARIABLE: %s\n", symbol_name(node->data.var.var_name));
     break;
 
   case NODE_ASSIGNMENT:
-    printf("ASSIGNMENT: %s =\n", node->data.assignment.var_name);
-    print_ast(node->data.assignment.value, indent + 1);
+    printf("ASSIGNMENT: %s =\n", symbol_name(node->data.assignment.var_name));
     break;
 
   case NODE_IF:
     printf("IF:\n");
-    printf("%*s  CONDITION:\n", indent * 2, "");
-    print_ast(node->data.if_stmt.condition, indent + 2);
-    printf("%*s  THEN:\n", indent * 2, "");
-    print_ast(node->data.if_stmt.if_body, indent + 2);
-    if (node->data.if_stmt.else_body) {
-      printf("%*s  ELSE:\n", indent * 2, "");
-      print_ast(node->data.if_stmt.else_body, indent + 2);
-    }
     break;
 
   case NODE_PRINT:
     printf("PRINT:\n");
-    print_ast(node->data.print.expression, indent + 1);
     break;
 
   case NODE_BLOCK:
     printf("BLOCK:\n");
-    for (size_t i = 0; i < node->data.block.statements->size; i++) {
-      print_ast(arr_get(node->data.block.statements, i), indent + 1);
+    break;
+
+  case NODE_LOOP:
+    printf("LOOP:\n");
+    break;
+
+  case NODE_RANGE_LOOP:
+    printf("%s: %s\n", node->data.range_loop.parallel ? "PLOOP" : "RANGE LOOP",
+           symbol_name(node->data.range_loop.var_name));
+    for (size_t i = 0; i < node->data.range_loop.reduction_count; i++) {
+      reduction *r = &node->data.range_loop.reductions[i];
+      printf("%*s  REDUCE: %s %s\n", indent * 2, "", symbol_name(r->name),
+             reduce_op_to_str(r->op));
     }
     break;
 
+  case NODE_LOOP_STOP:
+    printf("STOP\n");
+    break;
+
+  case NODE_LOOP_NEXT:
+    printf("NEXT\n");
+    break;
+
+  case NODE_FUNCTION_DEF:
+    printf("%sFUNCTION: %s(", node->data.function_def.pure ? "PURE " : "",
+           symbol_name(node->data.function_def.name));
+    for (size_t i = 0; i < node->data.function_def.param_count; i++)
+      printf("%s%s", i ? ", " : "",
+             symbol_name(node->data.function_def.params[i]));
+    printf(")\n");
+    break;
+
+  case NODE_FUNCTION_CALL:
+    printf("CALL: %s\n", symbol_name(node->data.function_call.name));
+    break;
+
+  case NODE_RETURN:
+    printf("RETURN:\n");
+    break;
+
+  case NODE_INDEX:
+    printf("INDEX: %s\n", symbol_name(node->data.element.name));
+    break;
+
+  case NODE_INDEX_ASSIGN:
+    printf("INDEX ASSIGNMENT: %s =\n", symbol_name(node->data.element.name));
+    break;
+
   case NODE_NOOP:
     printf("NO-OP\n");
     break;
@@ -432,22 +550,59 @@ void print_ast(ast_node *node, int indent) {
   }
 }
 
-ast_node *build_ast_tree(arr_t *tokens) {
+// indents of nodes being printed are kept on heap stack , its top is indent
+// of parent
+void print_ast(ast_node *node, int indent) {
+  size_t count = 0;
+  size_t capacity = 16;
+  int *indents = malloc(sizeof(int) * capacity);
+  if (!indents)
+    elog("Error allocation memory for ast dump");
+
+  walker w;
+  walk_init(&w, node);
+  walk_step step;
+  while (walk_next(&w, &step)) {
+    if (step.leaving) {
+      count--;
+      continue;
+    }
+
+    int at = indent;
+    const char *label = child_label(step.node, step.parent);
+    if (label) {
+      printf("%*s  %s:\n", indents[count - 1] * 2, "", label);
+      at = indents[count - 1] + 2;
+    } else if (count > 0) {
+      at = indents[count - 1] + 1;
+    }
+    print_node(step.node, at);
+
+    if (count >= capacity) {
+      capacity *= 2;
+      indents = realloc(indents, sizeof(int) * capacity);
+      if (!indents)
+        elog("Error allocation memory for ast dump");
+    }
+    indents[count++] = at;
+  }
+  walk_free(&w);
+  free(indents);
+}
+
+ast_node *build_ast_tree(const token_buffer *tokens, arena_t *arena) {
   if (!tokens)
-    elog("Can't parse ast tree from null ptr on arr");
-  if (tokens->size == 0)
-    elog("Can't parse ast tree from empty arr");
-  if (!tokens->data)
-    elog(
-        "Can't parse ast tree from arr, ptr on data (arr_t -> **data) is null");
-
-  lexer_t *lexer = new_lexer(tokens);
+    elog("Can't parse ast tree from null ptr on token buffer");
+  if (tokens->count == 0)
+    elog("Can't parse ast tree from empty token buffer");
+
+  lexer_t *lexer = new_lexer(tokens, arena);
   ast_node *result = NULL;
 
-  if (lexer->current->type == TOKEN_LBRACE) {
+  if (lexer_type(lexer) == TOKEN_LBRACE) {
     lexer_skip(lexer, 1);
     result = parse_block(lexer);
-    if (lexer->current->type == TOKEN_RBRACE) {
+    if (lexer_type(lexer) == TOKEN_RBRACE) {
       lexer_skip(lexer, 1);
     } else {
       lexer_syntax_error(lexer, "Expected '}'");
@@ -455,19 +610,18 @@ ast_node *build_ast_tree(arr_t *tokens) {
   } else {
     arr_t *statements = arr_create(1);
 
-    while (lexer->current->type != TOKEN_EOF) {
+    while (lexer_type(lexer) != TOKEN_EOF) {
       ast_node *statement = parse_statement(lexer);
       if (statement) {
         arr_push(statements, statement);
       }
     }
 
-    if (statements->size > 0) {
-      result = new_block_node(statements);
-    } else {
-      arr_destroy(statements);
+    if (statements->size == 0)
       elog("No valid statements found in script");
-    }
+
+    result = new_block_node(lexer->arena, statements);
+    arr_destroy(statements);
   }
 
   free_lexer(lexer);
@@ -479,8 +633,8 @@ ast_node *parse_block(lexer_t *lexer) {
     elog("Can't parse block to ast node , lexer is null");
 
   arr_t *arr = arr_create(1);
-  while (lexer->current->type != TOKEN_RBRACE &&
-         lexer->current->type != TOKEN_EOF) {
+  while (lexer_type(lexer) != TOKEN_RBRACE &&
+         lexer_type(lexer) != TOKEN_EOF) {
     ast_node *statement = parse_statement(lexer);
 
     if (statement)
@@ -491,227 +645,340 @@ ast_node *parse_block(lexer_t *lexer) {
     elog("Empty block statements are not allowed");
   }
 
-  return new_block_node(arr);
+  ast_node *block = new_block_node(lexer->arena, arr);
+  arr_destroy(arr);
+  return block;
 }
 
-ast_node *parse_statement(lexer_t *lexer) {
-  if (!lexer)
-    elog("Can't create statement ast node, have null ptr on lexer");
+// parser keeps its work on heap stacks in lexer , so nesting of scripts is
+// limited by max_depth only and never by C stack
+static void *grow_stack(void *items, size_t *capacity, size_t item_size) {
+  *capacity = *capacity ? *capacity * 2 : 16;
+  items = realloc(items, item_size * *capacity);
+  if (!items)
+    elog("Error allocation memory for parser stack");
+  return items;
+}
+
+static void check_depth(lexer_t *lexer, size_t depth) {
+  if (lexer->open_count + depth > max_depth())
+    elog("Syntax error %zu:%zu nesting deeper than %zu , raise limit with "
+         "--max-depth",
+         lexer_line(lexer), lexer_column(lexer), max_depth());
+}
+
+// name '[' index ']' '=' value ';'
+static ast_node *parse_index_assignment(lexer_t *lexer) {
+  symbol_t name = lexer_symbol(lexer);
+  lexer_skip(lexer, 2);
+  ast_node *index = parse_expression(lexer);
+
+  if (lexer_type(lexer) != TOKEN_RBRACKET)
+    lexer_syntax_error(lexer, "expected ']' after index");
+  lexer_one_skip(lexer);
+  if (lexer_type(lexer) != TOKEN_ASSIGN)
+    lexer_syntax_error(lexer, "expected '=' after element of array");
+  lexer_one_skip(lexer);
+  ast_node *value = parse_expression(lexer);
+
+  if (lexer_type(lexer) != TOKEN_SEMICOLON)
+    lexer_syntax_error(lexer, "expected ';' after expression");
+  lexer_one_skip(lexer);
+  return new_index_assign_node(lexer->arena, name, index, value);
+}
 
-  if (lexer->current->type == TOKEN_SEMICOLON) {
+static ast_node *parse_simple_statement(lexer_t *lexer) {
+  if (lexer_type(lexer) == TOKEN_SEMICOLON) {
     lexer_one_skip(lexer);
     return NULL; // Skip empty statements
   }
 
-  if (lexer->current->type == TOKEN_LOOP_STOP) {
+  if (lexer_type(lexer) == TOKEN_LOOP_STOP) {
     lexer_one_skip(lexer);
 
-    if (lexer->current->type != TOKEN_SEMICOLON)
+    if (lexer_type(lexer) != TOKEN_SEMICOLON)
       elog("Syntax error: %zu:%zu expected ';' after 'stop'",
-           lexer->current->line, lexer->current->offset);
+           lexer_line(lexer), lexer_column(lexer));
 
     lexer_one_skip(lexer);
-    return new_loop_stop_node();
+    return new_loop_stop_node(lexer->arena);
   }
 
-  if (lexer->current->type == TOKEN_LOOP_NEXT) {
+  if (lexer_type(lexer) == TOKEN_LOOP_NEXT) {
     lexer_one_skip(lexer);
 
-    if (lexer->current->type != TOKEN_SEMICOLON)
+    if (lexer_type(lexer) != TOKEN_SEMICOLON)
       elog("Syntax error: %zu:%zu expected ';' after 'next'",
-           lexer->current->line, lexer->current->offset);
+           lexer_line(lexer), lexer_column(lexer));
 
     lexer_one_skip(lexer);
-    return new_loop_next_node();
+    return new_loop_next_node(lexer->arena);
   }
 
-  if (lexer->current->type == TOKEN_CONST) {
+  if (lexer_type(lexer) == TOKEN_CONST) {
 
     lexer_one_skip(lexer);
 
-    if (lexer->current->type != TOKEN_IDENTIFIER) {
+    if (lexer_type(lexer) != TOKEN_IDENTIFIER) {
       lexer_syntax_error(lexer, "after 'const' must go var identifire \n");
     }
 
-    if (lexer->current->type == TOKEN_IDENTIFIER) {
-      const char *var_name = lexer->current->value.string;
+    if (lexer_type(lexer) == TOKEN_IDENTIFIER) {
+      symbol_t var_name = lexer_symbol(lexer);
       lexer_one_skip(lexer);
-      if (lexer->current->type != TOKEN_ASSIGN)
+      if (lexer_type(lexer) != TOKEN_ASSIGN)
         elog("Syntax error : %zu:%zu expected '=' after identifier in "
              "assignment",
-             lexer->current->line, lexer->current->offset);
+             lexer_line(lexer), lexer_column(lexer));
 
       lexer_one_skip(lexer);
       ast_node *expression = parse_expression(lexer);
 
-      if (lexer->current->type != TOKEN_SEMICOLON)
+      if (lexer_type(lexer) != TOKEN_SEMICOLON)
         elog("Syntax error : %zu:%zu expected ';' after expression",
-             lexer->current->line, lexer->current->offset);
+             lexer_line(lexer), lexer_column(lexer));
 
       lexer_one_skip(lexer);
-      return new_assignment_node(var_name, expression, true);
+      return new_assignment_node(lexer->arena, var_name, expression, true);
     }
   }
 
-  if (lexer->current->type == TOKEN_IDENTIFIER) {
-    const char *var_name = lexer->current->value.string;
+  if (lexer_type(lexer) == TOKEN_IDENTIFIER &&
+      lexer->tokens->types[lexer->current + 1] == TOKEN_LBRACKET)
+    return parse_index_assignment(lexer);
+
+  if (lexer_type(lexer) == TOKEN_IDENTIFIER) {
+    symbol_t var_name = lexer_symbol(lexer);
     lexer_one_skip(lexer);
-    if (lexer->current->type != TOKEN_ASSIGN)
+    if (lexer_type(lexer) != TOKEN_ASSIGN)
       elog("Syntax error : %zu:%zu expected '=' after identifier in assignment",
-           lexer->current->line, lexer->current->offset);
+           lexer_line(lexer), lexer_column(lexer));
 
     lexer_one_skip(lexer);
     ast_node *expression = parse_expression(lexer);
 
-    if (lexer->current->type != TOKEN_SEMICOLON)
+    if (lexer_type(lexer) != TOKEN_SEMICOLON)
       elog("Syntax error : %zu:%zu expected ';' after expression",
-           lexer->current->line, lexer->current->offset);
+           lexer_line(lexer), lexer_column(lexer));
 
     lexer_one_skip(lexer);
-    return new_assignment_node(var_name, expression, false);
-  }
-
-  if (lexer->current->type == TOKEN_FN) {
-    return parse_function_def(lexer);
+    return new_assignment_node(lexer->arena, var_name, expression, false);
   }
 
-  if (lexer->current->type == TOKEN_RETURN) {
+  if (lexer_type(lexer) == TOKEN_RETURN) {
     return parse_return_statement(lexer);
   }
 
-  if (lexer->current->type == TOKEN_IF) {
-    return parse_if_statement(lexer);
-  }
-
-  if (lexer->current->type == TOKEN_PRINT) {
+  if (lexer_type(lexer) == TOKEN_PRINT) {
     return parse_print_statement(lexer);
   }
 
-  if (lexer->current->type == TOKEN_LOOP) {
-    return parse_loop_statement(lexer);
-  }
-
-  if (lexer->current->type == TOKEN_LBRACE) {
-    lexer_one_skip(lexer);
-    ast_node *block = parse_block(lexer);
-    if (lexer->current->type != TOKEN_RBRACE)
-      elog("Syntax error : %zu:%zu expected '}' after block",
-           lexer->current->line, lexer->current->offset);
-
-    lexer_one_skip(lexer);
-    return block;
-  }
-
   lexer_syntax_error(lexer, "Unknown statement type");
   return NULL;
 }
 
-ast_node *parse_if_statement(lexer_t *lexer) {
-  if (!lexer)
-    elog("Can't parse if statement, lexer is null");
-
-  lexer_skip_if_eq(lexer, TOKEN_IF);
+// compound statement whose body is being parsed
+typedef enum {
+  OPEN_BLOCK,
+  OPEN_FUNCTION,
+  OPEN_IF,
+  OPEN_ELSE,
+  OPEN_LOOP,
+  OPEN_RANGE_LOOP,
+} open_kind;
+
+typedef struct open_statement {
+  open_kind kind;
+  size_t line;
+  // statements of block and function body
+  arr_t *statements;
+  ast_node *condition;
+  ast_node *if_body;
+  // bounds of range loop , 'name' is its variable
+  ast_node *start;
+  ast_node *end;
+  ast_node *step;
+  bool parallel;
+  reduction *reductions;
+  size_t reduction_count;
+  symbol_t name;
+  symbol_t *params;
+  size_t param_count;
+  bool pure;
+} open_statement;
+
+static ast_node *parse_condition(lexer_t *lexer, const char *keyword) {
+  lexer_one_skip(lexer);
 
-  if (lexer->current->type != TOKEN_LPAREN)
-    elog("Syntax error : %zu:%zu expected '(' after 'if'", lexer->current->line,
-         lexer->current->offset);
+  if (lexer_type(lexer) != TOKEN_LPAREN)
+    elog("Syntax error : %zu:%zu expected '(' after '%s'", lexer_line(lexer),
+         lexer_column(lexer), keyword);
 
   lexer_one_skip(lexer);
   ast_node *condition = parse_comparison(lexer);
 
-  if (lexer->current->type != TOKEN_RPAREN)
+  if (lexer_type(lexer) != TOKEN_RPAREN)
     elog("Syntax error : %zu:%zu expected ')' after condition",
-         lexer->current->line, lexer->current->offset);
+         lexer_line(lexer), lexer_column(lexer));
 
   lexer_one_skip(lexer);
-  ast_node *if_body = parse_statement(lexer);
-
-  ast_node *else_body = NULL;
-  if (lexer->current->type == TOKEN_ELSE) {
-    lexer_one_skip(lexer);
-    else_body = parse_statement(lexer);
-  }
-
-  return new_if_node(condition, if_body, else_body);
+  return condition;
 }
 
-ast_node *parse_loop_statement(lexer_t *lexer) {
-  if (lexer == NULL)
-    elog("Can't parse loop with null ptr on lexer");
-
-  lexer_skip_if_eq(lexer, TOKEN_LOOP);
-  if (lexer->current->type != TOKEN_LPAREN)
-    elog("Syntax error : %zu:%zu expected '(' after 'loop'",
-         lexer->current->line, lexer->current->offset);
+// 'in' and 'step' are plain identifiers everywhere else , so scripts may
+// still use them as names
+static bool is_contextual(lexer_t *lexer, const char *word) {
+  return lexer_type(lexer) == TOKEN_IDENTIFIER &&
+         lexer_symbol(lexer) == intern_cstr(word);
+}
 
-  lexer_skip_if_eq(lexer, TOKEN_LPAREN);
-  ast_node *condition = parse_comparison(lexer);
+// 'loop' name 'in' start '..' end ('step' step)? , step is 1 by default
+static void parse_range_head(lexer_t *lexer, open_statement *loop) {
+  lexer_one_skip(lexer);
+  if (lexer_type(lexer) != TOKEN_IDENTIFIER)
+    lexer_syntax_error(lexer, "expected loop variable");
+  loop->kind = OPEN_RANGE_LOOP;
+  loop->name = lexer_symbol(lexer);
+  lexer_one_skip(lexer);
 
-  if (lexer->current->type != TOKEN_RPAREN)
-    elog("Syntax error : %zu:%zu expected ')' after 'loop'",
-         lexer->current->line, lexer->current->offset);
-  lexer_skip_if_eq(lexer, TOKEN_RPAREN);
+  if (!is_contextual(lexer, "in"))
+    lexer_syntax_error(lexer, "expected 'in' after loop variable");
+  lexer_one_skip(lexer);
+  loop->start = parse_expression(lexer);
 
-  ast_node *loop_body = parse_statement(lexer);
+  if (lexer_type(lexer) != TOKEN_RANGE)
+    lexer_syntax_error(lexer, "expected '..' between bounds of loop");
+  lexer_one_skip(lexer);
+  loop->end = parse_expression(lexer);
 
-  return new_loop_node(condition, loop_body);
+  if (is_contextual(lexer, "step")) {
+    lexer_one_skip(lexer);
+    loop->step = parse_expression(lexer);
+  } else {
+    loop->step = at_line(new_number_node(lexer->arena, 1.0), loop->line);
+  }
 }
 
-ast_node *parse_print_statement(lexer_t *lexer) {
-  if (!lexer)
-    elog("Can't parse print statement, lexer is null");
-
-  lexer_skip_if_eq(lexer, TOKEN_PRINT);
-
-  if (lexer->current->type != TOKEN_LPAREN)
-    elog("Syntax error : %zu:%zu expected '(' after 'print'",
-         lexer->current->line, lexer->current->offset);
+static reduce_op parse_reduce_op(lexer_t *lexer) {
+  if (lexer_type(lexer) == TOKEN_PLUS)
+    return REDUCE_ADD;
+  if (lexer_type(lexer) == TOKEN_MULTIPLY)
+    return REDUCE_MUL;
+  if (is_contextual(lexer, "min"))
+    return REDUCE_MIN;
+  if (is_contextual(lexer, "max"))
+    return REDUCE_MAX;
+  lexer_syntax_error(lexer, "expected '+' , '*' , 'min' or 'max' after "
+                            "reduction variable");
+  return REDUCE_ADD;
+}
 
+// 'reduce' '(' name op (',' name op)* ')'
+static void parse_reductions(lexer_t *lexer, open_statement *loop) {
+  lexer_one_skip(lexer);
+  if (lexer_type(lexer) != TOKEN_LPAREN)
+    lexer_syntax_error(lexer, "expected '(' after 'reduce'");
   lexer_one_skip(lexer);
-  ast_node *expression = parse_expression(lexer);
 
-  if (lexer->current->type != TOKEN_RPAREN)
-    elog("Syntax error : %zu:%zu expected ')' after expression in print",
-         lexer->current->line, lexer->current->offset);
+  size_t capacity = 0;
+  do {
+    if (lexer_type(lexer) != TOKEN_IDENTIFIER)
+      lexer_syntax_error(lexer, "expected name of reduction variable");
+    symbol_t name = lexer_symbol(lexer);
+    if (name == loop->name)
+      lexer_syntax_error(lexer, "loop variable can't be reduced");
+    for (size_t i = 0; i < loop->reduction_count; i++) {
+      if (loop->reductions[i].name == name)
+        lexer_syntax_error(lexer, "variable is reduced twice");
+    }
+    lexer_one_skip(lexer);
 
-  lexer_one_skip(lexer);
+    if (loop->reduction_count >= capacity) {
+      capacity = capacity ? capacity * 2 : 4;
+      loop->reductions =
+          realloc(loop->reductions, sizeof(reduction) * capacity);
+      if (!loop->reductions)
+        elog("Error allocation memory for ploop reductions");
+    }
+    loop->reductions[loop->reduction_count++] =
+        (reduction){.name = name, .slot = 0, .op = parse_reduce_op(lexer)};
+    lexer_one_skip(lexer);
 
-  if (lexer->current->type != TOKEN_SEMICOLON)
-    elog("Syntax error : %zu:%zu expected ';' after print statement",
-         lexer->current->line, lexer->current->offset);
+    if (lexer_type(lexer) == TOKEN_COMMA)
+      lexer_one_skip(lexer);
+    else
+      break;
+  } while (true);
 
+  if (lexer_type(lexer) != TOKEN_RPAREN)
+    lexer_syntax_error(lexer, "expected ')' after reductions");
   lexer_one_skip(lexer);
+}
 
-  return new_print_node(expression);
+// 'ploop' range head ('reduce' reductions)?
+static void parse_ploop_head(lexer_t *lexer, open_statement *loop) {
+  parse_range_head(lexer, loop);
+  loop->parallel = true;
+  if (is_contextual(lexer, "reduce"))
+    parse_reductions(lexer, loop);
+}
+
+static ast_node *new_range_loop(lexer_t *lexer, open_statement *loop,
+                                ast_node *body) {
+  ast_node *node = new_range_loop_node(lexer->arena, loop->name, loop->start,
+                                       loop->end, loop->step, body);
+  if (loop->parallel) {
+    node->data.range_loop.parallel = true;
+    node->data.range_loop.reductions =
+        arena_copy(lexer->arena, loop->reductions,
+                   sizeof(reduction) * loop->reduction_count);
+    node->data.range_loop.reduction_count = loop->reduction_count;
+    free(loop->reductions);
+  }
+  return node;
 }
 
-ast_node *parse_function_def(lexer_t *lexer) {
+// 'pure'? 'fn' name '(' params ')'
+static void parse_function_head(lexer_t *lexer, open_statement *function) {
+  if (lexer_type(lexer) == TOKEN_PURE) {
+    function->pure = true;
+    lexer_one_skip(lexer);
+    if (lexer_type(lexer) != TOKEN_FN)
+      lexer_syntax_error(lexer, "after 'pure' must go 'fn'");
+  }
   lexer_skip_if_eq(lexer, TOKEN_FN);
 
-  if (lexer->current->type != TOKEN_IDENTIFIER)
+  if (lexer_type(lexer) != TOKEN_IDENTIFIER)
     lexer_syntax_error(lexer, "after 'fn' must go identifier");
 
-  char *name = strdup(lexer->current->value.string);
+  symbol_t name = lexer_symbol(lexer);
   lexer_one_skip(lexer);
 
-  if (lexer->current->type != TOKEN_LPAREN)
+  if (lexer_type(lexer) != TOKEN_LPAREN)
     lexer_syntax_error(
         lexer,
         "after function identifier must go '(' params|or empty place ')' ");
   lexer_skip_if_eq(lexer, TOKEN_LPAREN);
 
-  arr_t *params = arr_create(4);
-  if (lexer->current->type != TOKEN_RPAREN) {
+  symbol_t *params = NULL;
+  size_t param_count = 0;
+  size_t param_capacity = 0;
+  if (lexer_type(lexer) != TOKEN_RPAREN) {
     do {
-      if (lexer->current->type != TOKEN_IDENTIFIER)
+      if (lexer_type(lexer) != TOKEN_IDENTIFIER)
         lexer_syntax_error(
             lexer, "expected params or ')' in function declaration after '(' ");
 
-      char *param = strdup(lexer->current->value.string);
-      arr_push(params, param);
+      if (param_count >= param_capacity) {
+        param_capacity = param_capacity ? param_capacity * 2 : 4;
+        params = realloc(params, sizeof(symbol_t) * param_capacity);
+        if (!params)
+          elog("Error allocation memory for function params");
+      }
+      params[param_count++] = lexer_symbol(lexer);
       lexer_one_skip(lexer);
 
-      if (lexer->current->type == TOKEN_COMMA)
+      if (lexer_type(lexer) == TOKEN_COMMA)
         lexer_one_skip(lexer);
       else
         break;
@@ -720,71 +987,189 @@ ast_node *parse_function_def(lexer_t *lexer) {
 
   lexer_skip_if_eq(lexer, TOKEN_RPAREN);
 
-  if (lexer->current->type == TOKEN_ARROW) {
-    lexer_one_skip(lexer);
-    ast_node *expr = parse_expression(lexer);
+  function->name = name;
+  function->params = params;
+  function->param_count = param_count;
+}
 
-    ast_node *return_node = new_return_node(expr);
+static ast_node *new_function(lexer_t *lexer, open_statement *function,
+                              ast_node *body) {
+  ast_node *func_def_node =
+      new_function_def_node(lexer->arena, function->name, function->params,
+                            function->param_count, body);
+  func_def_node->data.function_def.pure = function->pure;
+  free(function->params);
+  return func_def_node;
+}
 
-    arr_t *stms = arr_create(1);
-    arr_push(stms, expr);
-    ast_node *block_node = new_block_node(stms);
+// '->' expression ';' , body is block with one return
+static ast_node *parse_arrow_body(lexer_t *lexer, open_statement *function) {
+  lexer_one_skip(lexer);
+  ast_node *expr = parse_expression(lexer);
 
-    if (lexer->current->type != TOKEN_SEMICOLON)
-      lexer_syntax_error(lexer, "expected ';' after func expression");
-    else
-      lexer_one_skip(lexer);
+  ast_node *return_node = new_return_node(lexer->arena, expr);
 
-    ast_node *func_def_node = new_function_def_node(name, params, block_node);
-    return func_def_node;
-  }
+  arr_t *stms = arr_create(1);
+  arr_push(stms, return_node);
+  ast_node *block_node = new_block_node(lexer->arena, stms);
+  arr_destroy(stms);
 
-  if (lexer->current->type == TOKEN_LBRACE) {
+  if (lexer_type(lexer) != TOKEN_SEMICOLON)
+    lexer_syntax_error(lexer, "expected ';' after func expression");
+  else
     lexer_one_skip(lexer);
 
-    ast_node *block = parse_block(lexer);
+  return new_function(lexer, function, block_node);
+}
 
-    if (lexer->current->type != TOKEN_RBRACE)
-      lexer_syntax_error(lexer, "expected '}' in the on of func body");
-    else
-      lexer_one_skip(lexer);
+// block or function body ends at '}' , EOF before it is an error
+static ast_node *close_body(lexer_t *lexer, open_statement *open) {
+  if (open->statements->size == 0)
+    elog("Empty block statements are not allowed");
 
-    ast_node *func_def_node = new_function_def_node(name, params, block);
-    return func_def_node;
+  if (lexer_type(lexer) != TOKEN_RBRACE) {
+    if (open->kind == OPEN_FUNCTION)
+      lexer_syntax_error(lexer, "expected '}' in the on of func body");
+    elog("Syntax error : %zu:%zu expected '}' after block", lexer_line(lexer),
+         lexer_column(lexer));
   }
+  lexer_one_skip(lexer);
 
-  lexer_syntax_error(lexer, "unexpected symbol after fynction "
-                            "declaration , must be or '->' or '{' ");
+  ast_node *block = new_block_node(lexer->arena, open->statements);
+  arr_destroy(open->statements);
+  if (open->kind == OPEN_FUNCTION)
+    return new_function(lexer, open, block);
+  return block;
 }
 
-ast_node *parse_function_call(lexer_t *lexer, const char *name) {
+// compound statements are opened on stack instead of recursion , statement
+// completed on top goes to body of the one below , which may complete it too
+ast_node *parse_statement(lexer_t *lexer) {
   if (!lexer)
-    elog("Can't parse function call with null ptr on lexer");
-  if (!name || *name == '\0')
-    elog("Can't parse function call with null or empty function name");
+    elog("Can't create statement ast node, have null ptr on lexer");
 
-  lexer_skip_if_eq(lexer, TOKEN_LPAREN);
+  size_t base = lexer->open_count;
+  for (;;) {
+    open_statement *top =
+        lexer->open_count > base ? &lexer->open[lexer->open_count - 1] : NULL;
+    ast_node *node = NULL;
 
-  arr_t *arguments = arr_create(4);
+    if (top && (top->kind == OPEN_BLOCK || top->kind == OPEN_FUNCTION) &&
+        (lexer_type(lexer) == TOKEN_RBRACE || lexer_type(lexer) == TOKEN_EOF)) {
+      node = at_line(close_body(lexer, top), top->line);
+      lexer->open_count--;
+    } else {
+      open_statement open = {.line = lexer_line(lexer)};
 
-  if (lexer->current->type != TOKEN_RPAREN) {
-    do {
-      if (lexer->current->type != TOKEN_IDENTIFIER)
-        lexer_syntax_error(lexer, "expected list of parameters of ')' ");
+      switch (lexer_type(lexer)) {
+      case TOKEN_LBRACE:
+        lexer_one_skip(lexer);
+        open.kind = OPEN_BLOCK;
+        open.statements = arr_create(4);
+        break;
+      case TOKEN_IF:
+        open.kind = OPEN_IF;
+        open.condition = parse_condition(lexer, "if");
+        break;
+      case TOKEN_LOOP:
+        if (lexer->tokens->types[lexer->current + 1] == TOKEN_IDENTIFIER) {
+          parse_range_head(lexer, &open);
+          break;
+        }
+        open.kind = OPEN_LOOP;
+        open.condition = parse_condition(lexer, "loop");
+        break;
+      case TOKEN_PLOOP:
+        parse_ploop_head(lexer, &open);
+        break;
+      case TOKEN_FN:
+      case TOKEN_PURE:
+        parse_function_head(lexer, &open);
+        if (lexer_type(lexer) == TOKEN_ARROW) {
+          node = at_line(parse_arrow_body(lexer, &open), open.line);
+          break;
+        }
+        if (lexer_type(lexer) != TOKEN_LBRACE)
+          lexer_syntax_error(lexer, "unexpected symbol after fynction "
+                                    "declaration , must be or '->' or '{' ");
+        lexer_one_skip(lexer);
+        open.kind = OPEN_FUNCTION;
+        open.statements = arr_create(4);
+        break;
+      default:
+        node = at_line(parse_simple_statement(lexer), open.line);
+        break;
+      }
 
-      ast_node *arg_expr = parse_expression(lexer);
-      arr_push(arguments, arg_expr);
+      if (open.statements || open.condition || open.start) {
+        check_depth(lexer, 1);
+        if (lexer->open_count >= lexer->open_capacity)
+          lexer->open = grow_stack(lexer->open, &lexer->open_capacity,
+                                   sizeof(open_statement));
+        lexer->open[lexer->open_count++] = open;
+        continue;
+      }
+    }
 
-      if (lexer->current->type == TOKEN_COMMA)
+    // completed statement goes down the stack
+    for (;;) {
+      if (lexer->open_count == base)
+        return node;
+
+      top = &lexer->open[lexer->open_count - 1];
+      if (top->kind == OPEN_BLOCK || top->kind == OPEN_FUNCTION) {
+        if (node)
+          arr_push(top->statements, node);
+        break;
+      }
+
+      if (top->kind == OPEN_IF && lexer_type(lexer) == TOKEN_ELSE) {
         lexer_one_skip(lexer);
-      else
+        top->kind = OPEN_ELSE;
+        top->if_body = node;
         break;
-    } while (true);
+      }
+
+      if (top->kind == OPEN_LOOP)
+        node = new_loop_node(lexer->arena, top->condition, node);
+      else if (top->kind == OPEN_RANGE_LOOP)
+        node = new_range_loop(lexer, top, node);
+      else
+        node = new_if_node(lexer->arena, top->condition,
+                           top->kind == OPEN_ELSE ? top->if_body : node,
+                           top->kind == OPEN_ELSE ? node : NULL);
+      node = at_line(node, top->line);
+      lexer->open_count--;
+    }
   }
+}
 
-  lexer_skip_if_eq(lexer, TOKEN_RPAREN);
+ast_node *parse_print_statement(lexer_t *lexer) {
+  if (!lexer)
+    elog("Can't parse print statement, lexer is null");
+
+  lexer_skip_if_eq(lexer, TOKEN_PRINT);
+
+  if (lexer_type(lexer) != TOKEN_LPAREN)
+    elog("Syntax error : %zu:%zu expected '(' after 'print'",
+         lexer_line(lexer), lexer_column(lexer));
 
-  return new_function_call_node(name, arguments);
+  lexer_one_skip(lexer);
+  ast_node *expression = parse_expression(lexer);
+
+  if (lexer_type(lexer) != TOKEN_RPAREN)
+    elog("Syntax error : %zu:%zu expected ')' after expression in print",
+         lexer_line(lexer), lexer_column(lexer));
+
+  lexer_one_skip(lexer);
+
+  if (lexer_type(lexer) != TOKEN_SEMICOLON)
+    elog("Syntax error : %zu:%zu expected ';' after print statement",
+         lexer_line(lexer), lexer_column(lexer));
+
+  lexer_one_skip(lexer);
+
+  return new_print_node(lexer->arena, expression);
 }
 
 ast_node *parse_return_statement(lexer_t *lexer) {
@@ -795,14 +1180,14 @@ ast_node *parse_return_statement(lexer_t *lexer) {
 
   ast_node *value = NULL;
 
-  if (lexer->current->type != TOKEN_SEMICOLON)
+  if (lexer_type(lexer) != TOKEN_SEMICOLON)
     value = parse_expression(lexer);
   else
-    value = new_number_node(0.0);
+    value = new_number_node(lexer->arena, 0.0);
 
   lexer_skip_if_eq(lexer, TOKEN_SEMICOLON);
 
-  return new_return_node(value);
+  return new_return_node(lexer->arena, value);
 }
 
 ast_node *parse_comparison(lexer_t *lexer) {
@@ -811,94 +1196,212 @@ ast_node *parse_comparison(lexer_t *lexer) {
 
   ast_node *left = parse_expression(lexer);
 
-  if (lexer->current->type == TOKEN_EQ || lexer->current->type == TOKEN_NE ||
-      lexer->current->type == TOKEN_LT || lexer->current->type == TOKEN_LE ||
-      lexer->current->type == TOKEN_GT || lexer->current->type == TOKEN_GE) {
+  if (lexer_type(lexer) == TOKEN_EQ || lexer_type(lexer) == TOKEN_NE ||
+      lexer_type(lexer) == TOKEN_LT || lexer_type(lexer) == TOKEN_LE ||
+      lexer_type(lexer) == TOKEN_GT || lexer_type(lexer) == TOKEN_GE) {
 
-    TokenType op = lexer->current->type;
+    TokenType op = lexer_type(lexer);
     lexer_one_skip(lexer);
     ast_node *right = parse_expression(lexer);
 
-    return new_binary_node(left, right, op);
+    return new_binary_node(lexer->arena, left, right, op);
   }
 
   return left;
 }
 
-ast_node *parse_expression(lexer_t *lexer) {
-  if (!lexer)
-    elog("Can't parse expression, lexer ptr is null");
+// operand of expression with depth of its subtree
+typedef struct expr_operand {
+  ast_node *node;
+  size_t depth;
+} expr_operand;
+
+// binary operator waiting for its right operand , or '(' of group or call
+// ('op' is TOKEN_IDENTIFIER) whose ')' is not reached yet , or '[' of index
+// into array 'name' whose ']' is not reached yet
+typedef struct expr_pending {
+  TokenType op;
+  symbol_t name;
+  // first argument of call on operand stack
+  size_t base;
+  size_t line;
+} expr_pending;
+
+static int precedence(TokenType type) {
+  switch (type) {
+  case TOKEN_PLUS:
+  case TOKEN_MINUS:
+    return 1;
+  case TOKEN_MULTIPLY:
+  case TOKEN_DIVIDE:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+static void push_operand(lexer_t *lexer, ast_node *node, size_t depth) {
+  check_depth(lexer, depth);
+  if (lexer->operand_count >= lexer->operand_capacity)
+    lexer->operands = grow_stack(lexer->operands, &lexer->operand_capacity,
+                                 sizeof(expr_operand));
+  lexer->operands[lexer->operand_count++] =
+      (expr_operand){.node = node, .depth = depth};
+}
 
-  ast_node *left = parse_term(lexer);
+static void push_pending(lexer_t *lexer, expr_pending pending) {
+  if (lexer->pending_count >= lexer->pending_capacity)
+    lexer->pending = grow_stack(lexer->pending, &lexer->pending_capacity,
+                                sizeof(expr_pending));
+  lexer->pending[lexer->pending_count++] = pending;
+}
 
-  while (lexer->current->type == TOKEN_PLUS ||
-         lexer->current->type == TOKEN_MINUS) {
-    TokenType op = lexer->current->type;
-    lexer_one_skip(lexer);
-    ast_node *right = parse_term(lexer);
+// applies pending operators of at least 'min' precedence down to nearest
+// group , call or start of expression
+static void reduce(lexer_t *lexer, size_t base, int min) {
+  while (lexer->pending_count > base &&
+         precedence(lexer->pending[lexer->pending_count - 1].op) >= min &&
+         precedence(lexer->pending[lexer->pending_count - 1].op) > 0) {
+    TokenType op = lexer->pending[--lexer->pending_count].op;
+    expr_operand right = lexer->operands[--lexer->operand_count];
+    expr_operand left = lexer->operands[--lexer->operand_count];
+
+    // left operand continues chain 'a + b + c' , only right one nests
+    size_t depth =
+        left.depth > right.depth + 1 ? left.depth : right.depth + 1;
+    push_operand(lexer, new_binary_node(lexer->arena, left.node, right.node, op),
+                 depth);
+  }
+}
 
-    left = new_binary_node(left, right, op);
+static void close_call(lexer_t *lexer, expr_pending call) {
+  size_t count = lexer->operand_count - call.base;
+  arr_t *arguments = arr_create(count ? count : 1);
+  size_t depth = 0;
+  for (size_t i = call.base; i < lexer->operand_count; i++) {
+    arr_push(arguments, lexer->operands[i].node);
+    if (lexer->operands[i].depth > depth)
+      depth = lexer->operands[i].depth;
   }
+  lexer->operand_count = call.base;
 
-  return left;
+  ast_node *node = new_function_call_node(lexer->arena, call.name, arguments);
+  arr_destroy(arguments);
+  push_operand(lexer, at_line(node, call.line), depth + 1);
+}
+
+static void close_index(lexer_t *lexer, expr_pending index) {
+  expr_operand operand = lexer->operands[--lexer->operand_count];
+  ast_node *node = new_index_node(lexer->arena, index.name, operand.node);
+  push_operand(lexer, at_line(node, index.line), operand.depth + 1);
 }
 
-ast_node *parse_term(lexer_t *lexer) {
+// operator precedence parsing over heap stacks , groups and call arguments
+// nest without recursion
+ast_node *parse_expression(lexer_t *lexer) {
   if (!lexer)
-    elog("Can't parse term by null ptr on lexer");
+    elog("Can't parse expression, lexer ptr is null");
 
-  ast_node *left = parse_factor(lexer);
+  size_t operand_base = lexer->operand_count;
+  size_t pending_base = lexer->pending_count;
 
-  while (lexer->current->type == TOKEN_MULTIPLY ||
-         lexer->current->type == TOKEN_DIVIDE) {
-    TokenType op = lexer->current->type;
-    lexer_one_skip(lexer);
-    ast_node *right = parse_factor(lexer);
+  for (;;) {
+    size_t line = lexer_line(lexer);
 
-    left = new_binary_node(left, right, op);
-  }
+    switch (lexer_type(lexer)) {
+    case TOKEN_NUMBER: {
+      ast_node *node = new_number_node(lexer->arena, lexer_number(lexer));
+      lexer_one_skip(lexer);
+      push_operand(lexer, at_line(node, line), 1);
+      break;
+    }
 
-  return left;
-}
+    case TOKEN_IDENTIFIER: {
+      symbol_t name = lexer_symbol(lexer);
+      lexer_one_skip(lexer);
 
-ast_node *parse_factor(lexer_t *lexer) {
-  if (!lexer)
-    elog("Can't parse factor by null ptr on lexer");
+      if (lexer_type(lexer) == TOKEN_LBRACKET) {
+        lexer_one_skip(lexer);
+        push_pending(lexer, (expr_pending){.op = TOKEN_LBRACKET,
+                                           .name = name,
+                                           .base = lexer->operand_count,
+                                           .line = line});
+        continue;
+      }
 
-  if (lexer->current->type == TOKEN_NUMBER) {
-    double value = lexer->current->value.number;
-    lexer_one_skip(lexer);
-    return new_number_node(value);
-  }
+      if (lexer_type(lexer) != TOKEN_LPAREN) {
+        push_operand(lexer,
+                     at_line(new_variable_node(lexer->arena, name, false), line),
+                     1);
+        break;
+      }
 
-  if (lexer->current->type == TOKEN_CONST) {
-    if (lexer->current->type == TOKEN_IDENTIFIER) {
-      lexer_syntax_error(lexer, "Can't create const var with no assigment");
+      lexer_one_skip(lexer);
+      push_pending(lexer, (expr_pending){.op = TOKEN_IDENTIFIER,
+                                         .name = name,
+                                         .base = lexer->operand_count,
+                                         .line = line});
+      if (lexer_type(lexer) == TOKEN_RPAREN)
+        break;
+      continue;
     }
-  }
 
-  if (lexer->current->type == TOKEN_IDENTIFIER) {
-    const char *name = lexer->current->value.string;
-    lexer_one_skip(lexer);
+    case TOKEN_LPAREN:
+      lexer_one_skip(lexer);
+      push_pending(lexer, (expr_pending){.op = TOKEN_LPAREN, .line = line});
+      continue;
 
-    if (lexer->current->type == TOKEN_LPAREN)
-      return parse_function_call(lexer, name);
-    else
-      return new_variable_node(name, false);
-  }
+    default:
+      elog("Unexpected token: %d at position %zu", lexer_type(lexer),
+           lexer->current);
+    }
 
-  if (lexer->current->type == TOKEN_LPAREN) {
-    lexer_one_skip(lexer);
-    ast_node *expression = parse_expression(lexer);
+    // after operand comes operator , ')' closing group or call , ',' between
+    // arguments or end of expression
+    for (;;) {
+      TokenType type = lexer_type(lexer);
+      int level = precedence(type);
+      if (level) {
+        reduce(lexer, pending_base, level);
+        push_pending(lexer, (expr_pending){.op = type});
+        lexer_one_skip(lexer);
+        break;
+      }
 
-    if (lexer->current->type != TOKEN_RPAREN)
-      elog("Expected ')' at position %zu", lexer->current_index);
+      reduce(lexer, pending_base, 1);
+      if (lexer->pending_count == pending_base) {
+        if (lexer->operand_count != operand_base + 1)
+          elog("Can't parse expression , operands left on parser stack");
+        return lexer->operands[--lexer->operand_count].node;
+      }
 
-    lexer_one_skip(lexer);
-    return expression;
-  }
+      expr_pending open = lexer->pending[lexer->pending_count - 1];
+      if (open.op == TOKEN_LBRACKET) {
+        if (type != TOKEN_RBRACKET)
+          lexer_syntax_error(lexer, "expected ']' after index");
+        lexer_one_skip(lexer);
+        lexer->pending_count--;
+        close_index(lexer, open);
+        continue;
+      }
 
-  elog("Unexpected token: %d at position %zu", lexer->current->type,
-       lexer->current_index);
-  return NULL;
+      if (type == TOKEN_RPAREN) {
+        lexer_one_skip(lexer);
+        lexer->pending_count--;
+        if (open.op == TOKEN_IDENTIFIER)
+          close_call(lexer, open);
+        else
+          at_line(lexer->operands[lexer->operand_count - 1].node, open.line);
+        continue;
+      }
+
+      if (open.op == TOKEN_LPAREN)
+        elog("Expected ')' at position %zu", lexer->current);
+      if (type != TOKEN_COMMA)
+        lexer_skip_if_eq(lexer, TOKEN_RPAREN);
+
+      lexer_one_skip(lexer);
+      break;
+    }
+  }
 }
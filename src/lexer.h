@@ -1,9 +1,10 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include "arena.h"
 #include "arr.h"
 #include "parser.h"
-#include <stdbool.h>
+#include "ploop.h"
 #include <stdbool.h>
 
 typedef enum ast_type {
@@ -22,16 +23,49 @@ typedef enum ast_type {
     NODE_FUNCTION_CALL,
     NODE_RETURN,
     NODE_PARAM_LIST,
+    NODE_RANGE_LOOP,
+    NODE_INDEX,
+    NODE_INDEX_ASSIGN,
 } ast_type;
 
+// 'name op' of ploop reduce clause
+typedef struct reduction {
+    symbol_t name;
+    size_t slot;
+    reduce_op op;
+    // set by mark_unset_reads , value from before the loop may be unset
+    bool maybe_unset;
+} reduction;
+
+// every 'name[counter + low]' .. 'name[counter + high]' of range loop fits
+// array 'name' once checked before the loop
+typedef struct range_guard {
+    symbol_t name;
+    size_t slot;
+    int16_t low;
+    int16_t high;
+} range_guard;
+
+struct builtin;
+
+typedef struct ast_list {
+    struct ast_node **items;
+    size_t count;
+} ast_list;
+
 typedef struct ast_node {
     ast_type type;
+    // source line , 0 for nodes parser builds on its own (like arrow body)
+    uint32_t line;
     union {
         double value;
 
         struct {
-            char* var_name;
+            symbol_t var_name;
             bool is_const;
+            size_t slot;
+            // set by mark_unset_reads , read may run before assignment
+            bool maybe_unset;
         } var;
 
         struct {
@@ -42,8 +76,9 @@ typedef struct ast_node {
 
         struct {
             bool is_const;
-            char* var_name;
+            symbol_t var_name;
             struct ast_node* value;
+            size_t slot;
         } assignment;
 
         struct {
@@ -57,7 +92,7 @@ typedef struct ast_node {
         } print;
 
         struct {
-            arr_t* statements;
+            ast_list statements;
         } block;
 
         struct {
@@ -65,15 +100,56 @@ typedef struct ast_node {
             struct ast_node *loop_body;
         } loop;
 
+        // 'loop var in start..end step step' , bounds are evaluated once.
+        // 'ploop' runs iterations in parallel on private copies of variables
+        // , only its reductions are written back
+        struct {
+            symbol_t var_name;
+            size_t slot;
+            struct ast_node *start;
+            struct ast_node *end;
+            struct ast_node *step;
+            struct ast_node *loop_body;
+            bool parallel;
+            struct reduction *reductions;
+            size_t reduction_count;
+            // set by hoist_invariants , accesses they cover are 'hoisted'
+            struct range_guard *guards;
+            size_t guard_count;
+        } range_loop;
+
+        // 'name[index]' , NODE_INDEX_ASSIGN stores 'value' there
+        struct {
+            symbol_t name;
+            size_t slot;
+            struct ast_node *index;
+            struct ast_node *value;
+            // bounds check is done by guard of enclosing range loop
+            bool hoisted;
+            // set by mark_unset_reads , array may be read before assignment
+            bool maybe_unset;
+        } element;
+
         struct {
-            char *name;
-            arr_t *params;
+            symbol_t name;
+            symbol_t *params;
+            size_t param_count;
             struct ast_node *body;
+            size_t slot_count;
+            // 'pure fn' , results may be cached
+            bool pure;
+            // set by mark_pure_functions when calls are cached
+            bool memoize;
         } function_def;
 
         struct {
-            char *name;
-            arr_t *arguments;
+            symbol_t name;
+            ast_list arguments;
+            // inline cache , definition found by call in run 'cached_run'
+            struct ast_node *target;
+            uint32_t cached_run;
+            // set by resolver when name is builtin not defined by script
+            const struct builtin *builtin;
         } function_call;
 
         struct {
@@ -82,57 +158,89 @@ typedef struct ast_node {
     } data;
 } ast_node;
 
+// heap work stacks of parser , kept for all statements of one source
+struct open_statement;
+struct expr_operand;
+struct expr_pending;
+
+// cursor over token buffer , 'current' is index of token being parsed
 typedef struct lexer_t {
-    token *current;
-    size_t current_index;
-    arr_t *tokens;
+    const token_buffer *tokens;
+    size_t current;
+    arena_t *arena;
+
+    // compound statements being parsed , their count is nesting depth
+    struct open_statement *open;
+    size_t open_count;
+    size_t open_capacity;
+
+    struct expr_operand *operands;
+    size_t operand_count;
+    size_t operand_capacity;
+
+    struct expr_pending *pending;
+    size_t pending_count;
+    size_t pending_capacity;
 } lexer_t;
 
+static inline TokenType lexer_type(const lexer_t *lexer) {
+    return (TokenType)lexer->tokens->types[lexer->current];
+}
+
+static inline size_t lexer_line(const lexer_t *lexer) {
+    return lexer->tokens->lines[lexer->current];
+}
+
+static inline double lexer_number(const lexer_t *lexer) {
+    return lexer->tokens->values[lexer->current].number;
+}
+
+static inline symbol_t lexer_symbol(const lexer_t *lexer) {
+    return lexer->tokens->values[lexer->current].symbol;
+}
+
 void print_ast(ast_node *node, int indent);
 
-ast_node *new_number_node(double value);
-ast_node *new_binary_node(ast_node *left, ast_node *right, TokenType type);
-ast_node *new_variable_node(const char *name , bool is_const);
-ast_node *new_assignment_node(const char *var_name, ast_node *value , bool is_const);
-ast_node *new_if_node(ast_node *condition, ast_node *if_body, ast_node *else_body);
-ast_node *new_print_node(ast_node *expression);
-ast_node *new_block_node(arr_t *statements);
-ast_node *new_loop_node(ast_node *condition , ast_node *loop_body);
-ast_node *new_loop_stop_node();
-ast_node *new_loop_next_node();
-ast_node *new_function_def_node(const char *name, arr_t *parameters, ast_node *body);
-ast_node *new_function_call_node(const char *name, arr_t *arguments);
-ast_node *new_return_node(ast_node *value);
-
-ast_node *build_ast_tree(arr_t* tokens);
-void free_ast(ast_node *node);
-
-lexer_t *new_lexer(arr_t *tokens);
+ast_node *new_number_node(arena_t *arena, double value);
+ast_node *new_binary_node(arena_t *arena, ast_node *left, ast_node *right, TokenType type);
+ast_node *new_variable_node(arena_t *arena, symbol_t name , bool is_const);
+ast_node *new_assignment_node(arena_t *arena, symbol_t var_name, ast_node *value , bool is_const);
+ast_node *new_if_node(arena_t *arena, ast_node *condition, ast_node *if_body, ast_node *else_body);
+ast_node *new_print_node(arena_t *arena, ast_node *expression);
+ast_node *new_block_node(arena_t *arena, arr_t *statements);
+ast_node *new_loop_node(arena_t *arena, ast_node *condition , ast_node *loop_body);
+ast_node *new_range_loop_node(arena_t *arena, symbol_t var_name, ast_node *start,
+                              ast_node *end, ast_node *step, ast_node *loop_body);
+ast_node *new_loop_stop_node(arena_t *arena);
+ast_node *new_loop_next_node(arena_t *arena);
+ast_node *new_function_def_node(arena_t *arena, symbol_t name, symbol_t *parameters,
+                                size_t param_count, ast_node *body);
+ast_node *new_function_call_node(arena_t *arena, symbol_t name, arr_t *arguments);
+ast_node *new_index_node(arena_t *arena, symbol_t name, ast_node *index);
+ast_node *new_index_assign_node(arena_t *arena, symbol_t name, ast_node *index,
+                                ast_node *value);
+ast_node *new_return_node(arena_t *arena, ast_node *value);
+
+ast_node *build_ast_tree(const token_buffer *tokens, arena_t *arena);
+
+lexer_t *new_lexer(const token_buffer *tokens, arena_t *arena);
 void free_lexer(lexer_t *lexer);
 void lexer_skip(lexer_t *lexer, size_t count);
 void lexer_one_skip(lexer_t *lexer);
 void lexer_syntax_error(lexer_t *lexer , const char* message);
 bool lexer_skip_if_eq(lexer_t *lexer , TokenType type);
 
-token *lexer_take(lexer_t *lexer);
-token *lexer_look_back(lexer_t *lexer);
-token *lexer_look_next(lexer_t *lexer);
+size_t lexer_column(const lexer_t *lexer);
+size_t lexer_take(lexer_t *lexer);
+size_t lexer_look_back(lexer_t *lexer);
+size_t lexer_look_next(lexer_t *lexer);
 
-ast_node *build_ast_tree(arr_t *tokens);
 ast_node *parse_block(lexer_t *lexer);
 ast_node *parse_statement(lexer_t *lexer);
-ast_node *parse_if_statement(lexer_t *lexer);
 ast_node *parse_print_statement(lexer_t *lexer);
-ast_node *parse_loop_statement(lexer_t *lexer);
-ast_node *parse_function_def(lexer_t *lexer);
-
-ast_node *parse_function_call(lexer_t *lexer, const char *name);
 ast_node *parse_return_statement(lexer_t *lexer);
 
 ast_node *parse_expression(lexer_t *lexer);
 ast_node *parse_comparison(lexer_t *lexer);
-ast_node *parse_term(lexer_t *lexer);
-ast_node *parse_factor(lexer_t *lexer);
-ast_node *parse_comparison(lexer_t *lexer);
 
 #endif
@@ -0,0 +1,584 @@
+#include "licm.h"
+#include "logger.h"
+#include <stdint.h>
+#include "stats.h"
+#include "walk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// walk numbers loops and assignments in order , name is assigned in loop
+// being processed when its latest assignment is not before start of the loop
+// (inner loops go first , so everything after the start is inside). Symbols
+// interned after 'first_temp' are temporaries made by this pass.
+typedef struct {
+  arena_t *arena;
+  size_t *assigned;
+  size_t capacity;
+  size_t position;
+  size_t loop_start;
+  symbol_t first_temp;
+  size_t temp_count;
+  // names which may hold array , script ones only
+  bool *arrays;
+  // assignments computed before loop being processed
+  arr_t *hoisted;
+  // whether operands of expression being hoisted are invariant
+  bool *flags;
+  size_t flag_count;
+  size_t flag_capacity;
+} licm;
+
+static void fit_symbols(licm *h, size_t count) {
+  if (count <= h->capacity)
+    return;
+
+  size_t capacity = h->capacity ? h->capacity : 64;
+  while (capacity < count)
+    capacity *= 2;
+
+  h->assigned = realloc(h->assigned, sizeof(size_t) * capacity);
+  if (!h->assigned)
+    elog("Error allocation memory for loop invariant names");
+  memset(h->assigned + h->capacity, 0,
+         sizeof(size_t) * (capacity - h->capacity));
+  h->capacity = capacity;
+}
+
+// '$' never starts identifier of script , so temporaries can't clash with it ,
+// names left by previous scripts are skipped
+static symbol_t new_temp(licm *h) {
+  char name[32];
+  symbol_t temp;
+  do {
+    snprintf(name, sizeof(name), "$%zu", h->temp_count++);
+    temp = intern_cstr(name);
+  } while (temp < h->first_temp);
+
+  fit_symbols(h, symbol_count());
+  return temp;
+}
+
+static bool is_assigned(licm *h, symbol_t name) {
+  return h->assigned[name] >= h->loop_start;
+}
+
+// operator over array fails and so does read of unset variable , so
+// operator moves out of loop only when none of its variables may hold array
+// or be unset
+static bool is_invariant_number(licm *h, ast_node *var) {
+  symbol_t name = var->data.var.var_name;
+  return !var->data.var.maybe_unset && !is_assigned(h, name) &&
+         (name >= h->first_temp || !h->arrays[name]);
+}
+
+static bool may_be_array(licm *h, ast_node *value) {
+  switch (value->type) {
+  case NODE_NUMBER:
+  case NODE_BIN_OP:
+    return false;
+  case NODE_VARIABLE:
+    return h->arrays[value->data.var.var_name];
+  default:
+    return true;
+  }
+}
+
+// names are shared by all scopes , so name may hold array when any of its
+// assignments gives value which may be one : call , element , param or name
+// which may hold array itself , the last spreads until nothing changes
+static void find_arrays(licm *h, ast_node *tree) {
+  h->arrays = calloc(h->first_temp ? h->first_temp : 1, sizeof(bool));
+  arr_t *assignments = arr_create(16);
+  if (!h->arrays || !assignments)
+    elog("Error allocation memory for loop invariant names");
+
+  walker w;
+  walk_init(&w, tree);
+  walk_step step;
+  while (walk_next(&w, &step)) {
+    ast_node *node = step.node;
+    if (step.leaving)
+      continue;
+
+    if (node->type == NODE_ASSIGNMENT) {
+      arr_push(assignments, node);
+      walk_skip(&w);
+    } else if (node->type == NODE_FUNCTION_DEF) {
+      for (size_t i = 0; i < node->data.function_def.param_count; i++)
+        h->arrays[node->data.function_def.params[i]] = true;
+    } else if (is_expression(node)) {
+      walk_skip(&w);
+    }
+  }
+  walk_free(&w);
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 0; i < assignments->size; i++) {
+      ast_node *assignment = arr_get(assignments, i);
+      symbol_t name = assignment->data.assignment.var_name;
+      ast_node *value = assignment->data.assignment.value;
+      if (h->arrays[name] || !may_be_array(h, value))
+        continue;
+      h->arrays[name] = true;
+      changed = true;
+    }
+  }
+  arr_destroy(assignments);
+}
+
+// temporaries are assigned right before loop being processed , so they stay
+// assigned inside of enclosing loops
+static void assign_before_loop(licm *h, symbol_t temp) {
+  h->assigned[temp] = h->loop_start - 1;
+}
+
+static bool is_invariant(licm *h, ast_node *node) {
+  walker w;
+  walk_init(&w, node);
+  walk_step step;
+  bool invariant = true;
+  while (invariant && walk_next(&w, &step)) {
+    ast_node *at = step.node;
+    if (step.leaving)
+      continue;
+
+    switch (at->type) {
+    case NODE_NUMBER:
+      break;
+    case NODE_VARIABLE:
+      invariant = is_invariant_number(h, at);
+      break;
+    case NODE_BIN_OP: {
+      ast_node *right = at->data.binary.right;
+      invariant = at->data.binary.op != TOKEN_DIVIDE ||
+                  (right->type == NODE_NUMBER && right->data.value != 0);
+      break;
+    }
+    default:
+      invariant = false;
+      break;
+    }
+  }
+  walk_free(&w);
+  return invariant;
+}
+
+// both trees are walked side by side , shapes match while every pair of
+// nodes does
+static bool same_expr(ast_node *one, ast_node *two) {
+  walker w1, w2;
+  walk_init(&w1, one);
+  walk_init(&w2, two);
+  walk_step a, b;
+  bool same = true;
+  while (same && walk_next(&w1, &a)) {
+    walk_next(&w2, &b);
+    if (a.leaving)
+      continue;
+
+    ast_node *x = a.node;
+    ast_node *y = b.node;
+    if (x->type != y->type)
+      same = false;
+    else if (x->type == NODE_NUMBER)
+      same = memcmp(&x->data.value, &y->data.value, sizeof(double)) == 0;
+    else if (x->type == NODE_VARIABLE)
+      same = x->data.var.var_name == y->data.var.var_name;
+    else if (x->type == NODE_BIN_OP)
+      same = x->data.binary.op == y->data.binary.op;
+    else
+      same = false;
+  }
+  walk_free(&w1);
+  walk_free(&w2);
+  return same;
+}
+
+// operator is moved to assignment of temporary and replaced by read of it in
+// place , equal operators of one loop share temporary
+static void hoist(licm *h, ast_node *node) {
+  symbol_t temp = NO_SYMBOL;
+  for (size_t i = 0; i < h->hoisted->size && temp == NO_SYMBOL; i++) {
+    ast_node *assignment = arr_get(h->hoisted, i);
+    if (assignment->data.assignment.var_name >= h->first_temp &&
+        same_expr(assignment->data.assignment.value, node))
+      temp = assignment->data.assignment.var_name;
+  }
+
+  if (temp == NO_SYMBOL) {
+    temp = new_temp(h);
+    ast_node *value = arena_copy(h->arena, node, sizeof(ast_node));
+    ast_node *assignment = new_assignment_node(h->arena, temp, value, false);
+    assignment->line = node->line;
+    arr_push(h->hoisted, assignment);
+    assign_before_loop(h, temp);
+  }
+
+  node->type = NODE_VARIABLE;
+  node->data.var.var_name = temp;
+  node->data.var.is_const = false;
+  node->data.var.slot = 0;
+  node->data.var.maybe_unset = false;
+  STAT_INC(nodes_hoisted);
+}
+
+static void push_flag(licm *h, bool flag) {
+  if (h->flag_count >= h->flag_capacity) {
+    h->flag_capacity = h->flag_capacity ? h->flag_capacity * 2 : 32;
+    h->flags = realloc(h->flags, sizeof(bool) * h->flag_capacity);
+    if (!h->flags)
+      elog("Error allocation memory for loop invariant operands");
+  }
+  h->flags[h->flag_count++] = flag;
+}
+
+static void hoist_operand(licm *h, ast_node *node, bool invariant) {
+  if (invariant && node->type == NODE_BIN_OP)
+    hoist(h, node);
+}
+
+// hoists largest invariant operators of expression , node is invariant when
+// its operands are , so it is decided once when node is left and operands
+// are hoisted when their parent turns out not to be invariant
+static void hoist_expr(licm *h, ast_node *node) {
+  if (!node)
+    return;
+
+  walker w;
+  walk_init(&w, node);
+  walk_step step;
+  while (walk_next(&w, &step)) {
+    ast_node *at = step.node;
+    if (!step.leaving)
+      continue;
+
+    bool invariant = false;
+    switch (at->type) {
+    case NODE_NUMBER:
+      invariant = true;
+      break;
+    case NODE_VARIABLE:
+      invariant = is_invariant_number(h, at);
+      break;
+    case NODE_BIN_OP: {
+      ast_node *right = at->data.binary.right;
+      bool right_invariant = h->flags[--h->flag_count];
+      bool left_invariant = h->flags[--h->flag_count];
+      invariant = left_invariant && right_invariant &&
+                  (at->data.binary.op != TOKEN_DIVIDE ||
+                   (right->type == NODE_NUMBER && right->data.value != 0));
+      if (!invariant) {
+        hoist_operand(h, at->data.binary.left, left_invariant);
+        hoist_operand(h, right, right_invariant);
+      }
+      break;
+    }
+    case NODE_FUNCTION_CALL: {
+      ast_list *arguments = &at->data.function_call.arguments;
+      h->flag_count -= arguments->count;
+      for (size_t i = 0; i < arguments->count; i++)
+        hoist_operand(h, arguments->items[i], h->flags[h->flag_count + i]);
+      break;
+    }
+    case NODE_INDEX:
+      h->flag_count--;
+      hoist_operand(h, at->data.element.index, h->flags[h->flag_count]);
+      break;
+    default:
+      break;
+    }
+    push_flag(h, invariant);
+  }
+  walk_free(&w);
+
+  hoist_operand(h, node, h->flags[--h->flag_count]);
+}
+
+// temporary of inner loop whose value is invariant here too moves before
+// this loop , temporaries are assigned only in blocks made by hoist_loop
+static bool move_temp(licm *h, ast_node *node) {
+  if (node->type != NODE_ASSIGNMENT ||
+      node->data.assignment.var_name < h->first_temp ||
+      !is_invariant(h, node->data.assignment.value))
+    return false;
+
+  arr_push(h->hoisted, node);
+  assign_before_loop(h, node->data.assignment.var_name);
+  return true;
+}
+
+static bool was_moved(licm *h, ast_node *statement) {
+  for (size_t i = 0; i < h->hoisted->size; i++)
+    if (arr_get(h->hoisted, i) == statement)
+      return true;
+  return false;
+}
+
+// inner loops are skipped , whatever is invariant here is invariant in them
+// too and is already in their temporaries. Bounds of range loop are computed
+// once per its start , so they belong to this loop. Moved temporaries leave
+// their block , it keeps at least the loop they were computed for.
+static void hoist_body(licm *h, ast_node *body) {
+  walker w;
+  walk_init(&w, body);
+  walk_step step;
+  while (walk_next(&w, &step)) {
+    ast_node *node = step.node;
+
+    if (step.leaving) {
+      if (node->type != NODE_BLOCK)
+        continue;
+      ast_list *statements = &node->data.block.statements;
+      size_t kept = 0;
+      for (size_t i = 0; i < statements->count; i++)
+        if (!was_moved(h, statements->items[i]))
+          statements->items[kept++] = statements->items[i];
+      statements->count = kept;
+      continue;
+    }
+
+    if (step.parent && step.parent->type == NODE_BLOCK &&
+        move_temp(h, node)) {
+      walk_skip(&w);
+      continue;
+    }
+
+    if (is_expression(node)) {
+      hoist_expr(h, node);
+      walk_skip(&w);
+      continue;
+    }
+
+    switch (node->type) {
+    case NODE_ASSIGNMENT:
+    case NODE_INDEX_ASSIGN:
+    case NODE_IF:
+    case NODE_PRINT:
+    case NODE_RETURN:
+    case NODE_BLOCK:
+      break;
+    case NODE_RANGE_LOOP:
+      hoist_expr(h, node->data.range_loop.start);
+      hoist_expr(h, node->data.range_loop.end);
+      hoist_expr(h, node->data.range_loop.step);
+      walk_skip(&w);
+      break;
+    default:
+      walk_skip(&w);
+      break;
+    }
+  }
+  walk_free(&w);
+}
+
+// loops and functions inside of body would need guards of their own , body
+// with them keeps its checks
+static bool is_flat_body(ast_node *body) {
+  walker w;
+  walk_init(&w, body);
+  walk_step step;
+  bool flat = true;
+  while (flat && walk_next(&w, &step)) {
+    if (step.leaving)
+      continue;
+
+    switch (step.node->type) {
+    case NODE_LOOP:
+    case NODE_RANGE_LOOP:
+    case NODE_FUNCTION_DEF:
+      flat = false;
+      break;
+    case NODE_IF:
+    case NODE_BLOCK:
+      break;
+    default:
+      walk_skip(&w);
+      break;
+    }
+  }
+  walk_free(&w);
+  return flat;
+}
+
+static bool is_small_whole(ast_node *node) {
+  return node->type == NODE_NUMBER && node->data.value >= INT16_MIN &&
+         node->data.value <= INT16_MAX &&
+         node->data.value == (double)(int16_t)node->data.value;
+}
+
+// index is 'var' , 'var + k' , 'k + var' or 'var - k' with whole literal 'k'
+static bool counter_offset(ast_node *index, symbol_t var, int *offset) {
+  if (index->type == NODE_VARIABLE) {
+    *offset = 0;
+    return index->data.var.var_name == var;
+  }
+  if (index->type != NODE_BIN_OP)
+    return false;
+
+  ast_node *left = index->data.binary.left;
+  ast_node *right = index->data.binary.right;
+  TokenType op = index->data.binary.op;
+  if (op == TOKEN_PLUS && right->type == NODE_VARIABLE) {
+    ast_node *swap = left;
+    left = right;
+    right = swap;
+  }
+  if ((op != TOKEN_PLUS && op != TOKEN_MINUS) ||
+      left->type != NODE_VARIABLE || left->data.var.var_name != var ||
+      !is_small_whole(right))
+    return false;
+
+  *offset = (int)(op == TOKEN_MINUS ? -right->data.value : right->data.value);
+  return true;
+}
+
+// accesses by counter of loop to arrays not assigned in it and assigned
+// before it , one guard per array covers all of them
+static void collect_guards(licm *h, ast_node *body, symbol_t var,
+                           arr_t *accesses) {
+  walker w;
+  walk_init(&w, body);
+  walk_step step;
+  while (walk_next(&w, &step)) {
+    ast_node *node = step.node;
+    int offset;
+    if (!step.leaving &&
+        (node->type == NODE_INDEX || node->type == NODE_INDEX_ASSIGN) &&
+        !is_assigned(h, node->data.element.name) &&
+        !node->data.element.maybe_unset &&
+        counter_offset(node->data.element.index, var, &offset))
+      arr_push(accesses, node);
+  }
+  walk_free(&w);
+}
+
+// counter of range loop takes whole steps from start , so checks of
+// 'array[counter + k]' are done once before the loop by its guards. Arrays
+// have fixed length and functions can't assign variables of caller , so
+// guard stays true while loop runs when counter and arrays are not assigned
+// in body.
+static void guard_range_loop(licm *h, ast_node *loop, size_t start) {
+  symbol_t var = loop->data.range_loop.var_name;
+  h->loop_start = start;
+  if (h->assigned[var] != start + 1 ||
+      !is_flat_body(loop->data.range_loop.loop_body))
+    return;
+
+  arr_t *accesses = arr_create(8);
+  collect_guards(h, loop->data.range_loop.loop_body, var, accesses);
+  if (accesses->size == 0) {
+    arr_destroy(accesses);
+    return;
+  }
+
+  range_guard *guards =
+      arena_alloc(h->arena, sizeof(range_guard) * accesses->size);
+  size_t count = 0;
+  for (size_t i = 0; i < accesses->size; i++) {
+    ast_node *access = arr_get(accesses, i);
+    int offset = 0;
+    counter_offset(access->data.element.index, var, &offset);
+    access->data.element.hoisted = true;
+    STAT_INC(checks_hoisted);
+
+    size_t g = 0;
+    while (g < count && guards[g].name != access->data.element.name)
+      g++;
+    if (g == count) {
+      guards[count++] = (range_guard){.name = access->data.element.name,
+                                      .low = (int16_t)offset,
+                                      .high = (int16_t)offset};
+    } else if (offset < guards[g].low) {
+      guards[g].low = (int16_t)offset;
+    } else if (offset > guards[g].high) {
+      guards[g].high = (int16_t)offset;
+    }
+  }
+  loop->data.range_loop.guards = guards;
+  loop->data.range_loop.guard_count = count;
+  arr_destroy(accesses);
+}
+
+// condition is NULL for range loop
+static void hoist_loop(licm *h, ast_node *loop, ast_node *body,
+                       ast_node *condition, size_t start) {
+  h->loop_start = start;
+
+  arr_t *hoisted = arr_create(4);
+  h->hoisted = hoisted;
+  // body goes first , so condition shares temporaries moved from inner loops
+  hoist_body(h, body);
+  hoist_expr(h, condition);
+  h->hoisted = NULL;
+
+  if (hoisted->size > 0) {
+    arr_push(hoisted, arena_copy(h->arena, loop, sizeof(ast_node)));
+    ast_node *block = new_block_node(h->arena, hoisted);
+    block->line = loop->line;
+    *loop = *block;
+  }
+  arr_destroy(hoisted);
+}
+
+// loops are processed when left , after loops inside of them
+static void hoist_tree(licm *h, ast_node *tree) {
+  walker w;
+  walk_init(&w, tree);
+  walk_step step;
+  while (walk_next(&w, &step)) {
+    ast_node *node = step.node;
+
+    if (step.leaving) {
+      if (node->type == NODE_LOOP) {
+        hoist_loop(h, node, node->data.loop.loop_body,
+                   node->data.loop.condition, step.kept);
+      } else if (node->type == NODE_RANGE_LOOP) {
+        // before hoist_loop , which may wrap loop into block
+        guard_range_loop(h, node, step.kept);
+        hoist_loop(h, node, node->data.range_loop.loop_body, NULL, step.kept);
+      }
+      continue;
+    }
+
+    switch (node->type) {
+    case NODE_ASSIGNMENT:
+      h->assigned[node->data.assignment.var_name] = ++h->position;
+      walk_skip(&w);
+      break;
+    case NODE_LOOP:
+      walk_keep(&w, ++h->position);
+      break;
+    // loop variable and reductions are assigned on every iteration
+    case NODE_RANGE_LOOP:
+      walk_keep(&w, ++h->position);
+      h->assigned[node->data.range_loop.var_name] = ++h->position;
+      for (size_t i = 0; i < node->data.range_loop.reduction_count; i++)
+        h->assigned[node->data.range_loop.reductions[i].name] = h->position;
+      break;
+    case NODE_IF:
+    case NODE_BLOCK:
+    case NODE_FUNCTION_DEF:
+      break;
+    default:
+      walk_skip(&w);
+      break;
+    }
+  }
+  walk_free(&w);
+}
+
+void hoist_invariants(ast_node *ast_tree, arena_t *arena) {
+  if (!ast_tree || !arena)
+    elog("Can't hoist loop invariants , null ptr on ast tree or arena");
+
+  licm h = {.arena = arena, .first_temp = (symbol_t)symbol_count()};
+  fit_symbols(&h, symbol_count());
+  find_arrays(&h, ast_tree);
+  hoist_tree(&h, ast_tree);
+  free(h.arrays);
+  free(h.flags);
+  free(h.assigned);
+}
@@ -0,0 +1,16 @@
+#ifndef LICM_H
+#define LICM_H
+
+#include "arena.h"
+#include "lexer.h"
+
+// Loop invariant code motion : operators in condition and body of loop whose
+// variables are never assigned inside of the loop are computed once into
+// temporaries before it , loop is replaced by block of these assignments and
+// the loop. Inner loops go first , so temporaries of inner loop move further
+// out while they stay invariant. Only operators which can't fail are moved
+// (no calls , division only by nonzero literal , no variables which may hold
+// arrays or be unset) , so loop which never runs can't fail because of them.
+void hoist_invariants(ast_node *ast_tree, arena_t *arena);
+
+#endif
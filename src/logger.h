@@ -1,8 +1,11 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
+// clang only , gcc warns about unknown warning
+#ifdef __clang__
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wgnu-zero-variadic-macro-arguments"
+#endif
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -63,5 +66,7 @@ log_level get_log_level(void);
     exit(1); \
 } while(0)
 
+#ifdef __clang__
 #pragma GCC diagnostic pop
 #endif
+#endif
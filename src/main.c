@@ -1,9 +1,22 @@
-#include "arr.h"
+#include "compiler.h"
+#include "depth.h"
 #include "interpreter.h"
+#include "jit.h"
 #include "lexer.h"
 #include "logger.h"
+#include "optimizer.h"
 #include "parser.h"
+#include "pool.h"
+#include "profile.h"
+#include "source.h"
+#include "stats.h"
+#include "unit.h"
+#include "vm.h"
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 const char *token_type_to_str(TokenType type) {
   switch (type) {
@@ -51,85 +64,264 @@ const char *token_type_to_str(TokenType type) {
     return "GE";
   case TOKEN_NE:
     return "NE";
+  case TOKEN_CONST:
+    return "CONST";
+  case TOKEN_LOOP:
+    return "LOOP";
+  case TOKEN_LOOP_NEXT:
+    return "NEXT";
+  case TOKEN_LOOP_STOP:
+    return "STOP";
+  case TOKEN_FN:
+    return "FN";
+  case TOKEN_RETURN:
+    return "RETURN";
+  case TOKEN_ARROW:
+    return "ARROW";
+  case TOKEN_COMMA:
+    return "COMMA";
+  case TOKEN_PURE:
+    return "PURE";
+  case TOKEN_RANGE:
+    return "RANGE";
+  case TOKEN_PLOOP:
+    return "PLOOP";
+  case TOKEN_LBRACKET:
+    return "LBRACKET";
+  case TOKEN_RBRACKET:
+    return "RBRACKET";
   default:
     return "UNKNOWN";
   }
 }
 
-char* load_file(const char* filename) {
-    FILE* file = fopen(filename, "r");
-    if (file == NULL) {
-        printf("Ошибка при открытии файла: %s\n", filename);
-        return NULL;
-    }
-    
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    rewind(file);
-    
-    char* buffer = (char*)malloc(file_size + 1);
-    if (buffer == NULL) {
-        printf("Ошибка при выделении памяти\n");
-        fclose(file);
-        return NULL;
-    }
-    
-    size_t read_size = fread(buffer, 1, file_size, file);
-    if (read_size != file_size) {
-        printf("Ошибка при чтении файла\n");
-        free(buffer);
-        fclose(file);
-        return NULL;
+typedef struct options_t {
+  const char *script;
+  bool dump_tokens;
+  bool dump_ast;
+  bool dump_bytecode;
+  bool tree;
+  bool no_jit;
+  bool time;
+  bool stats;
+  bool profile;
+  const char *profile_folded;
+  bool help;
+} options_t;
+
+static void print_usage(FILE *out) {
+  fprintf(out,
+          "Usage: anum [options] script\n"
+          "  script            path to script , '-' reads it from stdin\n"
+          "Options:\n"
+          "  --dump-tokens     print token table\n"
+          "  --dump-ast        print ast tree\n"
+          "  --dump-bytecode   print compiled bytecode\n"
+          "  --tree            run reference ast walker instead of vm\n"
+          "  --no-jit          interpret all bytecode , never compile it to "
+          "native code\n"
+          "  --time            print time of every phase to stderr\n"
+          "  --stats           print counters and phase times as json to "
+          "stderr\n"
+          "  --profile         sample running script and print flat profile "
+          "to stderr\n"
+          "  --profile-folded FILE\n"
+          "                    write sampled stacks in folded format for "
+          "flamegraphs\n"
+          "  --max-depth N     limit nesting of statements and expressions "
+          "(default %d)\n"
+          "  --max-call-depth N\n"
+          "                    limit nesting of calls (default %d)\n"
+          "  --threads N       run ploop on N threads (default one per cpu)\n"
+          "  -h , --help       print this help\n",
+          DEFAULT_MAX_DEPTH, DEFAULT_MAX_CALL_DEPTH);
+}
+
+// returns false when arguments are wrong
+static bool parse_options(int argc, char **argv, options_t *options) {
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+
+    if (strcmp(arg, "--dump-tokens") == 0) {
+      options->dump_tokens = true;
+    } else if (strcmp(arg, "--dump-ast") == 0) {
+      options->dump_ast = true;
+    } else if (strcmp(arg, "--dump-bytecode") == 0) {
+      options->dump_bytecode = true;
+    } else if (strcmp(arg, "--tree") == 0) {
+      options->tree = true;
+    } else if (strcmp(arg, "--no-jit") == 0) {
+      options->no_jit = true;
+    } else if (strcmp(arg, "--time") == 0) {
+      options->time = true;
+    } else if (strcmp(arg, "--stats") == 0) {
+      options->stats = true;
+    } else if (strcmp(arg, "--profile") == 0) {
+      options->profile = true;
+    } else if (strcmp(arg, "--profile-folded") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Option '%s' needs file path\n", arg);
+        return false;
+      }
+      options->profile_folded = argv[++i];
+    } else if (strcmp(arg, "--max-depth") == 0 ||
+               strcmp(arg, "--max-call-depth") == 0 ||
+               strcmp(arg, "--threads") == 0) {
+      char *end = NULL;
+      long number = i + 1 < argc ? strtol(argv[i + 1], &end, 10) : 0;
+      if (number <= 0 || *end != '\0') {
+        fprintf(stderr, "Option '%s' needs positive number\n", arg);
+        return false;
+      }
+      if (strcmp(arg, "--max-depth") == 0) {
+        set_max_depth((size_t)number);
+      } else if (strcmp(arg, "--max-call-depth") == 0) {
+        set_max_call_depth((size_t)number);
+      } else {
+        set_pool_threads((size_t)number);
+      }
+      i++;
+    } else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+      options->help = true;
+      return true;
+    } else if (arg[0] == '-' && arg[1] != '\0') {
+      fprintf(stderr, "Unknown option '%s'\n", arg);
+      return false;
+    } else if (options->script) {
+      fprintf(stderr, "Only one script can be run , got '%s' and '%s'\n",
+              options->script, arg);
+      return false;
+    } else {
+      options->script = arg;
     }
-    
-    buffer[file_size] = '\0';
-    
-    fclose(file);
-    return buffer;
+  }
+
+  if (!options->script) {
+    fprintf(stderr, "No script given\n");
+    return false;
+  }
+  return true;
 }
 
-int main(void) {
-  const char* src_path = "/Users/illashisko/Documents/GitHub/Annuum/src/src.txt";
-  char *code = load_file(src_path);
-  arr_t *tokens = parse(code);
+static void print_tokens(const token_buffer *tokens) {
+  const char *code = tokens->source;
 
-  printf("Parsed tokens for code: \"%s\"\n", code);
   printf("----------------------------------------------------\n");
   printf("| %-15s | %-15s | %-10s | %-10s |\n", "TYPE", "VALUE", "LINE",
          "OFFSET");
   printf("----------------------------------------------------\n");
 
-  for (size_t i = 0; i < tokens->size; i++) {
-    token *t = (token *)arr_get(tokens, i);
+  for (size_t i = 0; i < tokens->count; i++) {
+    TokenType type = (TokenType)tokens->types[i];
 
-    if (t->type == TOKEN_NUMBER) {
-      printf("| %-15s | %-15.2f | %-10zu | %-10zu |\n",
-             token_type_to_str(t->type), t->value.number, t->line, t->offset);
-    } else if (t->type == TOKEN_IDENTIFIER) {
-      printf("| %-15s | %-15s | %-10zu | %-10zu |\n",
-             token_type_to_str(t->type), t->value.string, t->line, t->offset);
+    if (type == TOKEN_NUMBER) {
+      printf("| %-15s | %-15.2f | %-10u | %-10zu |\n", token_type_to_str(type),
+             tokens->values[i].number, tokens->lines[i],
+             token_column(tokens, i));
     } else {
-      printf(
-          "| %-15s | %-15s | %-10zu | %-10zu |\n", token_type_to_str(t->type),
-          (t->type == TOKEN_EOF) ? ""
-                                 : ((t->value.string) ? t->value.string : ""),
-          t->line, t->offset);
+      printf("| %-15s | %-15.*s | %-10u | %-10zu |\n", token_type_to_str(type),
+             (int)tokens->lengths[i], code + tokens->offsets[i],
+             tokens->lines[i], token_column(tokens, i));
     }
   }
   printf("----------------------------------------------------\n");
+}
 
-  ast_node *ast_tree = build_ast_tree(tokens);
-  if (!ast_tree)
+// only vm is sampled , time spent in compiler is not a part of profile
+static double run_vm(ast_node *tree, const options_t *options) {
+  proto *main_proto = compile(tree);
+  if (options->dump_bytecode)
+    print_proto(main_proto, 0);
+
+  bool profile = options->profile || options->profile_folded;
+  if (profile)
+    profile_start();
+  double result = vm_run(main_proto);
+  if (profile)
+    profile_stop();
+
+  free_proto(main_proto);
+  return result;
+}
+
+static void report_profile(const options_t *options) {
+  if (options->profile)
+    profile_print_flat(stderr);
+
+  if (options->profile_folded) {
+    FILE *out = fopen(options->profile_folded, "w");
+    if (!out)
+      elog("Can't open file '%s' for folded stacks",
+           options->profile_folded);
+    profile_write_folded(out);
+    fclose(out);
+  }
+  free_profile();
+}
+
+static void run_script(const options_t *options) {
+  if ((options->time || options->stats) && !STATS_ENABLED)
+    fprintf(stderr, "Stats are compiled out , rebuild without "
+                    "ANNUUM_NO_STATS to get them\n");
+  if ((options->profile || options->profile_folded) && options->tree)
+    fprintf(stderr, "Profiler samples only vm , '--tree' run is not "
+                    "profiled\n");
+
+  if (options->no_jit)
+    jit_set_enabled(false);
+
+  uint64_t started = stats_phase_begin();
+  source_t *source = strcmp(options->script, "-") == 0
+                         ? load_source_fd(STDIN_FILENO)
+                         : load_source(options->script);
+  stats_phase_end(PHASE_load, started);
+
+  unit_t *unit = new_unit();
+  started = stats_phase_begin();
+  unit->tokens = parse(source->data, source->length);
+  stats_phase_end(PHASE_tokenize, started);
+  if (options->dump_tokens)
+    print_tokens(unit->tokens);
+
+  started = stats_phase_begin();
+  unit->tree = build_ast_tree(unit->tokens, unit->arena);
+  if (!unit->tree)
     elog("Error parsing ast tree , build_ast_tree return NULL ptr");
+  stats_phase_end(PHASE_parse, started);
+  if (options->dump_ast)
+    print_ast(unit->tree, 0);
+
+  optimize(unit->tree, unit->arena);
 
-  print_ast(ast_tree, 2);
+  if (options->tree)
+    interpret_tree(unit->tree);
+  else
+    run_vm(unit->tree, options);
 
-  double result = interpret(ast_tree);
+  if (options->time)
+    stats_print_times(stderr);
+  if (options->stats)
+    stats_print_json(stderr);
+  if (options->profile || options->profile_folded)
+    report_profile(options);
 
-  printf("\n\nResult is %.2f \n", result);
+  free_pool();
+  free_unit(unit);
+  free_source(source);
+  free_symbols();
+}
 
-  free_ast(ast_tree);
-  arr_destroy(tokens);
+int main(int argc, char **argv) {
+  options_t options = {0};
+  if (!parse_options(argc, argv, &options)) {
+    print_usage(stderr);
+    return 1;
+  }
+  if (options.help) {
+    print_usage(stdout);
+    return 0;
+  }
 
+  run_script(&options);
   return 0;
 }
@@ -0,0 +1,138 @@
+#include "memo.h"
+#include "array.h"
+#include "logger.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+// integral doubles differ only in high bits , so every argument word goes
+// through splitmix64 finalizer before it reaches index bits , result is
+// nonzero since 0 marks free entry
+static uint64_t memo_hash(const double *args, size_t count) {
+  uint64_t hash = 0x9E3779B97F4A7C15u;
+  for (size_t i = 0; i < count; i++) {
+    uint64_t bits;
+    memcpy(&bits, &args[i], sizeof(bits));
+    hash ^= bits;
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9u;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBu;
+    hash ^= hash >> 31;
+  }
+  return hash ? hash : 1;
+}
+
+static bool memo_same(const memo_table *memo, size_t index,
+                      const double *args) {
+  return memcmp(memo->keys + index * memo->param_count, args,
+                sizeof(uint64_t) * memo->param_count) == 0;
+}
+
+static void memo_alloc(memo_table *memo, size_t capacity) {
+  // functions without params still get one key word , malloc(0) may fail
+  size_t key_count = capacity * memo->param_count;
+  memo->keys = malloc(sizeof(uint64_t) * (key_count ? key_count : 1));
+  memo->hashes = calloc(capacity, sizeof(uint64_t));
+  memo->values = malloc(sizeof(double) * capacity);
+  if (!memo->keys || !memo->hashes || !memo->values)
+    elog("Error allocation memory for memo table");
+
+  STAT_ADD(bytes_allocated,
+           sizeof(uint64_t) * capacity * (memo->param_count + 1) +
+               sizeof(double) * capacity);
+  memo->capacity = capacity;
+  memo->count = 0;
+}
+
+memo_table *new_memo_table(size_t param_count) {
+  memo_table *memo = malloc(sizeof(memo_table));
+  if (!memo)
+    elog("Error allocation memory for memo table");
+
+  memo->param_count = param_count;
+  memo_alloc(memo, MEMO_MIN_ENTRIES);
+  return memo;
+}
+
+bool memo_get(const memo_table *memo, const double *args, double *value) {
+  uint64_t hash = memo_hash(args, memo->param_count);
+  size_t mask = memo->capacity - 1;
+
+  for (size_t probe = 0; probe < MEMO_PROBES; probe++) {
+    size_t index = (hash + probe) & mask;
+    if (memo->hashes[index] == 0)
+      return false;
+    if (memo->hashes[index] == hash && memo_same(memo, index, args)) {
+      *value = memo->values[index];
+      return true;
+    }
+  }
+  return false;
+}
+
+// free or equal entry in probe window of hash , first entry of window is
+// evicted when there is none
+static size_t memo_slot(const memo_table *memo, uint64_t hash,
+                        const double *args) {
+  size_t mask = memo->capacity - 1;
+  for (size_t probe = 0; probe < MEMO_PROBES; probe++) {
+    size_t index = (hash + probe) & mask;
+    if (memo->hashes[index] == 0 ||
+        (memo->hashes[index] == hash && memo_same(memo, index, args)))
+      return index;
+  }
+  return hash & mask;
+}
+
+static void memo_store(memo_table *memo, uint64_t hash, const double *args,
+                       double value) {
+  size_t index = memo_slot(memo, hash, args);
+  if (memo->hashes[index] == 0)
+    memo->count++;
+
+  memo->hashes[index] = hash;
+  memcpy(memo->keys + index * memo->param_count, args,
+         sizeof(uint64_t) * memo->param_count);
+  memo->values[index] = value;
+}
+
+static void memo_grow(memo_table *memo) {
+  memo_table old = *memo;
+  memo_alloc(memo, old.capacity * 2);
+
+  for (size_t i = 0; i < old.capacity; i++) {
+    if (old.hashes[i] == 0)
+      continue;
+    double *args = (double *)(old.keys + i * old.param_count);
+    memo_store(memo, old.hashes[i], args, old.values[i]);
+  }
+
+  free(old.keys);
+  free(old.hashes);
+  free(old.values);
+}
+
+// arrays are left out , their handles would outlive arrays freed by
+// collection and their elements change under the same handle
+void memo_put(memo_table *memo, const double *args, double value) {
+  if (is_array(value))
+    return;
+  for (size_t i = 0; i < memo->param_count; i++)
+    if (is_array(args[i]))
+      return;
+
+  if ((memo->count + 1) * 2 > memo->capacity &&
+      memo->capacity < MEMO_MAX_ENTRIES)
+    memo_grow(memo);
+
+  memo_store(memo, memo_hash(args, memo->param_count), args, value);
+}
+
+void free_memo_table(memo_table *memo) {
+  if (!memo)
+    return;
+
+  free(memo->keys);
+  free(memo->hashes);
+  free(memo->values);
+  free(memo);
+}
@@ -0,0 +1,31 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Results of pure function keyed on bit patterns of its arguments , table
+// grows up to MEMO_MAX_ENTRIES and then new results evict old ones from
+// their probe window , so memory stays bounded for any number of keys
+#define MEMO_MIN_ENTRIES 64
+#define MEMO_MAX_ENTRIES (64 * 1024)
+#define MEMO_PROBES 8
+
+typedef struct memo_table {
+  size_t param_count;
+  // keys of entry i are keys[i * param_count ..] , hashes of 0 mark free
+  // entries
+  uint64_t *keys;
+  uint64_t *hashes;
+  double *values;
+  size_t count;
+  size_t capacity;
+} memo_table;
+
+memo_table *new_memo_table(size_t param_count);
+bool memo_get(const memo_table *memo, const double *args, double *value);
+void memo_put(memo_table *memo, const double *args, double value);
+void free_memo_table(memo_table *memo);
+
+#endif
@@ -0,0 +1,280 @@
+#include "optimizer.h"
+#include "licm.h"
+#include "logger.h"
+#include "purity.h"
+#include "stats.h"
+#include "unset.h"
+#include "walk.h"
+#include <stdlib.h>
+
+// per symbol state of scope being optimized , valid only when its stamp
+// equals generation of scope , like in resolver
+typedef struct {
+  uint32_t generation;
+  // first declaration of name in scope decides whether it is const
+  uint32_t *declared;
+  bool *is_const;
+  // const value known at current point of scope
+  uint32_t *known;
+  double *values;
+  // consts learned by enclosing blocks , forgotten when block ends
+  symbol_t *learned;
+  size_t learned_count;
+  size_t learned_capacity;
+  arr_t *pending_functions;
+} optimizer;
+
+static void declare(optimizer *o, symbol_t name, bool is_const) {
+  if (o->declared[name] == o->generation)
+    return;
+  o->declared[name] = o->generation;
+  o->is_const[name] = is_const;
+}
+
+// mirrors declaration order of resolver , so name counts as const exactly
+// when resolver rejects every other assignment to it
+static void collect_declarations(optimizer *o, ast_node *body) {
+  walker w;
+  walk_init(&w, body);
+  walk_step step;
+  while (walk_next(&w, &step)) {
+    ast_node *node = step.node;
+    if (step.leaving)
+      continue;
+
+    switch (node->type) {
+    case NODE_ASSIGNMENT:
+      declare(o, node->data.assignment.var_name,
+              node->data.assignment.is_const);
+      break;
+    case NODE_RANGE_LOOP:
+      declare(o, node->data.range_loop.var_name, false);
+      for (size_t i = 0; i < node->data.range_loop.reduction_count; i++)
+        declare(o, node->data.range_loop.reductions[i].name, false);
+      break;
+    case NODE_IF:
+    case NODE_LOOP:
+    case NODE_BLOCK:
+      break;
+    default:
+      walk_skip(&w);
+      break;
+    }
+  }
+  walk_free(&w);
+}
+
+static void learn_const(optimizer *o, symbol_t name, double value) {
+  if (o->learned_count >= o->learned_capacity) {
+    o->learned_capacity = o->learned_capacity ? o->learned_capacity * 2 : 16;
+    o->learned = realloc(o->learned, sizeof(symbol_t) * o->learned_capacity);
+    if (!o->learned)
+      elog("Error allocation memory for optimizer consts");
+  }
+
+  o->learned[o->learned_count++] = name;
+  o->known[name] = o->generation;
+  o->values[name] = value;
+}
+
+static void forget_consts(optimizer *o, size_t mark) {
+  while (o->learned_count > mark)
+    o->known[o->learned[--o->learned_count]] = 0;
+}
+
+// same arithmetic as both engines , division by zero is left for runtime
+// error
+static bool fold_binary(TokenType op, double one, double two, double *result) {
+  switch (op) {
+  case TOKEN_PLUS:
+    *result = one + two;
+    return true;
+  case TOKEN_MINUS:
+    *result = one - two;
+    return true;
+  case TOKEN_MULTIPLY:
+    *result = one * two;
+    return true;
+  case TOKEN_DIVIDE:
+    if (two == 0)
+      return false;
+    *result = one / two;
+    return true;
+  case TOKEN_LT:
+    *result = one < two ? 1.0 : 0.0;
+    return true;
+  case TOKEN_LE:
+    *result = one <= two ? 1.0 : 0.0;
+    return true;
+  case TOKEN_GT:
+    *result = one > two ? 1.0 : 0.0;
+    return true;
+  case TOKEN_GE:
+    *result = one >= two ? 1.0 : 0.0;
+    return true;
+  case TOKEN_EQ:
+    *result = one == two ? 1.0 : 0.0;
+    return true;
+  case TOKEN_NE:
+    *result = one != two ? 1.0 : 0.0;
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool is_literal(ast_node *node, double value) {
+  return node->type == NODE_NUMBER && node->data.value == value;
+}
+
+// operator rejects array operand , so it is dropped only for operand which
+// is operator itself , variables , calls and elements may hold arrays
+static bool gives_number(ast_node *node) {
+  return node->type == NODE_BIN_OP || node->type == NODE_NUMBER;
+}
+
+// returns operand which is the value of whole expression , only identities
+// exact for every double are used , so x + 0 (x = -0) and x * 0 (x = inf ,
+// nan or negative) stay
+static ast_node *identity_operand(ast_node *node) {
+  ast_node *left = node->data.binary.left;
+  ast_node *right = node->data.binary.right;
+
+  switch (node->data.binary.op) {
+  case TOKEN_MULTIPLY:
+    if (is_literal(right, 1.0) && gives_number(left))
+      return left;
+    if (is_literal(left, 1.0) && gives_number(right))
+      return right;
+    return NULL;
+  case TOKEN_DIVIDE:
+    return is_literal(right, 1.0) && gives_number(left) ? left : NULL;
+  case TOKEN_MINUS:
+    return is_literal(right, 0.0) && gives_number(left) ? left : NULL;
+  default:
+    return NULL;
+  }
+}
+
+static void replace_with_number(ast_node *node, double value) {
+  node->type = NODE_NUMBER;
+  node->data.value = value;
+  STAT_INC(nodes_folded);
+}
+
+static void fold_node(ast_node *node) {
+  ast_node *left = node->data.binary.left;
+  ast_node *right = node->data.binary.right;
+
+  double value;
+  if (left->type == NODE_NUMBER && right->type == NODE_NUMBER &&
+      fold_binary(node->data.binary.op, left->data.value, right->data.value,
+                  &value)) {
+    replace_with_number(node, value);
+    return;
+  }
+
+  ast_node *operand = identity_operand(node);
+  if (operand) {
+    uint32_t line = node->line;
+    *node = *operand;
+    node->line = line;
+    STAT_INC(nodes_folded);
+  }
+}
+
+// operators fold when left , after their operands. Const is known only for
+// statements after its assignment in the same block , they are the only
+// ones which always run after it.
+static void optimize_body(optimizer *o, ast_node *body) {
+  walker w;
+  walk_init(&w, body);
+  walk_step step;
+  while (walk_next(&w, &step)) {
+    ast_node *node = step.node;
+
+    if (step.leaving) {
+      if (node->type == NODE_BIN_OP)
+        fold_node(node);
+      else if (node->type == NODE_BLOCK)
+        forget_consts(o, step.kept);
+      else if (node->type == NODE_ASSIGNMENT && step.parent &&
+               step.parent->type == NODE_BLOCK &&
+               node->data.assignment.is_const &&
+               node->data.assignment.value->type == NODE_NUMBER &&
+               o->is_const[node->data.assignment.var_name])
+        learn_const(o, node->data.assignment.var_name,
+                    node->data.assignment.value->data.value);
+      continue;
+    }
+
+    switch (node->type) {
+    case NODE_VARIABLE: {
+      symbol_t name = node->data.var.var_name;
+      if (o->known[name] == o->generation)
+        replace_with_number(node, o->values[name]);
+      break;
+    }
+    case NODE_BLOCK:
+      walk_keep(&w, o->learned_count);
+      break;
+    case NODE_FUNCTION_DEF:
+      arr_push(o->pending_functions, node);
+      walk_skip(&w);
+      break;
+    default:
+      break;
+    }
+  }
+  walk_free(&w);
+}
+
+// every function is a separate scope , new generation drops whatever was
+// known in previous one
+static void optimize_scope(optimizer *o, ast_node *function, ast_node *body) {
+  o->generation++;
+  if (function)
+    for (size_t i = 0; i < function->data.function_def.param_count; i++)
+      declare(o, function->data.function_def.params[i], false);
+
+  collect_declarations(o, body);
+  optimize_body(o, body);
+}
+
+void optimize(ast_node *ast_tree, arena_t *arena) {
+  if (!ast_tree)
+    elog("Can't optimize ast tree by null ptr");
+
+  uint64_t started = stats_phase_begin();
+  size_t symbols = symbol_count() ? symbol_count() : 1;
+  optimizer o = {
+      .generation = 0,
+      .declared = calloc(symbols, sizeof(uint32_t)),
+      .is_const = calloc(symbols, sizeof(bool)),
+      .known = calloc(symbols, sizeof(uint32_t)),
+      .values = calloc(symbols, sizeof(double)),
+      .pending_functions = arr_create(8),
+  };
+  if (!o.declared || !o.is_const || !o.known || !o.values ||
+      !o.pending_functions)
+    elog("Error allocation memory for optimizer");
+
+  optimize_scope(&o, NULL, ast_tree);
+  for (size_t i = 0; i < o.pending_functions->size; i++) {
+    ast_node *function = arr_get(o.pending_functions, i);
+    optimize_scope(&o, function, function->data.function_def.body);
+  }
+
+  // before hoisting , reads which may be unset stay in their loops
+  mark_unset_reads(ast_tree);
+  hoist_invariants(ast_tree, arena);
+  mark_pure_functions(ast_tree);
+
+  arr_destroy(o.pending_functions);
+  free(o.learned);
+  free(o.values);
+  free(o.known);
+  free(o.is_const);
+  free(o.declared);
+  stats_phase_end(PHASE_optimize, started);
+}
@@ -0,0 +1,15 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "arena.h"
+#include "lexer.h"
+
+// Rewrites ast before resolving : folds operators over number literals ,
+// replaces reads of consts assigned a literal by that literal and drops
+// identities which keep value unchanged (x * 1 , x / 1 , x - 0) , then marks
+// reads which may run before assignment (see unset.h) , moves loop invariant
+// operators out of loops (see licm.h , new nodes go to 'arena') and marks
+// functions whose calls are cached (see purity.h).
+void optimize(ast_node *ast_tree, arena_t *arena);
+
+#endif
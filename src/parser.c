@@ -1,310 +1,359 @@
 #include "parser.h"
-#include "arr.h"
 #include "logger.h"
+#include "stats.h"
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
-token *new_string_token(TokenType type, char *string, size_t line,
-                        size_t offset) {
-  if (!string)
-    elog("Can't create a new string token with NULL ptr on string");
-  if (*string == '\0')
-    elog("Can't create a new string token with empty string");
-  token *t = (token *)malloc(sizeof(token));
-  if (!t)
-    elog("Error allocation memory for token struct (string token)");
-  t->type = type;
-  t->line = line;
-  t->offset = offset;
-  t->value.string = string;
-  return t;
-}
+#define NUMBER_BUFFER_SIZE 64
+#define TOKEN_BYTES                                                            \
+  (sizeof(uint8_t) + sizeof(uint32_t) * 3 + sizeof(token_value))
+
+token_buffer *new_token_buffer(const char *source, size_t capacity) {
+  if (!source)
+    elog("Can't create token buffer with null ptr on source");
+
+  token_buffer *tokens = calloc(1, sizeof(token_buffer));
+  if (!tokens)
+    elog("Error allocation memory for token buffer");
+
+  tokens->source = source;
+  tokens->capacity = capacity ? capacity : 1;
+  STAT_ADD(bytes_allocated, TOKEN_BYTES * tokens->capacity);
+  tokens->types = malloc(sizeof(uint8_t) * tokens->capacity);
+  tokens->lines = malloc(sizeof(uint32_t) * tokens->capacity);
+  tokens->offsets = malloc(sizeof(uint32_t) * tokens->capacity);
+  tokens->lengths = malloc(sizeof(uint32_t) * tokens->capacity);
+  tokens->values = malloc(sizeof(token_value) * tokens->capacity);
+  if (!tokens->types || !tokens->lines || !tokens->offsets ||
+      !tokens->lengths || !tokens->values)
+    elog("Error allocation memory for token buffer arrays");
 
-token *new_number_token(TokenType type, double number, size_t line,
-                        size_t offset) {
-  token *t = (token *)malloc(sizeof(token));
-  if (!t)
-    elog("Error allocation memory for token struct (number token)");
-  t->type = type;
-  t->line = line;
-  t->offset = offset;
-  t->value.number = number;
-  return t;
+  return tokens;
 }
 
-token *new_token(TokenType type, size_t line, size_t offset) {
-  token *t = (token *)malloc(sizeof(token));
-  if (!t)
-    elog("Error allocation memory for token struct (simple token)");
-  t->type = type;
-  t->line = line;
-  t->offset = offset;
-  return t;
+static void grow_token_buffer(token_buffer *tokens) {
+  STAT_ADD(bytes_allocated, TOKEN_BYTES * tokens->capacity);
+  tokens->capacity *= 2;
+  tokens->types = realloc(tokens->types, sizeof(uint8_t) * tokens->capacity);
+  tokens->lines = realloc(tokens->lines, sizeof(uint32_t) * tokens->capacity);
+  tokens->offsets =
+      realloc(tokens->offsets, sizeof(uint32_t) * tokens->capacity);
+  tokens->lengths =
+      realloc(tokens->lengths, sizeof(uint32_t) * tokens->capacity);
+  tokens->values =
+      realloc(tokens->values, sizeof(token_value) * tokens->capacity);
+  if (!tokens->types || !tokens->lines || !tokens->offsets ||
+      !tokens->lengths || !tokens->values)
+    elog("Error allocation memory for token buffer arrays");
 }
 
-void skip(char **str, size_t count) {
-  if (!str || !*str)
-    elog("Can't skip char(s), ptr on string is NULL");
-  size_t str_length = strlen(*str);
-  if (count > str_length)
-    elog("Can't skip more chars than %zu chars, string length is %zu", count,
-         str_length);
-  while (count != 0) {
-    (*str)++;
-    count--;
-  }
+size_t token_buffer_push(token_buffer *tokens, TokenType type, size_t line,
+                         size_t offset, size_t length) {
+  if (tokens->count >= tokens->capacity)
+    grow_token_buffer(tokens);
+
+  size_t index = tokens->count++;
+  tokens->types[index] = (uint8_t)type;
+  tokens->lines[index] = (uint32_t)line;
+  tokens->offsets[index] = (uint32_t)offset;
+  tokens->lengths[index] = (uint32_t)length;
+  tokens->values[index].symbol = NO_SYMBOL;
+  return index;
 }
 
-char *cnext(char *c) {
-  if (!c)
-    elog("Can't check if have next, ptr on string is null");
-  if (*(c + 1) == '\0')
-    return NULL;
-  return c + 1;
+// column is needed only by error messages , so it is found by walking back to
+// line start instead of being stored for every token
+size_t token_column(const token_buffer *tokens, size_t index) {
+  if (index >= tokens->count)
+    elog("Can't get column of token %zu , out of token buffer", index);
+
+  size_t offset = tokens->offsets[index];
+  size_t column = 0;
+  while (column < offset && tokens->source[offset - column - 1] != '\n' &&
+         tokens->source[offset - column - 1] != '\r')
+    column++;
+  return column;
 }
 
-bool is_newline_character(char **c) {
-  if (!c || !(*c))
-    return false;
-  if (*(*c) == '\r') {
-    char *cn = cnext(*c);
-    if (cn && *cn == '\n') {
-      skip(c, 2);
-    } else {
-      skip(c, 1);
-    }
-    return true;
-  }
-  if (*(*c) == '\n') {
-    skip(c, 1);
-    return true;
-  }
-  return false;
+void free_token_buffer(token_buffer *tokens) {
+  if (!tokens)
+    return;
+
+  free(tokens->types);
+  free(tokens->lines);
+  free(tokens->offsets);
+  free(tokens->lengths);
+  free(tokens->values);
+  free(tokens);
 }
 
 bool is_system_symbol(char c) {
-  return c == ')' || c == '(' || c == '{' || c == '}' || c == '+' || c == '-' ||
-         c == '*' || c == '/' || c == '=' || c == ';' || c == '<' || c == '>' ||
-         c == '!' || c == ',' || c == '.';
+  switch (c) {
+  case ')':
+  case '(':
+  case '{':
+  case '}':
+  case '[':
+  case ']':
+  case '+':
+  case '-':
+  case '*':
+  case '/':
+  case '=':
+  case ';':
+  case '<':
+  case '>':
+  case '!':
+  case ',':
+  case '.':
+    return true;
+  default:
+    return false;
+  }
 }
 
-bool is_number(const char *str) {
-  if (!str || !*str)
-    return false;
+static bool is_digit(char c) { return c >= '0' && c <= '9'; }
 
-  bool has_minus = (*str == '-');
-  const char *p = str;
+static bool is_space(char c) { return isspace((unsigned char)c); }
 
-  if (has_minus)
-    p++;
+bool is_number(const char *str, size_t length) {
+  if (!str || length == 0)
+    return false;
 
-  if (!*p)
+  size_t i = str[0] == '-' ? 1 : 0;
+  if (i == length)
     return false;
 
   bool has_decimal = false;
-
-  while (*p) {
-    if (isdigit(*p)) {
-      p++;
-    } else if (*p == '.' && !has_decimal) {
+  for (; i < length; i++) {
+    if (is_digit(str[i]))
+      continue;
+    if (str[i] == '.' && !has_decimal) {
       has_decimal = true;
-      p++;
-    } else {
-      return false;
+      continue;
     }
+    return false;
   }
   return true;
 }
 
-bool is_keyword(const char *str, const char *keyword) {
-  return strcmp(str, keyword) == 0;
+static bool is_word(const char *str, size_t length, const char *word) {
+  return memcmp(str, word, length) == 0;
 }
 
-TokenType get_token_type(const char *str) {
-  if (!str || !*str)
+// keywords and operators are told apart by length and first char , so each
+// lexeme costs at most one memcmp
+TokenType get_token_type(const char *str, size_t length) {
+  if (!str || length == 0)
     return TOKEN_EOF;
 
-  if (is_number(str)) {
+  if (is_number(str, length))
     return TOKEN_NUMBER;
-  }
-
-  if (is_keyword(str, "if"))
-    return TOKEN_IF;
-  if (is_keyword(str, "else"))
-    return TOKEN_ELSE;
-  if (is_keyword(str, "print"))
-    return TOKEN_PRINT;
-  if (is_keyword(str, "loop"))
-    return TOKEN_LOOP;
-  if (is_keyword(str, "next"))
-    return TOKEN_LOOP_NEXT;
-  if (is_keyword(str, "stop"))
-    return TOKEN_LOOP_STOP;
-  if (is_keyword(str, "const"))
-    return TOKEN_CONST;
-  if (is_keyword(str, "fn"))
-    return TOKEN_FN;
-  if (is_keyword(str, "return"))
-    return TOKEN_RETURN;
-  if (is_keyword(str, "->"))
-    return TOKEN_ARROW;
-  if (is_keyword(str, ","))
-    return TOKEN_COMMA;
-
-  if (is_keyword(str, "+"))
-    return TOKEN_PLUS;
-  if (is_keyword(str, "-"))
-    return TOKEN_MINUS;
-  if (is_keyword(str, "*"))
-    return TOKEN_MULTIPLY;
-  if (is_keyword(str, "/"))
-    return TOKEN_DIVIDE;
-  if (is_keyword(str, "="))
-    return TOKEN_ASSIGN;
-  if (is_keyword(str, "("))
-    return TOKEN_LPAREN;
-  if (is_keyword(str, ")"))
-    return TOKEN_RPAREN;
-  if (is_keyword(str, "{"))
-    return TOKEN_LBRACE;
-  if (is_keyword(str, "}"))
-    return TOKEN_RBRACE;
-  if (is_keyword(str, ";"))
-    return TOKEN_SEMICOLON;
-  if (is_keyword(str, ">"))
-    return TOKEN_GT;
-  if (is_keyword(str, "<"))
-    return TOKEN_LT;
-
-  if (is_keyword(str, "=="))
-    return TOKEN_EQ;
-  if (is_keyword(str, "<="))
-    return TOKEN_LE;
-  if (is_keyword(str, ">="))
-    return TOKEN_GE;
-  if (is_keyword(str, "!="))
-    return TOKEN_NE;
-
-  return TOKEN_IDENTIFIER;
-}
 
-char *extract_word(const char *str, size_t *length) {
-  if (!str)
-    return NULL;
-  *length = 0;
-  bool is_ssymbol = is_system_symbol(*str);
-  bool potential_negative_number =
-      (*str == '-' && (isdigit(*(str + 1)) || *(str + 1) == '.'));
-  bool potential_decimal_point = (*str == '.' && isdigit(*(str + 1)));
-
-  if (is_ssymbol && !potential_negative_number && !potential_decimal_point) {
-    if ((*str == '=' && *(str + 1) == '=') ||
-        (*str == '<' && *(str + 1) == '=') ||
-        (*str == '>' && *(str + 1) == '=') ||
-        (*str == '!' && *(str + 1) == '=') ||
-        (*str == '-' && *(str + 1) == '>')) {
-      *length = 2;
-    } else {
-      *length = 1;
+  switch (length) {
+  case 1:
+    switch (str[0]) {
+    case '+':
+      return TOKEN_PLUS;
+    case '-':
+      return TOKEN_MINUS;
+    case '*':
+      return TOKEN_MULTIPLY;
+    case '/':
+      return TOKEN_DIVIDE;
+    case '=':
+      return TOKEN_ASSIGN;
+    case '(':
+      return TOKEN_LPAREN;
+    case ')':
+      return TOKEN_RPAREN;
+    case '{':
+      return TOKEN_LBRACE;
+    case '}':
+      return TOKEN_RBRACE;
+    case '[':
+      return TOKEN_LBRACKET;
+    case ']':
+      return TOKEN_RBRACKET;
+    case ';':
+      return TOKEN_SEMICOLON;
+    case '>':
+      return TOKEN_GT;
+    case '<':
+      return TOKEN_LT;
+    case ',':
+      return TOKEN_COMMA;
     }
-  } else {
-    bool is_potential_number =
-        isdigit(*str) || potential_negative_number || potential_decimal_point;
-    while (str[*length] && !isspace(str[*length])) {
-      if (is_system_symbol(str[*length])) {
-        if (is_potential_number && str[*length] == '.' && str[*length + 1] &&
-            isdigit(str[*length + 1])) {
-          (*length)++;
-          continue;
-        }
-        if (*length == 0 && potential_negative_number) {
-          (*length)++;
-          continue;
-        }
-        break;
+    break;
+  case 2:
+    if (str[1] == '=') {
+      switch (str[0]) {
+      case '=':
+        return TOKEN_EQ;
+      case '<':
+        return TOKEN_LE;
+      case '>':
+        return TOKEN_GE;
+      case '!':
+        return TOKEN_NE;
       }
-      (*length)++;
     }
+    if (is_word(str, length, "->"))
+      return TOKEN_ARROW;
+    if (is_word(str, length, ".."))
+      return TOKEN_RANGE;
+    if (is_word(str, length, "if"))
+      return TOKEN_IF;
+    if (is_word(str, length, "fn"))
+      return TOKEN_FN;
+    break;
+  case 4:
+    switch (str[0]) {
+    case 'e':
+      return is_word(str, length, "else") ? TOKEN_ELSE : TOKEN_IDENTIFIER;
+    case 'l':
+      return is_word(str, length, "loop") ? TOKEN_LOOP : TOKEN_IDENTIFIER;
+    case 'n':
+      return is_word(str, length, "next") ? TOKEN_LOOP_NEXT : TOKEN_IDENTIFIER;
+    case 'p':
+      return is_word(str, length, "pure") ? TOKEN_PURE : TOKEN_IDENTIFIER;
+    case 's':
+      return is_word(str, length, "stop") ? TOKEN_LOOP_STOP : TOKEN_IDENTIFIER;
+    }
+    break;
+  case 5:
+    switch (str[0]) {
+    case 'p':
+      if (is_word(str, length, "print"))
+        return TOKEN_PRINT;
+      return is_word(str, length, "ploop") ? TOKEN_PLOOP : TOKEN_IDENTIFIER;
+    case 'c':
+      return is_word(str, length, "const") ? TOKEN_CONST : TOKEN_IDENTIFIER;
+    }
+    break;
+  case 6:
+    if (is_word(str, length, "return"))
+      return TOKEN_RETURN;
+    break;
   }
 
-  char *result = (char *)malloc(*length + 1);
-  if (!result) {
-    return NULL;
-  }
-  for (size_t i = 0; i < *length; i++) {
-    result[i] = str[i];
-  }
-  result[*length] = '\0';
-  return result;
+  return TOKEN_IDENTIFIER;
 }
 
-void handle_comment(char **code, size_t *line) {
-  if (**code == '/' && *(*code + 1) == '/') {
-    while (**code && **code != '\n' && **code != '\r') {
-      (*code)++;
-    }
+// length of lexeme starting at str , numbers may start with '-' or '.' and
+// keep '.' followed by digit , other words stop on any system symbol
+static size_t scan_word(const char *str) {
+  bool potential_negative_number =
+      (str[0] == '-' && (is_digit(str[1]) || str[1] == '.'));
+  bool potential_decimal_point = (str[0] == '.' && is_digit(str[1]));
+
+  if (is_system_symbol(str[0]) && !potential_negative_number &&
+      !potential_decimal_point) {
+    if ((str[1] == '=' &&
+         (str[0] == '=' || str[0] == '<' || str[0] == '>' || str[0] == '!')) ||
+        (str[0] == '-' && str[1] == '>') || (str[0] == '.' && str[1] == '.'))
+      return 2;
+    return 1;
+  }
 
-    if (**code == '\n' || **code == '\r') {
-      is_newline_character(code);
-      (*line)++;
+  bool is_potential_number =
+      is_digit(str[0]) || potential_negative_number || potential_decimal_point;
+  size_t length = 0;
+  while (str[length] && !is_space(str[length])) {
+    if (is_system_symbol(str[length])) {
+      if (is_potential_number && str[length] == '.' &&
+          is_digit(str[length + 1])) {
+        length++;
+        continue;
+      }
+      if (length == 0 && potential_negative_number) {
+        length++;
+        continue;
+      }
+      break;
     }
+    length++;
   }
+  return length;
 }
 
-arr_t *parse(char *code) {
+// buffer is nul terminated , so strtod reads in place and lexeme is copied
+// only when strtod would run past its end (like "1.e5" split by scanner)
+static double scan_number(const char *str, size_t length) {
+  char *end = NULL;
+  double value = strtod(str, &end);
+  if (end == str + length)
+    return value;
+
+  char buffer[NUMBER_BUFFER_SIZE];
+  char *copy = length < NUMBER_BUFFER_SIZE ? buffer : malloc(length + 1);
+  if (!copy)
+    elog("Error allocation memory for number literal");
+  memcpy(copy, str, length);
+  copy[length] = '\0';
+  value = strtod(copy, NULL);
+  if (copy != buffer)
+    free(copy);
+  return value;
+}
+
+// average lexeme with surrounding whitespace is a few chars long , so buffer
+// sized by source length rarely grows
+#define SOURCE_CHARS_PER_TOKEN 4
+
+// code must be nul terminated , 'code_length' only presizes token buffer
+token_buffer *parse(const char *code, size_t code_length) {
   if (!code || *code == '\0')
     elog("Can't parse empty code file");
 
-  arr_t *tokens = arr_create(1);
+  if (code_length >= UINT32_MAX)
+    elog("Can't parse code file , it is larger than 4GB");
+
+  token_buffer *tokens =
+      new_token_buffer(code, code_length / SOURCE_CHARS_PER_TOKEN + 16);
+  const char *cursor = code;
   size_t line = 1;
-  size_t offset = 0;
-
-  while (*code != '\0') {
-    if (isspace(*code)) {
-      if (is_newline_character(&code)) {
-        line++;
-        offset = 0;
-      } else {
-        code++;
-        offset++;
-      }
+
+  while (*cursor != '\0') {
+    char c = *cursor;
+
+    if (c == '\n' || c == '\r') {
+      cursor += (c == '\r' && cursor[1] == '\n') ? 2 : 1;
+      line++;
       continue;
     }
 
-    if (*code == '/' && *(code + 1) == '/') {
-      handle_comment(&code, &line);
+    if (is_space(c)) {
+      cursor++;
       continue;
     }
 
-    size_t len = 0;
-    char *stoken = extract_word(code, &len);
-
-    if (!stoken || len == 0) {
-      code++;
-      offset++;
+    if (c == '/' && cursor[1] == '/') {
+      while (*cursor && *cursor != '\n' && *cursor != '\r')
+        cursor++;
       continue;
     }
 
-    TokenType type = get_token_type(stoken);
-    token *t;
-
-    if (type == TOKEN_NUMBER) {
-      double value = atof(stoken);
-      free(stoken);
-      t = new_number_token(type, value, line, offset);
-    } else {
-      t = new_string_token(type, stoken, line, offset);
+    size_t length = scan_word(cursor);
+    if (length == 0) {
+      cursor++;
+      continue;
     }
 
-    arr_push(tokens, t);
-    skip(&code, len);
-    offset += len;
-  }
+    TokenType type = get_token_type(cursor, length);
+    size_t index =
+        token_buffer_push(tokens, type, line, cursor - code, length);
+    if (type == TOKEN_NUMBER)
+      tokens->values[index].number = scan_number(cursor, length);
+    else if (type == TOKEN_IDENTIFIER)
+      tokens->values[index].symbol = intern(cursor, length);
 
-  token *eof_token = new_token(TOKEN_EOF, line, offset);
-  arr_push(tokens, eof_token);
+    cursor += length;
+  }
 
+  token_buffer_push(tokens, TOKEN_EOF, line, cursor - code, 0);
+  STAT_ADD(tokens, tokens->count);
   return tokens;
 }
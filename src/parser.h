@@ -1,7 +1,10 @@
 #ifndef PARSER_H
 #define PARSER_H
+#include "arena.h"
 #include "arr.h"
+#include "symbol.h"
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef enum {
     TOKEN_EOF = 0,     // Конец файла
@@ -34,31 +37,42 @@ typedef enum {
     TOKEN_RETURN,     // Ключевое слово return
     TOKEN_ARROW,      // Стрелка ->
     TOKEN_COMMA,      // Запятая для разделения параметров
+    TOKEN_PURE,       // Ключевое слово pure
+    TOKEN_RANGE,      // Диапазон ..
+    TOKEN_PLOOP,      // Ключевое слово ploop
+    TOKEN_LBRACKET,   // Левая квадратная скобка [
+    TOKEN_RBRACKET,   // Правая квадратная скобка ]
 } TokenType;
 
-typedef struct token {
-    TokenType type;
-    size_t line;
-    size_t offset;
-    union {
-        double number;
-        char* string;
-    } value;
-} token;
+typedef union token_value {
+    double number;
+    symbol_t symbol;
+} token_value;
 
-token *new_string_token(TokenType type, char* string, size_t line, size_t offset);
-token *new_number_token(TokenType type, double number, size_t line, size_t offset);
-token *new_token(TokenType type, size_t line , size_t offset);
+#define NO_TOKEN SIZE_MAX
 
-arr_t *parse(char* code);
-void skip(char **str, size_t count);
-char *cnext(char *c);
-bool is_newline_character(char **c);
+// Tokens of one source , stored as parallel arrays indexed by token number ,
+// each token is a view (offset , length) into 'source'
+typedef struct token_buffer {
+    const char *source;
+    uint8_t *types;
+    uint32_t *lines;
+    uint32_t *offsets;
+    uint32_t *lengths;
+    token_value *values;
+    size_t count;
+    size_t capacity;
+} token_buffer;
+
+token_buffer *new_token_buffer(const char *source, size_t capacity);
+size_t token_buffer_push(token_buffer *tokens, TokenType type, size_t line,
+                         size_t offset, size_t length);
+size_t token_column(const token_buffer *tokens, size_t index);
+void free_token_buffer(token_buffer *tokens);
+
+token_buffer *parse(const char *code, size_t code_length);
 bool is_system_symbol(char c);
-char *extract_word(const char *str, size_t *length);
-bool is_number(const char *str);
-bool is_keyword(const char *str, const char *keyword);
-TokenType get_token_type(const char *str);
-void handle_comment(char **code, size_t *line);
+bool is_number(const char *str, size_t length);
+TokenType get_token_type(const char *str, size_t length);
 
 #endif // PARSER_H
@@ -0,0 +1,66 @@
+#include "ploop.h"
+#include "array.h"
+#include "logger.h"
+#include <math.h>
+#include <stdint.h>
+
+double reduce_identity(reduce_op op) {
+  switch (op) {
+  case REDUCE_ADD:
+    return 0.0;
+  case REDUCE_MUL:
+    return 1.0;
+  case REDUCE_MIN:
+    return INFINITY;
+  case REDUCE_MAX:
+    return -INFINITY;
+  }
+  return 0.0;
+}
+
+double reduce_combine(reduce_op op, double one, double two) {
+  if (isunordered(one, two))
+    check_operands(one, two);
+
+  switch (op) {
+  case REDUCE_ADD:
+    return one + two;
+  case REDUCE_MUL:
+    return one * two;
+  case REDUCE_MIN:
+    return two < one ? two : one;
+  case REDUCE_MAX:
+    return two > one ? two : one;
+  }
+  return one;
+}
+
+const char *reduce_op_to_str(reduce_op op) {
+  switch (op) {
+  case REDUCE_ADD:
+    return "+";
+  case REDUCE_MUL:
+    return "*";
+  case REDUCE_MIN:
+    return "min";
+  case REDUCE_MAX:
+    return "max";
+  }
+  return "?";
+}
+
+size_t ploop_chunks(double trips) {
+  if (trips > PLOOP_MAX_TRIPS)
+    elog("Too many trips in ploop , at most %.0f are allowed",
+         PLOOP_MAX_TRIPS);
+  return trips < PLOOP_CHUNKS ? (size_t)trips : PLOOP_CHUNKS;
+}
+
+void ploop_chunk(double trips, size_t chunks, size_t index, double *first,
+                 double *count) {
+  uint64_t total = (uint64_t)trips;
+  uint64_t begin = total * index / chunks;
+  uint64_t end = total * (index + 1) / chunks;
+  *first = (double)begin;
+  *count = (double)(end - begin);
+}
@@ -0,0 +1,30 @@
+#ifndef PLOOP_H
+#define PLOOP_H
+
+#include <stddef.h>
+
+// Parallel loop splits its trips into chunks whose count depends only on
+// trips , every chunk starts from the same copy of variables and reductions
+// are merged in chunk order , so result is the same for any number of threads
+// and for the serial tree walker
+#define PLOOP_CHUNKS 256
+// trips are counted exactly while they fit mantissa
+#define PLOOP_MAX_TRIPS 4503599627370496.0
+
+typedef enum reduce_op {
+  REDUCE_ADD,
+  REDUCE_MUL,
+  REDUCE_MIN,
+  REDUCE_MAX,
+} reduce_op;
+
+double reduce_identity(reduce_op op);
+double reduce_combine(reduce_op op, double one, double two);
+const char *reduce_op_to_str(reduce_op op);
+
+size_t ploop_chunks(double trips);
+// first trip and number of trips of chunk 'index' of 'chunks'
+void ploop_chunk(double trips, size_t chunks, size_t index, double *first,
+                 double *count);
+
+#endif
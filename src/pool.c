@@ -0,0 +1,213 @@
+#include "pool.h"
+#include "logger.h"
+#include "stats.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define POOL_CACHE_LINE 64
+
+// tasks [next , end) not taken yet , every queue has own cache line
+typedef struct {
+  pthread_mutex_t lock;
+  size_t next;
+  size_t end;
+} __attribute__((aligned(POOL_CACHE_LINE))) pool_queue;
+
+// workers wait for 'job' to change , last one to finish signals 'done'
+typedef struct {
+  size_t thread_count;
+  size_t worker_count;
+  pthread_t *threads;
+  pool_queue *queues;
+
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  uint64_t job;
+  size_t busy;
+  bool running;
+  bool stopping;
+  pool_task task;
+  void *context;
+  // counters of pool threads made by current job
+  stats_t stats;
+} pool_t;
+
+static pool_t pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+void set_pool_threads(size_t count) {
+  if (pool.worker_count)
+    elog("Can't change number of pool threads after pool started");
+  pool.thread_count = count;
+}
+
+size_t pool_threads(void) {
+  if (pool.worker_count)
+    return pool.worker_count;
+  if (pool.thread_count)
+    return pool.thread_count;
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 0 ? (size_t)cpus : 1;
+}
+
+static bool take_task(pool_queue *queue, size_t *task) {
+  pthread_mutex_lock(&queue->lock);
+  bool taken = queue->next < queue->end;
+  if (taken)
+    *task = queue->next++;
+  pthread_mutex_unlock(&queue->lock);
+  return taken;
+}
+
+// back half of range of the first worker which still has tasks becomes range
+// of thief , false when every range is empty
+static bool steal_tasks(size_t thief) {
+  for (size_t i = 1; i < pool.worker_count; i++) {
+    pool_queue *victim = &pool.queues[(thief + i) % pool.worker_count];
+
+    pthread_mutex_lock(&victim->lock);
+    size_t taken = (victim->end - victim->next + 1) / 2;
+    victim->end -= taken;
+    size_t first = victim->end;
+    pthread_mutex_unlock(&victim->lock);
+
+    if (taken) {
+      pool_queue *own = &pool.queues[thief];
+      pthread_mutex_lock(&own->lock);
+      own->next = first;
+      own->end = first + taken;
+      pthread_mutex_unlock(&own->lock);
+      return true;
+    }
+  }
+  return false;
+}
+
+static void work(size_t worker) {
+  size_t task;
+  for (;;) {
+    if (take_task(&pool.queues[worker], &task))
+      pool.task(pool.context, worker, task);
+    else if (!steal_tasks(worker))
+      return;
+  }
+}
+
+// workers are started before the first job , so they wait for job 1
+static void *worker_main(void *arg) {
+  size_t worker = (size_t)(uintptr_t)arg;
+  uint64_t seen = 0;
+
+  pthread_mutex_lock(&pool.lock);
+  for (;;) {
+    while (pool.job == seen && !pool.stopping)
+      pthread_cond_wait(&pool.start, &pool.lock);
+    if (pool.stopping)
+      break;
+    seen = pool.job;
+    pthread_mutex_unlock(&pool.lock);
+
+    work(worker);
+
+    pthread_mutex_lock(&pool.lock);
+    stats_move(&pool.stats);
+    if (--pool.busy == 0)
+      pthread_cond_signal(&pool.done);
+  }
+  pthread_mutex_unlock(&pool.lock);
+  return NULL;
+}
+
+// workers run vm code , native calls nest on their C stack like on stack of
+// main thread , so they get the same size as its usual default
+#define POOL_STACK_BYTES (8 * 1024 * 1024)
+
+static void start_workers(void) {
+  size_t count = pool_threads();
+
+  pool.queues = aligned_alloc(POOL_CACHE_LINE, sizeof(pool_queue) * count);
+  pool.threads = malloc(sizeof(pthread_t) * count);
+  if (!pool.queues || !pool.threads)
+    elog("Error allocation memory for thread pool");
+  for (size_t i = 0; i < count; i++) {
+    pthread_mutex_init(&pool.queues[i].lock, NULL);
+    pool.queues[i].next = pool.queues[i].end = 0;
+  }
+
+  pthread_attr_t attr;
+  if (pthread_attr_init(&attr) != 0 ||
+      pthread_attr_setstacksize(&attr, POOL_STACK_BYTES) != 0)
+    elog("Can't set stack of pool threads");
+  for (size_t i = 1; i < count; i++) {
+    if (pthread_create(&pool.threads[i], &attr, worker_main,
+                       (void *)(uintptr_t)i) != 0)
+      elog("Can't start pool thread %zu of %zu", i, count);
+  }
+  pthread_attr_destroy(&attr);
+  pool.worker_count = count;
+}
+
+void pool_run(size_t task_count, pool_task task, void *context) {
+  if (!task)
+    elog("Can't run pool job without task");
+  if (pool.running)
+    elog("Pool jobs can't be nested");
+  if (!pool.worker_count)
+    start_workers();
+
+  size_t workers = pool.worker_count;
+  for (size_t i = 0; i < workers; i++) {
+    pool.queues[i].next = task_count * i / workers;
+    pool.queues[i].end = task_count * (i + 1) / workers;
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  pool.task = task;
+  pool.context = context;
+  pool.busy = workers - 1;
+  pool.running = true;
+  pool.job++;
+  pthread_cond_broadcast(&pool.start);
+  pthread_mutex_unlock(&pool.lock);
+
+  work(0);
+
+  pthread_mutex_lock(&pool.lock);
+  while (pool.busy)
+    pthread_cond_wait(&pool.done, &pool.lock);
+  pool.running = false;
+  stats_absorb(&pool.stats);
+  pool.stats = (stats_t){0};
+  pthread_mutex_unlock(&pool.lock);
+}
+
+void free_pool(void) {
+  if (!pool.worker_count)
+    return;
+
+  pthread_mutex_lock(&pool.lock);
+  pool.stopping = true;
+  pthread_cond_broadcast(&pool.start);
+  pthread_mutex_unlock(&pool.lock);
+
+  for (size_t i = 1; i < pool.worker_count; i++)
+    pthread_join(pool.threads[i], NULL);
+  for (size_t i = 0; i < pool.worker_count; i++)
+    pthread_mutex_destroy(&pool.queues[i].lock);
+
+  free(pool.threads);
+  free(pool.queues);
+  pool.threads = NULL;
+  pool.queues = NULL;
+  pool.worker_count = 0;
+  pool.stopping = false;
+  pool.job = 0;
+}
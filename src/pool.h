@@ -0,0 +1,21 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// Work stealing pool of threads , tasks of job are split to equal ranges ,
+// one per thread , thread takes tasks from front of its own range and when
+// it runs out steals back half of range of other thread. Thread calling
+// pool_run is worker 0 and runs tasks too , other workers are started on
+// first job and live until free_pool.
+typedef void (*pool_task)(void *context, size_t worker, size_t task);
+
+// 0 means one thread per online cpu
+void set_pool_threads(size_t count);
+size_t pool_threads(void);
+
+// returns when every task ran , jobs can't be nested
+void pool_run(size_t task_count, pool_task task, void *context);
+void free_pool(void);
+
+#endif
@@ -0,0 +1,253 @@
+#include "profile.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+volatile sig_atomic_t profile_tick = 0;
+
+// samples are stored one after another as
+// [frame count , function , line , function , line , ...]
+typedef struct {
+  uint32_t *data;
+  size_t count;
+  size_t capacity;
+  size_t samples;
+  size_t current;
+  bool active;
+} profile_t;
+
+static profile_t profile = {0};
+
+static void on_profile_timer(int signal) {
+  (void)signal;
+  profile_tick = 1;
+}
+
+static void set_timer(long interval_us) {
+  struct itimerval timer = {
+      .it_interval = {.tv_sec = 0, .tv_usec = interval_us},
+      .it_value = {.tv_sec = 0, .tv_usec = interval_us},
+  };
+  if (setitimer(ITIMER_PROF, &timer, NULL) != 0)
+    elog("Can't set profiler timer");
+}
+
+void profile_start(void) {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_profile_timer;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, NULL) != 0)
+    elog("Can't install profiler signal handler");
+
+  profile.active = true;
+  profile_tick = 0;
+  set_timer(PROFILE_INTERVAL_US);
+}
+
+void profile_stop(void) {
+  if (!profile.active)
+    return;
+
+  set_timer(0);
+  signal(SIGPROF, SIG_IGN);
+  profile.active = false;
+  profile_tick = 0;
+}
+
+bool profile_active(void) { return profile.active; }
+
+static void push_word(uint32_t word) {
+  if (profile.count >= profile.capacity) {
+    profile.capacity = profile.capacity ? profile.capacity * 2 : 1024;
+    profile.data = realloc(profile.data, sizeof(uint32_t) * profile.capacity);
+    if (!profile.data)
+      elog("Error allocation memory for profile samples");
+  }
+  profile.data[profile.count++] = word;
+}
+
+void profile_sample_begin(void) {
+  profile.current = profile.count;
+  push_word(0);
+}
+
+void profile_sample_frame(symbol_t function, uint32_t line) {
+  push_word(function);
+  push_word(line);
+  profile.data[profile.current]++;
+}
+
+void profile_sample_end(void) { profile.samples++; }
+
+size_t profile_sample_count(void) { return profile.samples; }
+
+typedef struct {
+  uint64_t key;
+  size_t count;
+} profile_entry;
+
+static int compare_entry_count(const void *a, const void *b) {
+  const profile_entry *x = a;
+  const profile_entry *y = b;
+  if (x->count != y->count)
+    return x->count < y->count ? 1 : -1;
+  return (x->key > y->key) - (x->key < y->key);
+}
+
+static int compare_key(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// counts equal keys , result is sorted from most frequent
+static profile_entry *count_keys(uint64_t *keys, size_t count,
+                                 size_t *entry_count) {
+  qsort(keys, count, sizeof(uint64_t), compare_key);
+
+  profile_entry *entries = malloc(sizeof(profile_entry) * (count ? count : 1));
+  if (!entries)
+    elog("Error allocation memory for profile report");
+
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (n > 0 && entries[n - 1].key == keys[i])
+      entries[n - 1].count++;
+    else
+      entries[n++] = (profile_entry){.key = keys[i], .count = 1};
+  }
+
+  qsort(entries, n, sizeof(profile_entry), compare_entry_count);
+  *entry_count = n;
+  return entries;
+}
+
+#define LINE_KEY(function, line) (((uint64_t)(function) << 32) | (line))
+
+// self is counted by innermost frame , total once per sample for every
+// function on stack , recursion is deduplicated by stamps
+void profile_print_flat(FILE *out) {
+  size_t samples = profile.samples;
+  fprintf(out, "Flat profile , %zu samples every %d us\n", samples,
+          PROFILE_INTERVAL_US);
+  if (samples == 0)
+    return;
+
+  size_t symbols = symbol_count();
+  size_t *selfs = calloc(symbols, sizeof(size_t));
+  size_t *totals = calloc(symbols, sizeof(size_t));
+  size_t *stamps = calloc(symbols, sizeof(size_t));
+  uint64_t *self_lines = malloc(sizeof(uint64_t) * samples);
+  if (!selfs || !totals || !stamps || !self_lines)
+    elog("Error allocation memory for profile report");
+
+  size_t at = 0;
+  for (size_t i = 0; i < samples; i++) {
+    uint32_t depth = profile.data[at];
+    uint32_t *frames = profile.data + at + 1;
+
+    for (uint32_t f = 0; f < depth; f++) {
+      symbol_t function = frames[f * 2];
+      if (stamps[function] != i + 1) {
+        stamps[function] = i + 1;
+        totals[function]++;
+      }
+    }
+
+    symbol_t leaf = frames[(depth - 1) * 2];
+    selfs[leaf]++;
+    self_lines[i] = LINE_KEY(leaf, frames[(depth - 1) * 2 + 1]);
+    at += 1 + depth * 2;
+  }
+
+  size_t count = 0;
+  profile_entry *functions = malloc(sizeof(profile_entry) * symbols);
+  if (!functions)
+    elog("Error allocation memory for profile report");
+  for (size_t i = 0; i < symbols; i++)
+    if (totals[i])
+      functions[count++] = (profile_entry){.key = i, .count = selfs[i]};
+  qsort(functions, count, sizeof(profile_entry), compare_entry_count);
+
+  fprintf(out, "%7s %8s %7s %8s  %s\n", "self%", "self", "total%", "total",
+          "function");
+  for (size_t i = 0; i < count; i++) {
+    symbol_t function = (symbol_t)functions[i].key;
+    fprintf(out, "%6.2f%% %8zu %6.2f%% %8zu  %s\n",
+            100.0 * selfs[function] / samples, selfs[function],
+            100.0 * totals[function] / samples, totals[function],
+            symbol_name(function));
+  }
+  free(functions);
+
+  profile_entry *lines = count_keys(self_lines, samples, &count);
+  fprintf(out, "\n%7s %8s  %s\n", "self%", "self", "function:line");
+  for (size_t i = 0; i < count; i++)
+    fprintf(out, "%6.2f%% %8zu  %s:%u\n", 100.0 * lines[i].count / samples,
+            lines[i].count, symbol_name((symbol_t)(lines[i].key >> 32)),
+            (uint32_t)lines[i].key);
+  free(lines);
+
+  free(self_lines);
+  free(stamps);
+  free(totals);
+  free(selfs);
+}
+
+static int compare_sample(const void *a, const void *b) {
+  const uint32_t *x = *(const uint32_t *const *)a;
+  const uint32_t *y = *(const uint32_t *const *)b;
+  uint32_t length = x[0] < y[0] ? x[0] : y[0];
+  int order = memcmp(x + 1, y + 1, sizeof(uint32_t) * length * 2);
+  if (order != 0)
+    return order;
+  return (x[0] > y[0]) - (x[0] < y[0]);
+}
+
+static bool same_sample(const uint32_t *x, const uint32_t *y) {
+  return x[0] == y[0] &&
+         memcmp(x + 1, y + 1, sizeof(uint32_t) * x[0] * 2) == 0;
+}
+
+// one line per distinct stack , 'main:3;fib:5;fib:6 42' , ready for
+// flamegraph.pl and similar tools
+void profile_write_folded(FILE *out) {
+  size_t samples = profile.samples;
+  if (samples == 0)
+    return;
+
+  uint32_t **stacks = malloc(sizeof(uint32_t *) * samples);
+  if (!stacks)
+    elog("Error allocation memory for folded stacks");
+
+  size_t at = 0;
+  for (size_t i = 0; i < samples; i++) {
+    stacks[i] = profile.data + at;
+    at += 1 + profile.data[at] * 2;
+  }
+  qsort(stacks, samples, sizeof(uint32_t *), compare_sample);
+
+  for (size_t i = 0; i < samples;) {
+    size_t next = i + 1;
+    while (next < samples && same_sample(stacks[i], stacks[next]))
+      next++;
+
+    uint32_t depth = stacks[i][0];
+    for (uint32_t f = 0; f < depth; f++)
+      fprintf(out, "%s%s:%u", f ? ";" : "",
+              symbol_name(stacks[i][1 + f * 2]), stacks[i][2 + f * 2]);
+    fprintf(out, " %zu\n", next - i);
+    i = next;
+  }
+
+  free(stacks);
+}
+
+void free_profile(void) {
+  profile_stop();
+  free(profile.data);
+  memset(&profile, 0, sizeof(profile));
+}
@@ -0,0 +1,31 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "symbol.h"
+
+// Sampling profiler , cpu timer sets 'profile_tick' and interpreter records
+// its call stack (function and line of every frame) on next instruction
+#define PROFILE_INTERVAL_US 1000
+
+extern volatile sig_atomic_t profile_tick;
+
+void profile_start(void);
+void profile_stop(void);
+bool profile_active(void);
+
+// one sample is frames from outermost to innermost between begin and end
+void profile_sample_begin(void);
+void profile_sample_frame(symbol_t function, uint32_t line);
+void profile_sample_end(void);
+
+size_t profile_sample_count(void);
+void profile_print_flat(FILE *out);
+void profile_write_folded(FILE *out);
+void free_profile(void);
+
+#endif
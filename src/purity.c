@@ -0,0 +1,128 @@
+#include "purity.h"
+#include "logger.h"
+#include "walk.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+// every definition of tree , name maps to its index + 1 in 'functions'
+typedef struct {
+  arr_t *functions;
+  symbol_map indexes;
+  bool *impure;
+} purity;
+
+static void collect_functions(purity *p, ast_node *tree) {
+  walker w;
+  walk_init(&w, tree);
+  walk_step step;
+  while (walk_next(&w, &step)) {
+    ast_node *node = step.node;
+    if (step.leaving)
+      continue;
+
+    if (node->type == NODE_FUNCTION_DEF) {
+      arr_push(p->functions, node);
+      symbol_map_put(&p->indexes, node->data.function_def.name,
+                     (void *)(uintptr_t)p->functions->size);
+    } else if (is_expression(node)) {
+      walk_skip(&w);
+    }
+  }
+  walk_free(&w);
+}
+
+// unknown names fail at run time anyway , they just make caller impure
+static bool is_impure(purity *p, symbol_t name) {
+  size_t index = (size_t)(uintptr_t)symbol_map_get(&p->indexes, name);
+  return index == 0 || p->impure[index - 1];
+}
+
+// body prints , defines function , reads or writes array (its elements
+// change under the same argument) or calls impure one , nested function
+// bodies are scanned on their own
+static bool has_effect(purity *p, ast_node *body) {
+  walker w;
+  walk_init(&w, body);
+  walk_step step;
+  bool effect = false;
+  while (!effect && walk_next(&w, &step)) {
+    ast_node *node = step.node;
+    if (step.leaving)
+      continue;
+
+    switch (node->type) {
+    case NODE_FUNCTION_CALL:
+      effect = is_impure(p, node->data.function_call.name);
+      break;
+    case NODE_PRINT:
+    case NODE_FUNCTION_DEF:
+    case NODE_INDEX:
+    case NODE_INDEX_ASSIGN:
+      effect = true;
+      break;
+    default:
+      break;
+    }
+  }
+  walk_free(&w);
+  return effect;
+}
+
+void mark_pure_functions(ast_node *ast_tree) {
+  if (!ast_tree)
+    elog("Can't mark pure functions of ast tree by null ptr");
+
+  purity p = {.functions = arr_create(8)};
+  if (!p.functions)
+    elog("Error allocation memory for purity analysis");
+  symbol_map_init(&p.indexes);
+  collect_functions(&p, ast_tree);
+
+  size_t count = p.functions->size;
+  p.impure = calloc(count ? count : 1, sizeof(bool));
+  if (!p.impure)
+    elog("Error allocation memory for purity analysis");
+
+  // names defined twice fail at run time , neither definition is trusted
+  for (size_t i = 0; i < count; i++) {
+    ast_node *function = arr_get(p.functions, i);
+    size_t index = (size_t)(uintptr_t)symbol_map_get(
+        &p.indexes, function->data.function_def.name);
+    if (index != i + 1) {
+      p.impure[i] = true;
+      p.impure[index - 1] = true;
+    }
+  }
+
+  // every function starts pure , calls of impure ones spread to callers until
+  // nothing changes , so recursion alone keeps function pure
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 0; i < count; i++) {
+      if (p.impure[i])
+        continue;
+
+      ast_node *function = arr_get(p.functions, i);
+      if (has_effect(&p, function->data.function_def.body)) {
+        p.impure[i] = true;
+        changed = true;
+      }
+    }
+  }
+
+  // functions found pure stay uncached , most are called with new arguments
+  // every time and lookup would only slow their calls down
+  for (size_t i = 0; i < count; i++) {
+    ast_node *function = arr_get(p.functions, i);
+    if (function->data.function_def.pure && p.impure[i])
+      elog("Function '%s' is declared pure but prints , defines functions , "
+           "uses arrays or calls impure ones",
+           symbol_name(function->data.function_def.name));
+    function->data.function_def.memoize = function->data.function_def.pure;
+  }
+
+  free(p.impure);
+  symbol_map_free(&p.indexes);
+  arr_destroy(p.functions);
+}
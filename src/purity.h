@@ -0,0 +1,12 @@
+#ifndef PURITY_H
+#define PURITY_H
+
+#include "lexer.h"
+
+// Marks function definitions declared 'pure fn' , their calls are cached by
+// argument values. Declared function must be pure : never print , define
+// functions , use arrays or call anything but pure functions (builtins work
+// with arrays , so they are not pure) , else it is an error.
+void mark_pure_functions(ast_node *ast_tree);
+
+#endif
@@ -0,0 +1,340 @@
+#include "resolver.h"
+#include "builtin.h"
+#include "logger.h"
+#include "stats.h"
+#include "walk.h"
+#include <stdlib.h>
+#include <string.h>
+
+// slot of symbol is valid only when its generation equals generation of
+// scope being resolved , so maps are shared by all scopes without clearing
+typedef struct {
+  size_t *slots;
+  uint32_t *generations;
+  uint32_t generation;
+  size_t loop_depth;
+  // innermost loop is ploop , 'stop' can't leave it
+  bool in_ploop;
+  // ploops around current statement , 'return' can't leave them
+  size_t ploop_depth;
+  // names of functions defined anywhere in script , they shadow builtins
+  bool *defined;
+  // names of functions which print or define functions , directly or through
+  // calls , ploop can't call them
+  bool *effects;
+  arr_t *functions;
+  arr_t *pending_functions;
+} resolver;
+
+typedef struct {
+  symbol_t owner;
+  bool *is_const;
+  size_t count;
+  size_t capacity;
+} scope;
+
+static size_t scope_find(resolver *r, symbol_t name) {
+  if (r->generations[name] != r->generation)
+    return SIZE_MAX;
+  return r->slots[name];
+}
+
+static size_t scope_declare(resolver *r, scope *s, symbol_t name,
+                            bool is_const) {
+  size_t slot = scope_find(r, name);
+  if (slot != SIZE_MAX) {
+    if (s->is_const[slot])
+      elog("syntax error , try set value to const var %s", symbol_name(name));
+    return slot;
+  }
+
+  if (s->count >= MAX_SLOTS)
+    elog("Too many variables in '%s'", symbol_name(s->owner));
+
+  if (s->count >= s->capacity) {
+    s->capacity = s->capacity ? s->capacity * 2 : 16;
+    s->is_const = realloc(s->is_const, sizeof(bool) * s->capacity);
+    if (!s->is_const)
+      elog("Error allocation memory for resolver scope");
+  }
+
+  r->generations[name] = r->generation;
+  r->slots[name] = s->count;
+  s->is_const[s->count] = is_const;
+  return s->count++;
+}
+
+// first pass , every assigned name of scope gets its slot in order of
+// appearance , nested functions are separate scopes and skipped
+static void declare_assignments(resolver *r, scope *s, ast_node *body) {
+  walker w;
+  walk_init(&w, body);
+  walk_step step;
+  while (walk_next(&w, &step)) {
+    ast_node *node = step.node;
+    if (step.leaving)
+      continue;
+
+    switch (node->type) {
+    case NODE_ASSIGNMENT:
+      node->data.assignment.slot =
+          scope_declare(r, s, node->data.assignment.var_name,
+                        node->data.assignment.is_const);
+      walk_skip(&w);
+      break;
+    case NODE_RANGE_LOOP:
+      node->data.range_loop.slot =
+          scope_declare(r, s, node->data.range_loop.var_name, false);
+      for (size_t i = 0; i < node->data.range_loop.reduction_count; i++) {
+        reduction *reduced = &node->data.range_loop.reductions[i];
+        reduced->slot = scope_declare(r, s, reduced->name, false);
+      }
+      break;
+    case NODE_IF:
+    case NODE_LOOP:
+    case NODE_BLOCK:
+      break;
+    default:
+      walk_skip(&w);
+      break;
+    }
+  }
+  walk_free(&w);
+}
+
+// script may define function after call of it , so definitions are collected
+// before any call is bound
+static void collect_definitions(resolver *r, ast_node *tree) {
+  walker w;
+  walk_init(&w, tree);
+  walk_step step;
+  while (walk_next(&w, &step)) {
+    ast_node *node = step.node;
+    if (step.leaving)
+      continue;
+
+    if (node->type == NODE_FUNCTION_DEF) {
+      r->defined[node->data.function_def.name] = true;
+      arr_push(r->functions, node);
+    } else if (is_expression(node)) {
+      walk_skip(&w);
+    }
+  }
+  walk_free(&w);
+}
+
+static bool has_effect(resolver *r, ast_node *body) {
+  walker w;
+  walk_init(&w, body);
+  walk_step step;
+  bool effect = false;
+  while (!effect && walk_next(&w, &step)) {
+    ast_node *node = step.node;
+    if (step.leaving)
+      continue;
+
+    if (node->type == NODE_PRINT || node->type == NODE_FUNCTION_DEF)
+      effect = true;
+    else if (node->type == NODE_FUNCTION_CALL)
+      effect = r->effects[node->data.function_call.name];
+  }
+  walk_free(&w);
+  return effect;
+}
+
+// ploop workers share functions and output , so nothing run by chunk may
+// print or define function. Effects of callees spread to callers until
+// nothing changes , names defined twice fail at run time anyway.
+static void collect_effects(resolver *r) {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 0; i < r->functions->size; i++) {
+      ast_node *function = arr_get(r->functions, i);
+      symbol_t name = function->data.function_def.name;
+      if (r->effects[name] || !has_effect(r, function->data.function_def.body))
+        continue;
+      r->effects[name] = true;
+      changed = true;
+    }
+  }
+}
+
+static size_t find_variable(resolver *r, symbol_t name) {
+  size_t slot = scope_find(r, name);
+  if (slot == SIZE_MAX)
+    elog("Variable '%s' not found", symbol_name(name));
+  STAT_INC(variable_lookups);
+  return slot;
+}
+
+static void bind_call(resolver *r, ast_node *node) {
+  symbol_t name = node->data.function_call.name;
+  if (r->ploop_depth && r->effects[name])
+    elog("Syntax error : function '%s' prints or defines functions , it "
+         "can't be called inside of ploop",
+         symbol_name(name));
+  const builtin *native = r->defined[name] ? NULL : find_builtin(name);
+  if (native &&
+      native->param_count != node->data.function_call.arguments.count)
+    elog("Function '%s' called with wrong number of arguments",
+         symbol_name(name));
+  node->data.function_call.builtin = native;
+}
+
+static bool is_loop_body(ast_node *node, ast_node *parent) {
+  if (!parent)
+    return false;
+  if (parent->type == NODE_LOOP)
+    return node == parent->data.loop.loop_body;
+  return parent->type == NODE_RANGE_LOOP &&
+         node == parent->data.range_loop.loop_body;
+}
+
+// second pass , binds every read to the slot and checks that 'stop' and 'next'
+// are inside of loop , nested functions are queued and resolved after current
+// scope. Loop state changes when its body is entered and is back when loop is
+// left , condition and bounds belong to enclosing loop.
+static void bind_reads(resolver *r, ast_node *body) {
+  walker w;
+  walk_init(&w, body);
+  walk_step step;
+  while (walk_next(&w, &step)) {
+    ast_node *node = step.node;
+
+    if (step.leaving) {
+      if (node->type == NODE_RANGE_LOOP) {
+        for (size_t i = 0; i < node->data.range_loop.guard_count; i++) {
+          range_guard *guard = &node->data.range_loop.guards[i];
+          guard->slot = find_variable(r, guard->name);
+        }
+        r->ploop_depth -= node->data.range_loop.parallel;
+      }
+      if (node->type == NODE_LOOP || node->type == NODE_RANGE_LOOP) {
+        r->in_ploop = step.kept;
+        r->loop_depth--;
+      }
+      continue;
+    }
+
+    if (is_loop_body(node, step.parent)) {
+      bool parallel = step.parent->type == NODE_RANGE_LOOP &&
+                      step.parent->data.range_loop.parallel;
+      r->loop_depth++;
+      r->in_ploop = parallel;
+      r->ploop_depth += parallel;
+    }
+
+    switch (node->type) {
+    case NODE_VARIABLE:
+      node->data.var.slot = find_variable(r, node->data.var.var_name);
+      break;
+    case NODE_INDEX:
+    case NODE_INDEX_ASSIGN:
+      node->data.element.slot = find_variable(r, node->data.element.name);
+      break;
+    case NODE_LOOP:
+    case NODE_RANGE_LOOP:
+      walk_keep(&w, r->in_ploop);
+      break;
+    case NODE_LOOP_STOP:
+      if (r->loop_depth == 0)
+        elog("Syntax error : 'stop' outside of loop");
+      if (r->in_ploop)
+        elog("Syntax error : 'stop' can't leave ploop");
+      break;
+    case NODE_LOOP_NEXT:
+      if (r->loop_depth == 0)
+        elog("Syntax error : 'next' outside of loop");
+      break;
+    case NODE_FUNCTION_CALL:
+      bind_call(r, node);
+      break;
+    case NODE_RETURN:
+      if (r->ploop_depth)
+        elog("Syntax error : 'return' can't leave ploop");
+      break;
+    case NODE_PRINT:
+      if (r->ploop_depth)
+        elog("Syntax error : 'print' inside of ploop , its iterations run in "
+             "no order");
+      break;
+    case NODE_FUNCTION_DEF:
+      if (r->ploop_depth)
+        elog("Syntax error : function '%s' can't be defined inside of ploop",
+             symbol_name(node->data.function_def.name));
+      arr_push(r->pending_functions, node);
+      walk_skip(&w);
+      break;
+    default:
+      break;
+    }
+  }
+  walk_free(&w);
+}
+
+static size_t resolve_scope(resolver *r, scope *s, ast_node *body) {
+  declare_assignments(r, s, body);
+  bind_reads(r, body);
+
+  size_t count = s->count;
+  free(s->is_const);
+  return count;
+}
+
+static void resolve_function(resolver *r, ast_node *node) {
+  r->generation++;
+  r->loop_depth = 0;
+  r->in_ploop = false;
+  r->ploop_depth = 0;
+  scope s = {.owner = node->data.function_def.name};
+
+  for (size_t i = 0; i < node->data.function_def.param_count; i++) {
+    symbol_t param = node->data.function_def.params[i];
+    if (scope_find(r, param) != SIZE_MAX)
+      elog("Duplicate parameter '%s' in function '%s'", symbol_name(param),
+           symbol_name(node->data.function_def.name));
+    scope_declare(r, &s, param, false);
+  }
+
+  node->data.function_def.slot_count =
+      resolve_scope(r, &s, node->data.function_def.body);
+}
+
+size_t resolve(ast_node *ast_tree) {
+  if (!ast_tree)
+    elog("Can't resolve ast tree by null ptr");
+
+  uint64_t started = stats_phase_begin();
+  size_t symbols = symbol_count() ? symbol_count() : 1;
+  resolver r = {
+      .slots = malloc(sizeof(size_t) * symbols),
+      .generations = calloc(symbols, sizeof(uint32_t)),
+      .generation = 1,
+      .loop_depth = 0,
+      .defined = calloc(symbols, sizeof(bool)),
+      .effects = calloc(symbols, sizeof(bool)),
+      .functions = arr_create(8),
+      .pending_functions = arr_create(8),
+  };
+  if (!r.slots || !r.generations || !r.defined || !r.effects ||
+      !r.functions || !r.pending_functions)
+    elog("Error allocation memory for resolver");
+  collect_definitions(&r, ast_tree);
+  collect_effects(&r);
+
+  scope s = {.owner = intern_cstr("main")};
+  size_t slot_count = resolve_scope(&r, &s, ast_tree);
+
+  for (size_t i = 0; i < r.pending_functions->size; i++)
+    resolve_function(&r, arr_get(r.pending_functions, i));
+
+  arr_destroy(r.pending_functions);
+  arr_destroy(r.functions);
+  free(r.effects);
+  free(r.defined);
+  free(r.generations);
+  free(r.slots);
+  stats_phase_end(PHASE_resolve, started);
+  return slot_count;
+}
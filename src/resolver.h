@@ -0,0 +1,14 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include "lexer.h"
+#include <stdint.h>
+
+#define MAX_SLOTS UINT16_MAX
+
+// Binds every variable read and assignment to slot index of its function
+// frame (params go first). Returns slot count of top level scope, slot
+// counts of functions are stored in their definition nodes.
+size_t resolve(ast_node *ast_tree);
+
+#endif
@@ -0,0 +1,368 @@
+#include "simd.h"
+#include <math.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) && !defined(ANNUUM_NO_SIMD)
+#define SIMD_X86 1
+#include <immintrin.h>
+#else
+#define SIMD_X86 0
+#endif
+
+typedef double (*lane_merge)(double one, double two);
+
+static double merge_add(double one, double two) { return one + two; }
+static double merge_min(double one, double two) { return two < one ? two : one; }
+static double merge_max(double one, double two) { return two > one ? two : one; }
+
+// halves of lanes are merged until one is left , every kernel stores its
+// vector accumulators to lanes and ends here
+static double merge_lanes(double *lanes, lane_merge merge) {
+  for (size_t width = SIMD_LANES / 2; width > 0; width /= 2) {
+    for (size_t j = 0; j < width; j++)
+      lanes[j] = merge(lanes[j], lanes[j + width]);
+  }
+  return lanes[0];
+}
+
+static void fill_lanes(double *lanes, double value) {
+  for (size_t j = 0; j < SIMD_LANES; j++)
+    lanes[j] = value;
+}
+
+// elements after the last whole block are folded in order after lanes
+static double finish_sum(double *lanes, const double *rest, size_t count) {
+  double total = merge_lanes(lanes, merge_add);
+  for (size_t i = 0; i < count; i++)
+    total += rest[i];
+  return total;
+}
+
+static double finish_dot(double *lanes, const double *one, const double *two,
+                         size_t count) {
+  double total = merge_lanes(lanes, merge_add);
+  for (size_t i = 0; i < count; i++)
+    total += one[i] * two[i];
+  return total;
+}
+
+static double finish_fold(double *lanes, const double *rest, size_t count,
+                          lane_merge merge) {
+  double result = merge_lanes(lanes, merge);
+  for (size_t i = 0; i < count; i++)
+    result = merge(result, rest[i]);
+  return result;
+}
+
+#define SCALAR_ARITH(expr)                                                     \
+  for (size_t i = 0; i < count; i++) {                                         \
+    double x = one[i * one_step];                                              \
+    double y = two[i * two_step];                                              \
+    dst[i] = (expr);                                                           \
+  }
+
+static bool scalar_arith(simd_op op, double *dst, const double *one,
+                         size_t one_step, const double *two, size_t two_step,
+                         size_t count) {
+  switch (op) {
+  case SIMD_ADD:
+    SCALAR_ARITH(x + y)
+    break;
+  case SIMD_SUB:
+    SCALAR_ARITH(x - y)
+    break;
+  case SIMD_MUL:
+    SCALAR_ARITH(x * y)
+    break;
+  case SIMD_DIV:
+    for (size_t i = 0; i < count; i++) {
+      if (two[i * two_step] == 0)
+        return false;
+      dst[i] = one[i * one_step] / two[i * two_step];
+    }
+    break;
+  }
+  return true;
+}
+
+static double scalar_sum(const double *data, size_t count) {
+  double lanes[SIMD_LANES] = {0};
+  size_t i = 0;
+  for (; i + SIMD_LANES <= count; i += SIMD_LANES) {
+    for (size_t j = 0; j < SIMD_LANES; j++)
+      lanes[j] += data[i + j];
+  }
+  return finish_sum(lanes, data + i, count - i);
+}
+
+static double scalar_dot(const double *one, const double *two, size_t count) {
+  double lanes[SIMD_LANES] = {0};
+  size_t i = 0;
+  for (; i + SIMD_LANES <= count; i += SIMD_LANES) {
+    for (size_t j = 0; j < SIMD_LANES; j++)
+      lanes[j] += one[i + j] * two[i + j];
+  }
+  return finish_dot(lanes, one + i, two + i, count - i);
+}
+
+static double scalar_fold(const double *data, size_t count, double identity,
+                          lane_merge merge) {
+  double lanes[SIMD_LANES];
+  fill_lanes(lanes, identity);
+  size_t i = 0;
+  for (; i + SIMD_LANES <= count; i += SIMD_LANES) {
+    for (size_t j = 0; j < SIMD_LANES; j++)
+      lanes[j] = merge(lanes[j], data[i + j]);
+  }
+  return finish_fold(lanes, data + i, count - i, merge);
+}
+
+static double scalar_min(const double *data, size_t count) {
+  return scalar_fold(data, count, INFINITY, merge_min);
+}
+
+static double scalar_max(const double *data, size_t count) {
+  return scalar_fold(data, count, -INFINITY, merge_max);
+}
+
+static void scalar_axpy(double k, const double *x, double *y, size_t count) {
+  for (size_t i = 0; i < count; i++)
+    y[i] += k * x[i];
+}
+
+static const simd_kernels scalar_kernels = {
+    .arith = scalar_arith,
+    .sum = scalar_sum,
+    .dot = scalar_dot,
+    .min = scalar_min,
+    .max = scalar_max,
+    .axpy = scalar_axpy,
+};
+
+#if SIMD_X86
+
+// SSE2 is part of x86-64 , so these need no check. min_pd(x , m) is
+// 'x < m ? x : m' like merge_min , max_pd likewise.
+#define SSE2_ARITH(expr)                                                       \
+  for (; i + 2 <= count; i += 2) {                                             \
+    __m128d x = _mm_loadu_pd(one + i * one_step);                              \
+    __m128d y = _mm_loadu_pd(two + i * two_step);                              \
+    _mm_storeu_pd(dst + i, (expr));                                            \
+  }
+
+static bool sse2_arith(simd_op op, double *dst, const double *one,
+                       size_t one_step, const double *two, size_t two_step,
+                       size_t count) {
+  size_t i = 0;
+  __m128d zero = _mm_setzero_pd();
+  __m128d found = zero;
+  switch (op) {
+  case SIMD_ADD:
+    SSE2_ARITH(_mm_add_pd(x, y))
+    break;
+  case SIMD_SUB:
+    SSE2_ARITH(_mm_sub_pd(x, y))
+    break;
+  case SIMD_MUL:
+    SSE2_ARITH(_mm_mul_pd(x, y))
+    break;
+  case SIMD_DIV:
+    SSE2_ARITH((found = _mm_or_pd(found, _mm_cmpeq_pd(y, zero)),
+                _mm_div_pd(x, y)))
+    break;
+  }
+  if (_mm_movemask_pd(found))
+    return false;
+  return scalar_arith(op, dst + i, one + i * one_step, one_step,
+                      two + i * two_step, two_step, count - i);
+}
+
+// blocks of SIMD_LANES elements are folded by 'step(acc , at)' into vectors
+// kept in registers , then vectors go to lanes in index order
+#define SSE2_FOLD(init, step)                                                  \
+  __m128d a0 = init, a1 = init, a2 = init, a3 = init;                          \
+  __m128d a4 = init, a5 = init, a6 = init, a7 = init;                          \
+  size_t i = 0;                                                                \
+  for (; i + SIMD_LANES <= count; i += SIMD_LANES) {                           \
+    a0 = step(a0, i);                                                          \
+    a1 = step(a1, i + 2);                                                      \
+    a2 = step(a2, i + 4);                                                      \
+    a3 = step(a3, i + 6);                                                      \
+    a4 = step(a4, i + 8);                                                      \
+    a5 = step(a5, i + 10);                                                     \
+    a6 = step(a6, i + 12);                                                     \
+    a7 = step(a7, i + 14);                                                     \
+  }                                                                            \
+  double lanes[SIMD_LANES];                                                    \
+  _mm_storeu_pd(lanes, a0);                                                    \
+  _mm_storeu_pd(lanes + 2, a1);                                                \
+  _mm_storeu_pd(lanes + 4, a2);                                                \
+  _mm_storeu_pd(lanes + 6, a3);                                                \
+  _mm_storeu_pd(lanes + 8, a4);                                                \
+  _mm_storeu_pd(lanes + 10, a5);                                               \
+  _mm_storeu_pd(lanes + 12, a6);                                               \
+  _mm_storeu_pd(lanes + 14, a7);
+
+#define SSE2_SUM(acc, at) _mm_add_pd(acc, _mm_loadu_pd(data + (at)))
+#define SSE2_DOT(acc, at)                                                      \
+  _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(one + (at)), _mm_loadu_pd(two + (at))))
+#define SSE2_MIN(acc, at) _mm_min_pd(_mm_loadu_pd(data + (at)), acc)
+#define SSE2_MAX(acc, at) _mm_max_pd(_mm_loadu_pd(data + (at)), acc)
+
+static double sse2_sum(const double *data, size_t count) {
+  SSE2_FOLD(_mm_setzero_pd(), SSE2_SUM)
+  return finish_sum(lanes, data + i, count - i);
+}
+
+static double sse2_dot(const double *one, const double *two, size_t count) {
+  SSE2_FOLD(_mm_setzero_pd(), SSE2_DOT)
+  return finish_dot(lanes, one + i, two + i, count - i);
+}
+
+static double sse2_min(const double *data, size_t count) {
+  SSE2_FOLD(_mm_set1_pd(INFINITY), SSE2_MIN)
+  return finish_fold(lanes, data + i, count - i, merge_min);
+}
+
+static double sse2_max(const double *data, size_t count) {
+  SSE2_FOLD(_mm_set1_pd(-INFINITY), SSE2_MAX)
+  return finish_fold(lanes, data + i, count - i, merge_max);
+}
+
+static void sse2_axpy(double k, const double *x, double *y, size_t count) {
+  __m128d factor = _mm_set1_pd(k);
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    __m128d product = _mm_mul_pd(factor, _mm_loadu_pd(x + i));
+    _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), product));
+  }
+  scalar_axpy(k, x + i, y + i, count - i);
+}
+
+static const simd_kernels sse2_kernels = {
+    .arith = sse2_arith,
+    .sum = sse2_sum,
+    .dot = sse2_dot,
+    .min = sse2_min,
+    .max = sse2_max,
+    .axpy = sse2_axpy,
+};
+
+// compiled for AVX2 on their own and called only when cpu has it , FMA is
+// left out so products are rounded like in other kernels
+#define AVX2 __attribute__((target("avx2")))
+#define AVX2_ARITH(expr)                                                       \
+  for (; i + 4 <= count; i += 4) {                                             \
+    __m256d x = _mm256_loadu_pd(one + i * one_step);                           \
+    __m256d y = _mm256_loadu_pd(two + i * two_step);                           \
+    _mm256_storeu_pd(dst + i, (expr));                                         \
+  }
+
+AVX2 static bool avx2_arith(simd_op op, double *dst, const double *one,
+                            size_t one_step, const double *two,
+                            size_t two_step, size_t count) {
+  size_t i = 0;
+  __m256d zero = _mm256_setzero_pd();
+  __m256d found = zero;
+  switch (op) {
+  case SIMD_ADD:
+    AVX2_ARITH(_mm256_add_pd(x, y))
+    break;
+  case SIMD_SUB:
+    AVX2_ARITH(_mm256_sub_pd(x, y))
+    break;
+  case SIMD_MUL:
+    AVX2_ARITH(_mm256_mul_pd(x, y))
+    break;
+  case SIMD_DIV:
+    AVX2_ARITH((found = _mm256_or_pd(found, _mm256_cmp_pd(y, zero, _CMP_EQ_OQ)),
+                _mm256_div_pd(x, y)))
+    break;
+  }
+  if (_mm256_movemask_pd(found))
+    return false;
+  return scalar_arith(op, dst + i, one + i * one_step, one_step,
+                      two + i * two_step, two_step, count - i);
+}
+
+#define AVX2_FOLD(init, step)                                                  \
+  __m256d a0 = init, a1 = init, a2 = init, a3 = init;                          \
+  size_t i = 0;                                                                \
+  for (; i + SIMD_LANES <= count; i += SIMD_LANES) {                           \
+    a0 = step(a0, i);                                                          \
+    a1 = step(a1, i + 4);                                                      \
+    a2 = step(a2, i + 8);                                                      \
+    a3 = step(a3, i + 12);                                                     \
+  }                                                                            \
+  double lanes[SIMD_LANES];                                                    \
+  _mm256_storeu_pd(lanes, a0);                                                 \
+  _mm256_storeu_pd(lanes + 4, a1);                                             \
+  _mm256_storeu_pd(lanes + 8, a2);                                             \
+  _mm256_storeu_pd(lanes + 12, a3);
+
+#define AVX2_SUM(acc, at) _mm256_add_pd(acc, _mm256_loadu_pd(data + (at)))
+#define AVX2_DOT(acc, at)                                                      \
+  _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(one + (at)),                \
+                                   _mm256_loadu_pd(two + (at))))
+#define AVX2_MIN(acc, at) _mm256_min_pd(_mm256_loadu_pd(data + (at)), acc)
+#define AVX2_MAX(acc, at) _mm256_max_pd(_mm256_loadu_pd(data + (at)), acc)
+
+AVX2 static double avx2_sum(const double *data, size_t count) {
+  AVX2_FOLD(_mm256_setzero_pd(), AVX2_SUM)
+  return finish_sum(lanes, data + i, count - i);
+}
+
+AVX2 static double avx2_dot(const double *one, const double *two,
+                            size_t count) {
+  AVX2_FOLD(_mm256_setzero_pd(), AVX2_DOT)
+  return finish_dot(lanes, one + i, two + i, count - i);
+}
+
+AVX2 static double avx2_min(const double *data, size_t count) {
+  AVX2_FOLD(_mm256_set1_pd(INFINITY), AVX2_MIN)
+  return finish_fold(lanes, data + i, count - i, merge_min);
+}
+
+AVX2 static double avx2_max(const double *data, size_t count) {
+  AVX2_FOLD(_mm256_set1_pd(-INFINITY), AVX2_MAX)
+  return finish_fold(lanes, data + i, count - i, merge_max);
+}
+
+AVX2 static void avx2_axpy(double k, const double *x, double *y,
+                           size_t count) {
+  __m256d factor = _mm256_set1_pd(k);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256d product = _mm256_mul_pd(factor, _mm256_loadu_pd(x + i));
+    _mm256_storeu_pd(y + i, _mm256_add_pd(_mm256_loadu_pd(y + i), product));
+  }
+  scalar_axpy(k, x + i, y + i, count - i);
+}
+
+static const simd_kernels avx2_kernels = {
+    .arith = avx2_arith,
+    .sum = avx2_sum,
+    .dot = avx2_dot,
+    .min = avx2_min,
+    .max = avx2_max,
+    .axpy = avx2_axpy,
+};
+
+#endif
+
+static const simd_kernels *selected = &scalar_kernels;
+static pthread_once_t selected_once = PTHREAD_ONCE_INIT;
+
+// cpu model check also tells whether os saves ymm registers
+static void select_kernels(void) {
+#if SIMD_X86
+  __builtin_cpu_init();
+  selected =
+      __builtin_cpu_supports("avx2") ? &avx2_kernels : &sse2_kernels;
+#endif
+}
+
+const simd_kernels *simd(void) {
+  pthread_once(&selected_once, select_kernels);
+  return selected;
+}
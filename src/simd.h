@@ -0,0 +1,35 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Kernels over whole arrays of numbers , picked once by cpu : AVX2 , SSE2
+// (any x86-64) or plain C when built with ANNUUM_NO_SIMD or for other cpus.
+// Sums , dot products , min and max fold elements into SIMD_LANES partial
+// results by index and merge them in fixed order , so every kernel gives bit
+// identical result. Element-wise operand with step 0 is one number repeated ,
+// it points to SIMD_WIDTH copies of it.
+#define SIMD_LANES 16
+#define SIMD_WIDTH 4
+
+typedef enum simd_op { SIMD_ADD, SIMD_SUB, SIMD_MUL, SIMD_DIV } simd_op;
+
+typedef struct simd_kernels {
+  // dst[i] = one[i * one_step] op two[i * two_step] , false when divisor is
+  // zero (dst is partly written then)
+  bool (*arith)(simd_op op, double *dst, const double *one, size_t one_step,
+                const double *two, size_t two_step, size_t count);
+  double (*sum)(const double *data, size_t count);
+  double (*dot)(const double *one, const double *two, size_t count);
+  // inf and -inf for empty array , nan elements are skipped
+  double (*min)(const double *data, size_t count);
+  double (*max)(const double *data, size_t count);
+  // y[i] += k * x[i]
+  void (*axpy)(double k, const double *x, double *y, size_t count);
+} simd_kernels;
+
+// kernels of this cpu , safe to call from any thread
+const simd_kernels *simd(void);
+
+#endif
@@ -0,0 +1,117 @@
+#include "source.h"
+#include "logger.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SOURCE_READ_CHUNK (64 * 1024)
+
+static source_t *new_source(void) {
+  source_t *source = calloc(1, sizeof(source_t));
+  if (!source)
+    elog("Error allocation memory for source");
+  return source;
+}
+
+// region is reserved one page longer than file and file is mapped over its
+// start , so byte after last char is zero page and text ends with nul even
+// when file size is multiple of page size
+static bool map_source(source_t *source, int fd, size_t length) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t mapped_length = (length / page + 1) * page;
+
+  char *region = mmap(NULL, mapped_length, PROT_READ,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED)
+    return false;
+
+  if (mmap(region, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) ==
+      MAP_FAILED) {
+    munmap(region, mapped_length);
+    return false;
+  }
+
+  // tokenizer walks text once from start to end
+  madvise(region, length, MADV_SEQUENTIAL);
+
+  source->data = region;
+  source->length = length;
+  source->mapped = true;
+  source->mapped_length = mapped_length;
+  return true;
+}
+
+static void read_source(source_t *source, int fd) {
+  size_t capacity = SOURCE_READ_CHUNK;
+  size_t length = 0;
+  char *data = malloc(capacity);
+  if (!data)
+    elog("Error allocation memory for source text");
+
+  for (;;) {
+    if (capacity - length < SOURCE_READ_CHUNK / 2) {
+      capacity *= 2;
+      data = realloc(data, capacity);
+      if (!data)
+        elog("Error allocation memory for source text");
+    }
+
+    ssize_t count = read(fd, data + length, capacity - length - 1);
+    if (count == 0)
+      break;
+    if (count < 0) {
+      if (errno == EINTR)
+        continue;
+      elog("Can't read source : %s", strerror(errno));
+    }
+    length += (size_t)count;
+  }
+
+  data[length] = '\0';
+  source->data = data;
+  source->length = length;
+  source->mapped = false;
+}
+
+source_t *load_source_fd(int fd) {
+  if (fd < 0)
+    elog("Can't load source from invalid descriptor");
+
+  source_t *source = new_source();
+  struct stat info;
+
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0 &&
+      map_source(source, fd, (size_t)info.st_size))
+    return source;
+
+  read_source(source, fd);
+  return source;
+}
+
+source_t *load_source(const char *path) {
+  if (!path || *path == '\0')
+    elog("Can't load source by null or empty path");
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    elog("Can't open file '%s' : %s", path, strerror(errno));
+
+  source_t *source = load_source_fd(fd);
+  close(fd);
+  return source;
+}
+
+void free_source(source_t *source) {
+  if (!source)
+    return;
+
+  if (source->mapped)
+    munmap((void *)source->data, source->mapped_length);
+  else
+    free((void *)source->data);
+  free(source);
+}
@@ -0,0 +1,20 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Script text , nul terminated , 'length' does not count terminator
+// regular files are mapped read only , pipes and terminals are read into heap
+typedef struct source_t {
+  const char *data;
+  size_t length;
+  bool mapped;
+  size_t mapped_length;
+} source_t;
+
+source_t *load_source(const char *path);
+source_t *load_source_fd(int fd);
+void free_source(source_t *source);
+
+#endif
@@ -0,0 +1,81 @@
+#include "stats.h"
+#include <time.h>
+
+#if STATS_ENABLED
+_Thread_local stats_t stats = {0};
+#else
+static stats_t stats = {0};
+#endif
+
+static const char *phase_names[] = {
+#define STATS_PHASE_NAME(name) #name,
+    STATS_PHASES(STATS_PHASE_NAME)
+#undef STATS_PHASE_NAME
+};
+
+uint64_t stats_phase_begin(void) {
+#if STATS_ENABLED
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#else
+  return 0;
+#endif
+}
+
+void stats_phase_end(stats_phase phase, uint64_t started) {
+#if STATS_ENABLED
+  stats.phase_ns[phase] += stats_phase_begin() - started;
+#else
+  (void)phase;
+  (void)started;
+#endif
+}
+
+void stats_move(stats_t *to) {
+#if STATS_ENABLED
+#define STATS_COUNTER_MOVE(name)                                               \
+  to->name += stats.name;                                                      \
+  stats.name = 0;
+  STATS_COUNTERS(STATS_COUNTER_MOVE)
+#undef STATS_COUNTER_MOVE
+#else
+  (void)to;
+#endif
+}
+
+void stats_absorb(const stats_t *from) {
+#if STATS_ENABLED
+#define STATS_COUNTER_ABSORB(name) stats.name += from->name;
+  STATS_COUNTERS(STATS_COUNTER_ABSORB)
+#undef STATS_COUNTER_ABSORB
+#else
+  (void)from;
+#endif
+}
+
+const stats_t *stats_get(void) { return &stats; }
+
+void stats_print_times(FILE *out) {
+  for (int i = 0; i < PHASE_COUNT; i++)
+    fprintf(out, "%-9s %10.3f ms\n", phase_names[i], stats.phase_ns[i] / 1e6);
+}
+
+void stats_print_json(FILE *out) {
+  fprintf(out, "{\n  \"enabled\": %s,\n  \"phases_ns\": {",
+          STATS_ENABLED ? "true" : "false");
+  for (int i = 0; i < PHASE_COUNT; i++)
+    fprintf(out, "%s\n    \"%s\": %llu", i ? "," : "", phase_names[i],
+            (unsigned long long)stats.phase_ns[i]);
+  fprintf(out, "\n  },\n  \"counters\": {");
+
+  const char *separator = "";
+#define STATS_COUNTER_JSON(name)                                               \
+  fprintf(out, "%s\n    \"" #name "\": %llu", separator,                       \
+          (unsigned long long)stats.name);                                     \
+  separator = ",";
+  STATS_COUNTERS(STATS_COUNTER_JSON)
+#undef STATS_COUNTER_JSON
+
+  fprintf(out, "\n  }\n}\n");
+}
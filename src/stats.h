@@ -0,0 +1,71 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Counters and phase timers of interpreter , always on unless built with
+// ANNUUM_NO_STATS , every counter update is one add to thread local , so
+// threads of pool count without sharing cache lines
+#define STATS_COUNTERS(X)                                                      \
+  X(tokens)           /* tokens produced by tokenizer                */        \
+  X(ast_nodes)        /* ast nodes allocated by parser               */        \
+  X(nodes_folded)     /* expressions folded by optimizer             */        \
+  X(nodes_hoisted)    /* loop invariant operators moved out of loops */        \
+  X(checks_hoisted)   /* bounds checks moved before counted loops    */        \
+  X(variable_lookups) /* names bound to slots by resolver            */        \
+  X(function_calls)   /* calls made by vm or tree walker             */        \
+  X(memo_hits)        /* calls of pure functions answered by cache   */        \
+  X(loop_iterations)  /* loop bodies entered again                   */        \
+  X(instructions)     /* bytecode instructions interpreted           */        \
+  X(jit_compiled)     /* protos compiled to native code              */        \
+  X(nodes_evaluated)  /* ast nodes visited by tree walker            */        \
+  X(bytes_allocated)  /* arenas , token buffers , frames , arrays    */
+
+#define STATS_PHASES(X)                                                        \
+  X(load)                                                                      \
+  X(tokenize)                                                                  \
+  X(parse)                                                                     \
+  X(optimize)                                                                  \
+  X(resolve)                                                                   \
+  X(compile)                                                                   \
+  X(execute)
+
+#define STATS_PHASE_ENUM(name) PHASE_##name,
+typedef enum stats_phase {
+  STATS_PHASES(STATS_PHASE_ENUM) PHASE_COUNT
+} stats_phase;
+#undef STATS_PHASE_ENUM
+
+#define STATS_COUNTER_FIELD(name) uint64_t name;
+typedef struct stats_t {
+  STATS_COUNTERS(STATS_COUNTER_FIELD)
+  uint64_t phase_ns[PHASE_COUNT];
+} stats_t;
+#undef STATS_COUNTER_FIELD
+
+#ifndef ANNUUM_NO_STATS
+#define STATS_ENABLED 1
+extern _Thread_local stats_t stats;
+#define STAT_INC(counter) (stats.counter++)
+#define STAT_ADD(counter, value) (stats.counter += (value))
+#else
+#define STATS_ENABLED 0
+#define STAT_INC(counter) ((void)0)
+#define STAT_ADD(counter, value) ((void)0)
+#endif
+
+// started = stats_phase_begin() ; ... ; stats_phase_end(PHASE_x , started)
+uint64_t stats_phase_begin(void);
+void stats_phase_end(stats_phase phase, uint64_t started);
+
+// counters of pool thread are moved to job and absorbed by thread which ran
+// it , phase times stay where they were measured
+void stats_move(stats_t *to);
+void stats_absorb(const stats_t *from);
+
+const stats_t *stats_get(void);
+void stats_print_times(FILE *out);
+void stats_print_json(FILE *out);
+
+#endif
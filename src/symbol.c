@@ -0,0 +1,215 @@
+#include "symbol.h"
+#include "arena.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SYMBOL_CHUNK_SIZE 4096
+#define SYMBOL_MIN_BUCKETS 256
+
+typedef struct {
+  const char **names;
+  size_t *lengths;
+  uint32_t *hashes;
+  size_t count;
+  size_t capacity;
+
+  // open addressing , power of two size , NO_SYMBOL marks empty bucket
+  symbol_t *buckets;
+  size_t bucket_count;
+
+  arena_t *arena;
+} symbol_table;
+
+static symbol_table table = {0};
+
+static uint32_t hash_str(const char *str, size_t length) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (unsigned char)str[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static char *store_name(const char *str, size_t length) {
+  if (!table.arena)
+    table.arena = new_arena(SYMBOL_CHUNK_SIZE);
+
+  char *name = arena_alloc(table.arena, length + 1);
+  memcpy(name, str, length);
+  name[length] = '\0';
+  return name;
+}
+
+static void rehash(size_t bucket_count) {
+  symbol_t *buckets = malloc(sizeof(symbol_t) * bucket_count);
+  if (!buckets)
+    elog("Error allocation memory for symbol table buckets");
+  memset(buckets, 0xFF, sizeof(symbol_t) * bucket_count);
+
+  size_t mask = bucket_count - 1;
+  for (size_t i = 0; i < table.count; i++) {
+    size_t index = table.hashes[i] & mask;
+    while (buckets[index] != NO_SYMBOL)
+      index = (index + 1) & mask;
+    buckets[index] = (symbol_t)i;
+  }
+
+  free(table.buckets);
+  table.buckets = buckets;
+  table.bucket_count = bucket_count;
+}
+
+static void grow_entries(void) {
+  table.capacity = table.capacity ? table.capacity * 2 : 64;
+  table.names = realloc(table.names, sizeof(char *) * table.capacity);
+  table.lengths = realloc(table.lengths, sizeof(size_t) * table.capacity);
+  table.hashes = realloc(table.hashes, sizeof(uint32_t) * table.capacity);
+  if (!table.names || !table.lengths || !table.hashes)
+    elog("Error allocation memory for symbol table");
+}
+
+symbol_t intern(const char *str, size_t length) {
+  if (!str || length == 0)
+    elog("Can't intern null or empty string");
+
+  if (table.bucket_count == 0)
+    rehash(SYMBOL_MIN_BUCKETS);
+
+  uint32_t hash = hash_str(str, length);
+  size_t mask = table.bucket_count - 1;
+  size_t index = hash & mask;
+
+  while (table.buckets[index] != NO_SYMBOL) {
+    symbol_t symbol = table.buckets[index];
+    if (table.hashes[symbol] == hash && table.lengths[symbol] == length &&
+        memcmp(table.names[symbol], str, length) == 0)
+      return symbol;
+    index = (index + 1) & mask;
+  }
+
+  if (table.count >= NO_SYMBOL)
+    elog("Too many symbols");
+  if (table.count >= table.capacity)
+    grow_entries();
+
+  symbol_t symbol = (symbol_t)table.count++;
+  table.names[symbol] = store_name(str, length);
+  table.lengths[symbol] = length;
+  table.hashes[symbol] = hash;
+  table.buckets[index] = symbol;
+
+  if (table.count * 2 > table.bucket_count)
+    rehash(table.bucket_count * 2);
+
+  return symbol;
+}
+
+symbol_t intern_cstr(const char *str) {
+  if (!str)
+    elog("Can't intern null ptr on string");
+  return intern(str, strlen(str));
+}
+
+const char *symbol_name(symbol_t symbol) {
+  if (symbol >= table.count)
+    elog("Unknown symbol %u", symbol);
+  return table.names[symbol];
+}
+
+size_t symbol_count(void) { return table.count; }
+
+void free_symbols(void) {
+  free_arena(table.arena);
+  free(table.names);
+  free(table.lengths);
+  free(table.hashes);
+  free(table.buckets);
+  memset(&table, 0, sizeof(table));
+}
+
+#define SYMBOL_MAP_MIN_CAPACITY 16
+
+static size_t symbol_map_slot(symbol_t key, size_t mask) {
+  return (size_t)(key * 2654435761u) & mask;
+}
+
+static void symbol_map_grow(symbol_map *map) {
+  size_t capacity =
+      map->capacity ? map->capacity * 2 : SYMBOL_MAP_MIN_CAPACITY;
+  symbol_t *keys = malloc(sizeof(symbol_t) * capacity);
+  void **values = malloc(sizeof(void *) * capacity);
+  if (!keys || !values)
+    elog("Error allocation memory for symbol map");
+  memset(keys, 0xFF, sizeof(symbol_t) * capacity);
+
+  size_t mask = capacity - 1;
+  for (size_t i = 0; i < map->capacity; i++) {
+    if (map->keys[i] == NO_SYMBOL)
+      continue;
+
+    size_t index = symbol_map_slot(map->keys[i], mask);
+    while (keys[index] != NO_SYMBOL)
+      index = (index + 1) & mask;
+    keys[index] = map->keys[i];
+    values[index] = map->values[i];
+  }
+
+  free(map->keys);
+  free(map->values);
+  map->keys = keys;
+  map->values = values;
+  map->capacity = capacity;
+}
+
+void symbol_map_init(symbol_map *map) {
+  if (!map)
+    elog("Can't init symbol map by null ptr");
+  memset(map, 0, sizeof(symbol_map));
+}
+
+void *symbol_map_get(const symbol_map *map, symbol_t key) {
+  if (map->capacity == 0)
+    return NULL;
+
+  size_t mask = map->capacity - 1;
+  size_t index = symbol_map_slot(key, mask);
+  while (map->keys[index] != NO_SYMBOL) {
+    if (map->keys[index] == key)
+      return map->values[index];
+    index = (index + 1) & mask;
+  }
+  return NULL;
+}
+
+// returns false and keeps old value when key already present
+bool symbol_map_put(symbol_map *map, symbol_t key, void *value) {
+  if (key == NO_SYMBOL)
+    elog("Can't put empty symbol to symbol map");
+
+  if ((map->count + 1) * 2 > map->capacity)
+    symbol_map_grow(map);
+
+  size_t mask = map->capacity - 1;
+  size_t index = symbol_map_slot(key, mask);
+  while (map->keys[index] != NO_SYMBOL) {
+    if (map->keys[index] == key)
+      return false;
+    index = (index + 1) & mask;
+  }
+
+  map->keys[index] = key;
+  map->values[index] = value;
+  map->count++;
+  return true;
+}
+
+void symbol_map_free(symbol_map *map) {
+  if (!map)
+    return;
+
+  free(map->keys);
+  free(map->values);
+  memset(map, 0, sizeof(symbol_map));
+}
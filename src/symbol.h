@@ -0,0 +1,32 @@
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Interned identifier , equal names always have equal ids
+typedef uint32_t symbol_t;
+
+#define NO_SYMBOL UINT32_MAX
+
+symbol_t intern(const char *str, size_t length);
+symbol_t intern_cstr(const char *str);
+const char *symbol_name(symbol_t symbol);
+size_t symbol_count(void);
+void free_symbols(void);
+
+// Open addressing hash map from symbol to pointer
+typedef struct symbol_map {
+  symbol_t *keys;
+  void **values;
+  size_t count;
+  size_t capacity;
+} symbol_map;
+
+void symbol_map_init(symbol_map *map);
+void *symbol_map_get(const symbol_map *map, symbol_t key);
+bool symbol_map_put(symbol_map *map, symbol_t key, void *value);
+void symbol_map_free(symbol_map *map);
+
+#endif
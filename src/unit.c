@@ -0,0 +1,23 @@
+#include "unit.h"
+#include "logger.h"
+#include <stdlib.h>
+
+unit_t *new_unit(void) {
+  unit_t *unit = malloc(sizeof(unit_t));
+  if (!unit)
+    elog("Error allocation memory for compilation unit");
+
+  unit->arena = new_arena(ARENA_CHUNK_SIZE);
+  unit->tokens = NULL;
+  unit->tree = NULL;
+  return unit;
+}
+
+void free_unit(unit_t *unit) {
+  if (!unit)
+    return;
+
+  free_token_buffer(unit->tokens);
+  free_arena(unit->arena);
+  free(unit);
+}
@@ -0,0 +1,18 @@
+#ifndef UNIT_H
+#define UNIT_H
+
+#include "arena.h"
+#include "lexer.h"
+
+// Compilation unit of one script , ast nodes of it live in the unit arena ,
+// tokens in their own buffer , all are released together by free_unit
+typedef struct unit_t {
+  arena_t *arena;
+  token_buffer *tokens;
+  ast_node *tree;
+} unit_t;
+
+unit_t *new_unit(void);
+void free_unit(unit_t *unit);
+
+#endif
@@ -0,0 +1,221 @@
+#include "unset.h"
+#include "logger.h"
+#include "walk.h"
+#include <stdlib.h>
+
+// if being walked , names its if body assigned wait in 'branches' from
+// 'branch_start' while else body is walked
+typedef struct {
+  ast_node *node;
+  size_t start;
+  size_t branch_start;
+} open_if;
+
+// names assigned at current point of scope are flagged and listed in order ,
+// so state before statement is back once list is cut to its old length
+typedef struct {
+  bool *assigned;
+  symbol_t *names;
+  size_t count;
+  size_t capacity;
+  symbol_t *branches;
+  size_t branch_count;
+  size_t branch_capacity;
+  open_if *ifs;
+  size_t if_count;
+  size_t if_capacity;
+  // names of if body while its else body is merged
+  bool *marks;
+  arr_t *pending_functions;
+} marker;
+
+static void assign(marker *m, symbol_t name) {
+  if (m->assigned[name])
+    return;
+
+  if (m->count >= m->capacity) {
+    m->capacity = m->capacity ? m->capacity * 2 : 32;
+    m->names = realloc(m->names, sizeof(symbol_t) * m->capacity);
+    if (!m->names)
+      elog("Error allocation memory for assigned names");
+  }
+  m->assigned[name] = true;
+  m->names[m->count++] = name;
+}
+
+static void forget(marker *m, size_t start) {
+  while (m->count > start)
+    m->assigned[m->names[--m->count]] = false;
+}
+
+static void push_branch(marker *m, symbol_t name) {
+  if (m->branch_count >= m->branch_capacity) {
+    m->branch_capacity = m->branch_capacity ? m->branch_capacity * 2 : 32;
+    m->branches = realloc(m->branches, sizeof(symbol_t) * m->branch_capacity);
+    if (!m->branches)
+      elog("Error allocation memory for assigned names");
+  }
+  m->branches[m->branch_count++] = name;
+}
+
+static void open_if_node(marker *m, ast_node *node) {
+  if (m->if_count >= m->if_capacity) {
+    m->if_capacity = m->if_capacity ? m->if_capacity * 2 : 16;
+    m->ifs = realloc(m->ifs, sizeof(open_if) * m->if_capacity);
+    if (!m->ifs)
+      elog("Error allocation memory for assigned names");
+  }
+  m->ifs[m->if_count++] = (open_if){.node = node,
+                                    .start = m->count,
+                                    .branch_start = m->branch_count};
+}
+
+// if body is done , with else its names wait until else body is done too
+static void leave_if_body(marker *m) {
+  open_if *at = &m->ifs[m->if_count - 1];
+  if (!at->node->data.if_stmt.else_body)
+    return;
+
+  for (size_t i = at->start; i < m->count; i++)
+    push_branch(m, m->names[i]);
+  forget(m, at->start);
+}
+
+// names assigned by else body stay only when if body assigned them too
+static void leave_if(marker *m) {
+  open_if at = m->ifs[--m->if_count];
+  if (!at.node->data.if_stmt.else_body) {
+    forget(m, at.start);
+    return;
+  }
+
+  for (size_t i = at.branch_start; i < m->branch_count; i++)
+    m->marks[m->branches[i]] = true;
+
+  size_t kept = at.start;
+  for (size_t i = at.start; i < m->count; i++) {
+    symbol_t name = m->names[i];
+    if (m->marks[name])
+      m->names[kept++] = name;
+    else
+      m->assigned[name] = false;
+  }
+  m->count = kept;
+
+  for (size_t i = at.branch_start; i < m->branch_count; i++)
+    m->marks[m->branches[i]] = false;
+  m->branch_count = at.branch_start;
+}
+
+static bool is_body_of(ast_node *node, ast_node *parent, ast_type type) {
+  if (!parent || parent->type != type)
+    return false;
+  switch (type) {
+  case NODE_IF:
+    return node == parent->data.if_stmt.if_body;
+  case NODE_RANGE_LOOP:
+    return node == parent->data.range_loop.loop_body;
+  default:
+    return false;
+  }
+}
+
+// expressions never assign , so every read inside of statement sees names
+// assigned before it
+static void mark_scope(marker *m, ast_node *body) {
+  walker w;
+  walk_init(&w, body);
+  walk_step step;
+  while (walk_next(&w, &step)) {
+    ast_node *node = step.node;
+
+    if (step.leaving) {
+      switch (node->type) {
+      case NODE_ASSIGNMENT:
+        assign(m, node->data.assignment.var_name);
+        break;
+      case NODE_IF:
+        leave_if(m);
+        break;
+      case NODE_LOOP:
+      case NODE_RANGE_LOOP:
+        forget(m, step.kept);
+        break;
+      default:
+        break;
+      }
+      if (is_body_of(node, step.parent, NODE_IF))
+        leave_if_body(m);
+      continue;
+    }
+
+    // loop variable and reductions are assigned whenever body runs
+    if (is_body_of(node, step.parent, NODE_RANGE_LOOP)) {
+      ast_node *loop = step.parent;
+      assign(m, loop->data.range_loop.var_name);
+      for (size_t i = 0; i < loop->data.range_loop.reduction_count; i++)
+        assign(m, loop->data.range_loop.reductions[i].name);
+    }
+
+    switch (node->type) {
+    case NODE_VARIABLE:
+      node->data.var.maybe_unset = !m->assigned[node->data.var.var_name];
+      break;
+    case NODE_INDEX:
+    case NODE_INDEX_ASSIGN:
+      node->data.element.maybe_unset =
+          !m->assigned[node->data.element.name];
+      break;
+    case NODE_IF:
+      open_if_node(m, node);
+      break;
+    case NODE_LOOP:
+      walk_keep(&w, m->count);
+      break;
+    case NODE_RANGE_LOOP:
+      for (size_t i = 0; i < node->data.range_loop.reduction_count; i++) {
+        reduction *reduced = &node->data.range_loop.reductions[i];
+        reduced->maybe_unset = !m->assigned[reduced->name];
+      }
+      walk_keep(&w, m->count);
+      break;
+    case NODE_FUNCTION_DEF:
+      arr_push(m->pending_functions, node);
+      walk_skip(&w);
+      break;
+    default:
+      break;
+    }
+  }
+  walk_free(&w);
+  forget(m, 0);
+}
+
+void mark_unset_reads(ast_node *ast_tree) {
+  if (!ast_tree)
+    elog("Can't mark unset reads of ast tree by null ptr");
+
+  size_t symbols = symbol_count() ? symbol_count() : 1;
+  marker m = {
+      .assigned = calloc(symbols, sizeof(bool)),
+      .marks = calloc(symbols, sizeof(bool)),
+      .pending_functions = arr_create(8),
+  };
+  if (!m.assigned || !m.marks || !m.pending_functions)
+    elog("Error allocation memory for assigned names");
+
+  mark_scope(&m, ast_tree);
+  for (size_t i = 0; i < m.pending_functions->size; i++) {
+    ast_node *function = arr_get(m.pending_functions, i);
+    for (size_t p = 0; p < function->data.function_def.param_count; p++)
+      assign(&m, function->data.function_def.params[p]);
+    mark_scope(&m, function->data.function_def.body);
+  }
+
+  arr_destroy(m.pending_functions);
+  free(m.ifs);
+  free(m.branches);
+  free(m.marks);
+  free(m.names);
+  free(m.assigned);
+}
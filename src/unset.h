@@ -0,0 +1,16 @@
+#ifndef UNSET_H
+#define UNSET_H
+
+#include "lexer.h"
+
+// Definite assignment : read of variable (array of element and value of
+// reduction from before ploop too) is marked 'maybe_unset' when some path
+// through its scope reaches it before every assignment of the variable ,
+// engines check only such reads and fail on unset one like on unknown
+// variable. After if only names assigned by both branches count , loops may
+// run no trips , so names assigned inside of them don't count after them.
+// 'stop' , 'next' and 'return' are taken as falling through , which can only
+// add checks. Params are assigned , every function is a scope of its own.
+void mark_unset_reads(ast_node *ast_tree);
+
+#endif
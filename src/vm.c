@@ -0,0 +1,728 @@
+#include "vm.h"
+#include "array.h"
+#include "builtin.h"
+#include "depth.h"
+#include "frame.h"
+#include "jit.h"
+#include "logger.h"
+#include "memo.h"
+#include "ploop.h"
+#include "pool.h"
+#include "profile.h"
+#include "stats.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && !defined(VM_SWITCH_DISPATCH)
+#define VM_THREADED_DISPATCH
+#endif
+
+typedef struct vm_frame {
+  proto *fn;
+  instr *pc;
+  double *regs;
+  uint16_t ret_reg;
+} vm_frame;
+
+typedef struct vm_t {
+  frame_stack *stack;
+
+  vm_frame *frames;
+  size_t frame_count;
+  size_t frame_capacity;
+
+  // shared by vms of pool workers , nothing is defined while they run
+  symbol_map *funcs;
+
+  // native code is used only when jit is on and not profiling , depth
+  // counts native calls nested on C stack
+  bool jit;
+  size_t native_depth;
+
+  // vm of pool worker shares protos with other threads , it counts their
+  // hotness atomically and never writes call site or result caches
+  bool worker;
+  // one vm per pool worker , made by first ploop run in parallel
+  struct vm_t *workers;
+  size_t worker_count;
+} vm_t;
+
+static void vm_define_function(vm_t *vm, proto *fn) {
+  if (!symbol_map_put(vm->funcs, fn->name, fn))
+    elog("Function '%s' already defined", symbol_name(fn->name));
+}
+
+static proto *vm_get_function(vm_t *vm, symbol_t name) {
+  proto *fn = symbol_map_get(vm->funcs, name);
+  if (!fn)
+    elog("Function '%s' not found", symbol_name(name));
+  return fn;
+}
+
+// functions can't be redefined , so resolved call site stays valid for whole
+// run , caches are only dropped before next run
+static void vm_reset_callees(proto *fn, size_t depth, void *context) {
+  (void)depth;
+  (void)context;
+  if (fn->name_count)
+    memset(fn->callees, 0, sizeof(proto *) * fn->name_count);
+}
+
+// registers come from reused frame stack , only variable slots which are not
+// params are cleared , temporaries are always written before read. Cached
+// proto keeps its arguments after registers , params may change before
+// result is stored under them.
+static vm_frame *vm_add_frame(vm_t *vm, proto *fn, uint16_t ret_reg) {
+  if (vm->frame_count > max_call_depth())
+    elog("Call stack overflow , calls nested deeper than %zu , raise limit "
+         "with --max-call-depth",
+         max_call_depth());
+
+  if (vm->frame_count >= vm->frame_capacity) {
+    vm->frame_capacity = vm->frame_capacity ? vm->frame_capacity * 2 : 16;
+    vm->frames = realloc(vm->frames, sizeof(vm_frame) * vm->frame_capacity);
+    if (!vm->frames)
+      elog("Error allocation memory for vm call stack");
+  }
+
+  vm_frame *frame = &vm->frames[vm->frame_count++];
+  frame->fn = fn;
+  frame->pc = fn->code;
+  frame->regs =
+      frame_push(vm->stack, fn->reg_count + (fn->memo ? fn->param_count : 0));
+  frame->ret_reg = ret_reg;
+  return frame;
+}
+
+static vm_frame *vm_push_frame(vm_t *vm, proto *fn, const double *args,
+                               uint16_t ret_reg) {
+  vm_frame *frame = vm_add_frame(vm, fn, ret_reg);
+  if (fn->memo && fn->param_count)
+    memcpy(frame->regs + fn->reg_count, args,
+           sizeof(double) * fn->param_count);
+
+  if (fn->param_count)
+    memcpy(frame->regs, args, sizeof(double) * fn->param_count);
+  if (fn->slot_count > fn->param_count)
+    frame_unset(frame->regs + fn->param_count,
+                fn->slot_count - fn->param_count);
+  return frame;
+}
+
+static void vm_pop_frame(vm_t *vm) {
+  vm_frame *frame = &vm->frames[--vm->frame_count];
+  frame_pop(vm->stack, frame->regs);
+}
+
+// top frame returns 'value' , cached proto stores it under its arguments
+static void vm_remember(vm_t *vm, double value) {
+  vm_frame *frame = &vm->frames[vm->frame_count - 1];
+  if (frame->fn->memo && !vm->worker)
+    memo_put(frame->fn->memo, frame->regs + frame->fn->reg_count, value);
+}
+
+// result of call with arguments at 'args' when proto caches it
+static bool vm_recall(proto *fn, const double *args, double *value) {
+  if (!fn->memo || !memo_get(fn->memo, args, value))
+    return false;
+  STAT_INC(memo_hits);
+  return true;
+}
+
+// records whole call stack , caller frames stopped on their call instruction
+// and current one on instruction which is about to run
+static void vm_sample(vm_t *vm, const instr *pc) {
+  profile_sample_begin();
+  for (size_t i = 0; i < vm->frame_count; i++) {
+    vm_frame *frame = &vm->frames[i];
+    const instr *at = i + 1 == vm->frame_count ? pc : frame->pc - 1;
+    proto *fn = frame->fn;
+    profile_sample_frame(fn->name, fn->lines[at - fn->code]);
+  }
+  profile_sample_end();
+}
+
+// executed instructions are counted in local , so it stays in register and
+// goes to stats once per run
+#if STATS_ENABLED
+#define VM_COUNT() executed++
+#else
+#define VM_COUNT() ((void)0)
+#endif
+
+#ifdef VM_THREADED_DISPATCH
+#define VM_LABEL(op) &&do_##op,
+#define VM_LOOP() VM_DISPATCH();
+#define VM_CASE(op) do_##op:
+#define VM_DISPATCH()                                                          \
+  do {                                                                         \
+    VM_COUNT();                                                                \
+    goto *table[(in = *pc++).op];                                              \
+  } while (0)
+#else
+#define VM_PROFILE()                                                           \
+  (profile_tick ? (profile_tick = 0, vm_sample(vm, pc)) : (void)0)
+#define VM_LOOP() for (;;) switch (VM_COUNT(), VM_PROFILE(), (in = *pc++).op)
+#define VM_CASE(op) case op:
+#define VM_DISPATCH() continue
+#endif
+
+#define VM_LOAD_FRAME()                                                        \
+  do {                                                                         \
+    fn = frame->fn;                                                            \
+    pc = frame->pc;                                                            \
+    R = frame->regs;                                                           \
+    K = fn->consts;                                                            \
+  } while (0)
+
+// arrays are nans , so operands are checked only when result is nan
+#define VM_BINARY(op, second, expr)                                            \
+  VM_CASE(op) {                                                                \
+    double one = R[in.b];                                                      \
+    double two = second[in.c];                                                 \
+    double result = (expr);                                                    \
+    if (result != result)                                                      \
+      check_operands(one, two);                                                \
+    R[in.a] = result;                                                          \
+    VM_DISPATCH();                                                             \
+  }
+
+#define VM_COMPARE(op, expr)                                                   \
+  VM_CASE(op) {                                                                \
+    double one = R[in.b];                                                      \
+    double two = R[in.c];                                                      \
+    if (isunordered(one, two))                                                 \
+      check_operands(one, two);                                                \
+    R[in.a] = (expr) ? 1.0 : 0.0;                                              \
+    VM_DISPATCH();                                                             \
+  }
+
+static inline double divide(double one, double two) {
+  if (two == 0)
+    elog("Can't divide by zero");
+  return one / two;
+}
+
+// compare and branch , next instruction is OP_JMP taken when comparison is
+// false and skipped otherwise
+#define VM_BRANCH(op, second, expr)                                            \
+  VM_CASE(op) {                                                                \
+    double one = R[in.a];                                                      \
+    double two = second[in.b];                                                 \
+    if (isunordered(one, two))                                                 \
+      check_operands(one, two);                                                \
+    pc = (expr) ? pc + 1 : fn->code + INSTR_BX(*pc);                           \
+    VM_DISPATCH();                                                             \
+  }
+
+// callee of call instruction , call site caches it after first lookup
+static proto *vm_callee(vm_t *vm, proto *fn, instr in) {
+  proto *callee = fn->callees[in.c];
+  if (!callee) {
+    callee = vm_get_function(vm, fn->names[in.c]);
+    if (!vm->worker)
+      fn->callees[in.c] = callee;
+  }
+  if (callee->param_count != in.b)
+    elog("Function '%s' called with wrong number of arguments",
+         symbol_name(callee->name));
+  return callee;
+}
+
+// self call in tail position , arguments at 'args' become params of the
+// running frame which then starts over like freshly pushed one
+static void vm_reuse_frame(proto *fn, double *regs, const double *args) {
+  STAT_INC(function_calls);
+  // args are temporaries above slots , so copy never overlaps
+  if (fn->param_count)
+    memcpy(regs, args, sizeof(double) * fn->param_count);
+  if (fn->slot_count > fn->param_count)
+    frame_unset(regs + fn->param_count, fn->slot_count - fn->param_count);
+}
+
+static double vm_execute(vm_t *vm, size_t base);
+static const jit_helpers vm_jit_helpers;
+
+// workers count the same proto at once , so only the one whose count
+// reaches threshold compiles it and native code is published when complete
+static bool vm_worker_native_ready(proto *fn) {
+  if (__atomic_load_n(&fn->jit, __ATOMIC_ACQUIRE))
+    return true;
+  if (__atomic_load_n(&fn->hotness, __ATOMIC_RELAXED) >= JIT_THRESHOLD ||
+      __atomic_add_fetch(&fn->hotness, 1, __ATOMIC_RELAXED) != JIT_THRESHOLD)
+    return false;
+
+  jit_code *code = jit_compile(fn, &vm_jit_helpers);
+  __atomic_store_n(&fn->jit, code, __ATOMIC_RELEASE);
+  return code != NULL;
+}
+
+// counts call or loop iteration of fn and compiles it once it is hot ,
+// returns true when frame should continue in native code
+static bool vm_native_ready(vm_t *vm, proto *fn) {
+  if (!vm->jit || vm->native_depth >= JIT_MAX_DEPTH)
+    return false;
+  if (vm->worker)
+    return vm_worker_native_ready(fn);
+  if (fn->jit)
+    return true;
+  if (fn->hotness >= JIT_THRESHOLD || ++fn->hotness < JIT_THRESHOLD)
+    return false;
+
+  fn->jit = jit_compile(fn, &vm_jit_helpers);
+  return fn->jit != NULL;
+}
+
+// call made by native code , frame of hot callee is returned to caller's
+// native code which calls it directly , others are interpreted right here
+static jit_target vm_native_call(void *context, proto *fn, uint32_t at,
+                                 double *regs) {
+  vm_t *vm = context;
+  instr in = fn->code[at];
+  proto *callee = vm_callee(vm, fn, in);
+  if (vm_recall(callee, regs + in.a, &regs[in.a]))
+    return (jit_target){.regs = NULL, .code = NULL};
+
+  STAT_INC(function_calls);
+  vm->frames[vm->frame_count - 1].pc = fn->code + at + 1;
+  vm_frame *frame = vm_push_frame(vm, callee, regs + in.a, in.a);
+
+  if (vm_native_ready(vm, callee)) {
+    vm->native_depth++;
+    return (jit_target){.regs = frame->regs, .code = callee->jit->memory};
+  }
+
+  regs[in.a] = vm_execute(vm, vm->frame_count - 1);
+  return (jit_target){.regs = NULL, .code = NULL};
+}
+
+// tail call made by native code , returns true when it was self call and
+// frame is ready to run fn again , otherwise native code makes plain call
+static bool vm_native_tail(void *context, proto *fn, uint32_t at,
+                           double *regs) {
+  instr in = fn->code[at];
+  if (vm_callee(context, fn, in) != fn)
+    return false;
+  vm_reuse_frame(fn, regs, regs + in.a);
+  return true;
+}
+
+// native callee exited , returned one is popped , rest of one which left at
+// instruction without template is interpreted
+static double vm_native_return(void *context, uint64_t pc, double value) {
+  vm_t *vm = context;
+  vm->native_depth--;
+
+  if (pc == JIT_RETURNED) {
+    vm_remember(vm, value);
+    vm_pop_frame(vm);
+    return value;
+  }
+
+  vm_frame *frame = &vm->frames[vm->frame_count - 1];
+  frame->pc = frame->fn->code + pc;
+  return vm_execute(vm, vm->frame_count - 1);
+}
+
+static const jit_helpers vm_jit_helpers = {
+    .call = vm_native_call,
+    .ret = vm_native_return,
+    .tail = vm_native_tail,
+};
+
+// ploop being run , reductions of chunk i are at partials[i * count ..]
+typedef struct vm_ploop_job {
+  proto *fn;
+  const double *regs;
+  instr *at;
+  size_t chunks;
+  double *partials;
+  vm_t *vms;
+} vm_ploop_job;
+
+// chunk runs on copy of frame of ploop , which ends at OP_PEND after last
+// trip and leaves copy on top , reductions are taken from it
+static void vm_run_chunk(vm_t *vm, const vm_ploop_job *job, size_t chunk) {
+  instr in = *job->at;
+  const double *regs = job->regs;
+  double first, count;
+  ploop_chunk(regs[in.a + 1], job->chunks, chunk, &first, &count);
+
+  vm_frame *frame = vm_add_frame(vm, job->fn, 0);
+  double *R = frame->regs;
+  memcpy(R, regs, sizeof(double) * job->fn->reg_count);
+  R[in.a] = regs[in.a] + first * regs[in.a + 2];
+  R[in.a + 1] = count;
+  R[in.b] = R[in.a];
+  for (uint16_t i = 0; i < in.c; i++) {
+    instr reduced = job->at[1 + i];
+    R[reduced.a] = reduce_identity((reduce_op)reduced.b);
+  }
+  frame->pc = job->at + in.c + 2;
+
+  vm_execute(vm, vm->frame_count - 1);
+
+  double *partials = job->partials + chunk * in.c;
+  for (uint16_t i = 0; i < in.c; i++)
+    partials[i] = R[job->at[1 + i].a];
+  vm_pop_frame(vm);
+}
+
+static void vm_ploop_task(void *context, size_t worker, size_t chunk) {
+  vm_ploop_job *job = context;
+  vm_run_chunk(&job->vms[worker], job, chunk);
+}
+
+static void vm_start_workers(vm_t *vm) {
+  vm->worker_count = pool_threads();
+  vm->workers = calloc(vm->worker_count, sizeof(vm_t));
+  if (!vm->workers)
+    elog("Error allocation memory for vms of pool workers");
+
+  for (size_t i = 0; i < vm->worker_count; i++) {
+    vm_t *worker = &vm->workers[i];
+    worker->stack = new_frame_stack();
+    worker->funcs = vm->funcs;
+    worker->jit = vm->jit;
+    worker->worker = true;
+  }
+}
+
+static void vm_free_workers(vm_t *vm) {
+  for (size_t i = 0; i < vm->worker_count; i++) {
+    free_frame_stack(vm->workers[i].stack);
+    free(vm->workers[i].frames);
+  }
+  free(vm->workers);
+}
+
+// chunks run on pool unless this vm is a worker itself (nested ploop) or
+// profiler samples this thread , serial run takes them in order on this vm
+// and gives the same result. Reductions are merged in chunk order.
+static void vm_ploop(vm_t *vm, proto *fn, double *regs, instr *at) {
+  instr in = *at;
+  regs[in.a + 1] = range_trips(regs[in.a], regs[in.a + 1], regs[in.a + 2]);
+  size_t chunks = ploop_chunks(regs[in.a + 1]);
+  if (chunks == 0)
+    return;
+
+  vm_ploop_job job = {.fn = fn, .regs = regs, .at = at, .chunks = chunks};
+  job.partials = malloc(sizeof(double) * (chunks * in.c + 1));
+  if (!job.partials)
+    elog("Error allocation memory for ploop reductions");
+
+  // partials and frames of workers are not roots
+  arrays_hold();
+  if (vm->worker || profile_active() || pool_threads() == 1 || chunks == 1) {
+    for (size_t i = 0; i < chunks; i++)
+      vm_run_chunk(vm, &job, i);
+  } else {
+    if (!vm->workers)
+      vm_start_workers(vm);
+    job.vms = vm->workers;
+    pool_run(chunks, vm_ploop_task, &job);
+  }
+
+  for (uint16_t i = 0; i < in.c; i++) {
+    instr reduced = at[1 + i];
+    double value = regs[reduced.a];
+    for (size_t chunk = 0; chunk < chunks; chunk++)
+      value = reduce_combine((reduce_op)reduced.b, value,
+                             job.partials[chunk * in.c + i]);
+    regs[reduced.a] = value;
+  }
+  arrays_release();
+  free(job.partials);
+}
+
+// runs top frame until frame 'base' returns , frames pushed meanwhile are
+// run here too , calls from native code come back through vm_native_call
+static double vm_execute(vm_t *vm, size_t base) {
+#ifdef VM_THREADED_DISPATCH
+  static void *dispatch_table[] = {OPCODE_LIST(VM_LABEL)};
+  // while profiling every opcode goes through sampling stub first , so
+  // normal dispatch pays nothing for profiler
+  static void *profile_table[] = {[0 ... OP_COUNT - 1] = &&do_profile};
+  void **table = profile_active() ? profile_table : dispatch_table;
+#endif
+
+  vm_frame *frame = &vm->frames[vm->frame_count - 1];
+  proto *fn;
+  instr *pc;
+  double *R;
+  const double *K;
+  instr in;
+  double value;
+  uint16_t ret_reg;
+  proto *callee;
+#if STATS_ENABLED
+  uint64_t executed = 0;
+#endif
+  VM_LOAD_FRAME();
+
+  VM_LOOP() {
+#ifdef VM_THREADED_DISPATCH
+  do_profile:
+    if (profile_tick) {
+      profile_tick = 0;
+      vm_sample(vm, pc - 1);
+    }
+    goto *dispatch_table[in.op];
+#endif
+
+  // frame continues in native code from pc , it comes back either returned
+  // or at instruction without template
+  vm_native: {
+    vm->native_depth++;
+    jit_exit exit = jit_enter(fn->jit, R, vm, (size_t)(pc - fn->code));
+    vm->native_depth--;
+
+    // calls made by native code could have moved frame array
+    frame = &vm->frames[vm->frame_count - 1];
+    if (exit.pc == JIT_RETURNED) {
+      value = exit.value;
+      goto vm_return;
+    }
+    pc = fn->code + exit.pc;
+    VM_DISPATCH();
+  }
+
+    VM_CASE(OP_LOADK) {
+      R[in.a] = K[INSTR_BX(in)];
+      VM_DISPATCH();
+    }
+
+    VM_CASE(OP_MOVE) {
+      R[in.a] = R[in.b];
+      VM_DISPATCH();
+    }
+
+    VM_CASE(OP_READ) {
+      if (is_unset(R[in.b]))
+        elog("Variable '%s' not found", symbol_name(fn->names[in.c]));
+      R[in.a] = R[in.b];
+      VM_DISPATCH();
+    }
+
+    VM_BINARY(OP_ADD, R, one + two)
+    VM_BINARY(OP_SUB, R, one - two)
+    VM_BINARY(OP_MUL, R, one * two)
+    VM_BINARY(OP_DIV, R, divide(one, two))
+    VM_COMPARE(OP_LT, one < two)
+    VM_COMPARE(OP_LE, one <= two)
+    VM_COMPARE(OP_GT, one > two)
+    VM_COMPARE(OP_GE, one >= two)
+    VM_COMPARE(OP_EQ, one == two)
+    VM_COMPARE(OP_NE, one != two)
+
+    VM_BINARY(OP_ADDK, K, one + two)
+    VM_BINARY(OP_SUBK, K, one - two)
+    VM_BINARY(OP_MULK, K, one * two)
+    VM_BINARY(OP_DIVK, K, divide(one, two))
+
+    VM_BRANCH(OP_IFLT, R, one < two)
+    VM_BRANCH(OP_IFLE, R, one <= two)
+    VM_BRANCH(OP_IFGT, R, one > two)
+    VM_BRANCH(OP_IFGE, R, one >= two)
+    VM_BRANCH(OP_IFEQ, R, one == two)
+    VM_BRANCH(OP_IFNE, R, one != two)
+    VM_BRANCH(OP_IFLTK, K, one < two)
+    VM_BRANCH(OP_IFLEK, K, one <= two)
+    VM_BRANCH(OP_IFGTK, K, one > two)
+    VM_BRANCH(OP_IFGEK, K, one >= two)
+    VM_BRANCH(OP_IFEQK, K, one == two)
+    VM_BRANCH(OP_IFNEK, K, one != two)
+
+    VM_CASE(OP_JMP) {
+      pc = fn->code + INSTR_BX(in);
+      VM_DISPATCH();
+    }
+
+    VM_CASE(OP_LOOP) {
+      STAT_INC(loop_iterations);
+      pc = fn->code + INSTR_BX(in);
+      if (vm_native_ready(vm, fn))
+        goto vm_native;
+      VM_DISPATCH();
+    }
+
+    // range loop without trips takes following OP_JMP past its body
+    VM_CASE(OP_FORPREP) {
+      R[in.a + 1] = range_trips(R[in.a], R[in.a + 1], R[in.a + 2]);
+      if (R[in.a + 1] > 0) {
+        R[in.b] = R[in.a];
+        pc++;
+      } else {
+        pc = fn->code + INSTR_BX(*pc);
+      }
+      VM_DISPATCH();
+    }
+
+    VM_CASE(OP_FORLOOP) {
+      STAT_INC(loop_iterations);
+      R[in.a + 1] -= 1;
+      if (R[in.a + 1] > 0) {
+        R[in.a] += R[in.a + 2];
+        R[in.b] = R[in.a];
+        pc = fn->code + INSTR_BX(*pc);
+        if (vm_native_ready(vm, fn))
+          goto vm_native;
+      } else {
+        pc++;
+      }
+      VM_DISPATCH();
+    }
+
+    // caller frame keeps pc past ploop for profiler , serial chunks could
+    // move frame array
+    VM_CASE(OP_PLOOP) {
+      frame->pc = pc;
+      vm_ploop(vm, fn, R, pc - 1);
+      frame = &vm->frames[vm->frame_count - 1];
+      pc = fn->code + INSTR_BX(pc[in.c]);
+      VM_DISPATCH();
+    }
+
+    VM_CASE(OP_REDUCE) {
+      elog("OP_REDUCE is data of OP_PLOOP and never runs");
+      VM_DISPATCH();
+    }
+
+    VM_CASE(OP_PEND) {
+      STAT_ADD(instructions, executed);
+      return 0.0;
+    }
+
+    VM_CASE(OP_JMPF) {
+      if (R[in.a] == 0.0)
+        pc = fn->code + INSTR_BX(in);
+      VM_DISPATCH();
+    }
+
+    VM_CASE(OP_GETI) {
+      R[in.a] = array_get(R[in.b], R[in.c]);
+      VM_DISPATCH();
+    }
+
+    VM_CASE(OP_SETI) {
+      array_set(R[in.a], R[in.b], R[in.c]);
+      VM_DISPATCH();
+    }
+
+    // guard before the loop checked both array and index
+    VM_CASE(OP_GETU) {
+      R[in.a] = array_header(R[in.b])->data[(size_t)R[in.c]];
+      VM_DISPATCH();
+    }
+
+    VM_CASE(OP_SETU) {
+      array_header(R[in.a])->data[(size_t)R[in.b]] = R[in.c];
+      VM_DISPATCH();
+    }
+
+    // failed guard takes following OP_JMP to checked version of loop
+    VM_CASE(OP_GUARD) {
+      pc = array_fits(R + in.a, R[in.b], (int16_t)in.c)
+               ? pc + 1
+               : fn->code + INSTR_BX(*pc);
+      VM_DISPATCH();
+    }
+
+    VM_CASE(OP_NATIVE) {
+      R[in.a] = builtins[in.c].fn(R + in.a);
+      VM_DISPATCH();
+    }
+
+    VM_CASE(OP_PRINT) {
+      print_value(R[in.a]);
+      VM_DISPATCH();
+    }
+
+    VM_CASE(OP_DEFN) {
+      vm_define_function(vm, fn->protos[in.b]);
+      VM_DISPATCH();
+    }
+
+    VM_CASE(OP_CALL) {
+      callee = vm_callee(vm, fn, in);
+    vm_call:
+      if (vm_recall(callee, R + in.a, &R[in.a]))
+        VM_DISPATCH();
+
+      STAT_INC(function_calls);
+      frame->pc = pc;
+      frame = vm_push_frame(vm, callee, R + in.a, in.a);
+
+      VM_LOAD_FRAME();
+      if (vm_native_ready(vm, fn))
+        goto vm_native;
+      VM_DISPATCH();
+    }
+
+    VM_CASE(OP_TAILCALL) {
+      callee = vm_callee(vm, fn, in);
+      if (callee != fn)
+        goto vm_call;
+
+      vm_reuse_frame(fn, R, R + in.a);
+      pc = fn->code;
+      if (vm_native_ready(vm, fn))
+        goto vm_native;
+      VM_DISPATCH();
+    }
+
+    VM_CASE(OP_RET) {
+      value = R[in.a];
+    vm_return:
+      ret_reg = frame->ret_reg;
+      vm_remember(vm, value);
+      vm_pop_frame(vm);
+
+      if (vm->frame_count == base) {
+        STAT_ADD(instructions, executed);
+        return value;
+      }
+
+      frame = &vm->frames[vm->frame_count - 1];
+      VM_LOAD_FRAME();
+      R[ret_reg] = value;
+      VM_DISPATCH();
+    }
+  }
+
+  return 0.0;
+}
+
+// every live value of script is in registers of frames
+static void vm_roots(void *context, array_visit visit) {
+  vm_t *vm = context;
+  frame_visit(vm->stack, visit);
+}
+
+double vm_run(proto *main_proto) {
+  if (!main_proto)
+    elog("Can't run vm with null ptr on main proto");
+
+  visit_protos(main_proto, vm_reset_callees, NULL);
+
+  uint64_t started = stats_phase_begin();
+  symbol_map funcs;
+  symbol_map_init(&funcs);
+  vm_t vm = {.funcs = &funcs};
+  vm.stack = new_frame_stack();
+  vm.jit = jit_enabled() && !profile_active();
+  vm_push_frame(&vm, main_proto, NULL, 0);
+  arrays_set_roots(vm_roots, &vm);
+
+  double result = vm_execute(&vm, 0);
+
+  stats_phase_end(PHASE_execute, started);
+  free_frame_stack(vm.stack);
+  free(vm.frames);
+  vm_free_workers(&vm);
+  symbol_map_free(&funcs);
+  free_arrays();
+  return result;
+}
@@ -0,0 +1,8 @@
+#ifndef VM_H
+#define VM_H
+
+#include "bytecode.h"
+
+double vm_run(proto *main_proto);
+
+#endif
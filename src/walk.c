@@ -0,0 +1,113 @@
+#include "walk.h"
+#include "logger.h"
+#include <stdlib.h>
+
+static void push_step(walker *w, ast_node *node, ast_node *parent,
+                      bool leaving) {
+  if (!node)
+    return;
+
+  if (w->count >= w->capacity) {
+    w->capacity = w->capacity ? w->capacity * 2 : 32;
+    w->steps = realloc(w->steps, sizeof(walk_step) * w->capacity);
+    if (!w->steps)
+      elog("Error allocation memory for ast walk");
+  }
+  w->steps[w->count++] =
+      (walk_step){.node = node, .parent = parent, .leaving = leaving};
+}
+
+// children go on stack in reverse , so the first one is on top
+static void push_children(walker *w, ast_node *node) {
+  switch (node->type) {
+  case NODE_BIN_OP:
+    push_step(w, node->data.binary.right, node, false);
+    push_step(w, node->data.binary.left, node, false);
+    break;
+  case NODE_ASSIGNMENT:
+    push_step(w, node->data.assignment.value, node, false);
+    break;
+  case NODE_IF:
+    push_step(w, node->data.if_stmt.else_body, node, false);
+    push_step(w, node->data.if_stmt.if_body, node, false);
+    push_step(w, node->data.if_stmt.condition, node, false);
+    break;
+  case NODE_LOOP:
+    push_step(w, node->data.loop.loop_body, node, false);
+    push_step(w, node->data.loop.condition, node, false);
+    break;
+  case NODE_RANGE_LOOP:
+    push_step(w, node->data.range_loop.loop_body, node, false);
+    push_step(w, node->data.range_loop.step, node, false);
+    push_step(w, node->data.range_loop.end, node, false);
+    push_step(w, node->data.range_loop.start, node, false);
+    break;
+  case NODE_PRINT:
+    push_step(w, node->data.print.expression, node, false);
+    break;
+  case NODE_BLOCK:
+    for (size_t i = node->data.block.statements.count; i > 0; i--)
+      push_step(w, node->data.block.statements.items[i - 1], node, false);
+    break;
+  case NODE_FUNCTION_DEF:
+    push_step(w, node->data.function_def.body, node, false);
+    break;
+  case NODE_FUNCTION_CALL:
+    for (size_t i = node->data.function_call.arguments.count; i > 0; i--)
+      push_step(w, node->data.function_call.arguments.items[i - 1], node,
+                false);
+    break;
+  case NODE_RETURN:
+    push_step(w, node->data.return_stm.value, node, false);
+    break;
+  case NODE_INDEX:
+  case NODE_INDEX_ASSIGN:
+    push_step(w, node->data.element.value, node, false);
+    push_step(w, node->data.element.index, node, false);
+    break;
+  default:
+    break;
+  }
+}
+
+void walk_init(walker *w, ast_node *root) {
+  *w = (walker){0};
+  push_step(w, root, NULL, false);
+}
+
+bool walk_next(walker *w, walk_step *step) {
+  if (w->count == 0)
+    return false;
+
+  *step = w->steps[--w->count];
+  if (!step->leaving) {
+    push_step(w, step->node, step->parent, true);
+    w->children = w->count;
+    push_children(w, step->node);
+  }
+  return true;
+}
+
+void walk_skip(walker *w) { w->count = w->children; }
+
+void walk_keep(walker *w, size_t value) {
+  w->steps[w->children - 1].kept = value;
+}
+
+void walk_free(walker *w) {
+  free(w->steps);
+  *w = (walker){0};
+}
+
+bool is_expression(const ast_node *node) {
+  switch (node->type) {
+  case NODE_NUMBER:
+  case NODE_VARIABLE:
+  case NODE_BIN_OP:
+  case NODE_FUNCTION_CALL:
+  case NODE_INDEX:
+    return true;
+  default:
+    return false;
+  }
+}
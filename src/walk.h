@@ -0,0 +1,42 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include "lexer.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Walk over ast kept on a heap stack , passes use it instead of recursion ,
+// so nesting of script never reaches C stack. Node is entered before its
+// children and left after them , children go in source order and missing
+// ones (like absent else) are not walked.
+typedef struct walk_step {
+  ast_node *node;
+  // node whose child this one is , NULL for root
+  ast_node *parent;
+  bool leaving;
+  // value given to walk_keep when node was entered
+  size_t kept;
+} walk_step;
+
+typedef struct walker {
+  walk_step *steps;
+  size_t count;
+  size_t capacity;
+  // steps above it are children of node entered last
+  size_t children;
+} walker;
+
+void walk_init(walker *w, ast_node *root);
+// next step , false when whole tree is walked
+bool walk_next(walker *w, walk_step *step);
+// children of node entered last are not walked , node is still left
+void walk_skip(walker *w);
+// value returned in 'kept' when node entered last is left
+void walk_keep(walker *w, size_t value);
+void walk_free(walker *w);
+
+// number , variable , operator , call or element , statements contain them
+// but they never contain statements
+bool is_expression(const ast_node *node);
+
+#endif